@@ -0,0 +1,434 @@
+/*
+ *     bus_bench.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* End to end throughput and latency of the user bus. A peer thread plays
+ * the kernel on a LoopbackTransport: it opens the channels, then sends
+ * KERNEL_REQUESTs, which the application callback echoes back, and
+ * KERNEL_REPORTs, which it only takes in. Every point of the sweep runs
+ * closed loop, a window of messages in flight, and/or open loop at a fixed
+ * rate. The open loop is coordinated omission correct: a message is
+ * stamped with the time it was due, not the time the peer got to send it,
+ * so a stalled bus shows in the latencies instead of slowing the load.
+ *
+ * One JSON object per run goes to stdout or -o file: per point the
+ * messages and payload bytes per second, the drops, the request round
+ * trip and the report delivery percentiles, and the CPU the bus threads
+ * spent per message, the peer threads excluded.
+ *
+ *     bus_bench [-s sizes] [-c channels] [-m request %s] [-w workers]
+ *               [-l closed,open] [-q window] [-r msg/s] [-d seconds]
+ *               [-o file]
+ *
+ * the sweeps are comma separated lists, e.g. -c 1,1024,1048576
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <vector>
+#include "kubix.h"
+#include "kbx_transport.h"
+#include "kbx_futex.h"
+#include "kbx_hist.h"
+#include "kbx_log.h"
+
+#define UIDS_PER_PID	1024	/* socket uids of a simulated process */
+#define BENCH_PID		1000	/* the first simulated pid */
+#define STALL_NS		2000000000ULL	/* give up on the missing answers */
+
+struct Options{
+    std::vector<int> sizes;
+    std::vector<int> channels;
+    std::vector<int> requests;	/* % of KERNEL_REQUEST, the rest reports */
+    std::vector<int> workers;
+    bool closed;
+    bool open;
+    int window;
+    int rate;
+    double seconds;
+};
+
+struct Channel{
+    int pid;
+    int uid;
+    __u32 seq;
+};
+
+/* the counters of a point; the callback finds it through 'point' */
+struct Point{
+    KubixHistogram request;		/* sent by the peer to answer read */
+    KubixHistogram report;		/* sent by the peer to callback */
+    std::atomic<unsigned long> answers;
+    std::atomic<unsigned long> reports;
+    Point() : answers(0), reports(0) {}
+    unsigned long done() const { return answers.load() + reports.load(); }
+};
+static std::atomic<Point*> point;
+
+struct Reader{
+    LoopbackTransport *lt;
+    Point *pt;
+    std::atomic<int> stop;
+    pthread_t tid;
+    struct rusage usage;
+};
+
+/* ------------------------------------------------------------------------------
+ * the payload starts with the time the message was due
+ * */
+static __u64 dueOf(const void *payload)
+{
+    __u64 due;
+    memcpy(&due, payload, sizeof(due));
+    return due;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static int benchCallback(Kubix *bus, KubixView *view)
+{
+    Point *pt = point.load(std::memory_order_acquire);
+    if(view->hdr->opt == KERNEL_REPORT){
+        pt->report.record(kbx_now_ns() - dueOf(view->data));
+        pt->reports++;
+        return 0;
+    }
+    return bus->send2kernel(view->hdr->pid, view->hdr->uid, view->hdr->opt, 0,
+                            (void*)view->data, view->len);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void *readAnswers(void *arg)
+{
+    Reader *reader = (Reader*)arg;
+    struct kubix_frame frame;
+
+    /* the peer must keep reading: a bus blocked on a full socket stops
+     * receiving as well */
+    while(!reader->stop.load(std::memory_order_relaxed)){
+        if(reader->lt->peerRecv(&frame, 10) <= 0)
+            continue;
+        if(frame.kbx_msg.opt == KERNEL_REQUEST)
+            reader->pt->request.record(kbx_now_ns() - dueOf(frame.buf));
+        reader->pt->answers++;
+    }
+    getrusage(RUSAGE_THREAD, &reader->usage);
+    return NULL;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void startReader(Reader &reader, LoopbackTransport &lt, Point *pt)
+{
+    reader.lt = &lt;
+    reader.pt = pt;
+    reader.stop = 0;
+    point.store(pt, std::memory_order_release);
+    pthread_create(&reader.tid, NULL, readAnswers, &reader);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void stopReader(Reader &reader)
+{
+    reader.stop = 1;
+    pthread_join(reader.tid, NULL);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static __u64 cpuNs(const struct rusage &ru)
+{
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void waitUntil(__u64 due)
+{
+    __u64 now = kbx_now_ns();
+    if(due > now + 100000){
+        struct timespec ts = { 0, (long)(due - now - 50000) };
+        nanosleep(&ts, NULL);
+    }
+    while(kbx_now_ns() < due)
+        ;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static unsigned long drops(Kubix &bus)
+{
+    KubixRxStats stats;
+    bus.rxStats(stats);
+    return stats.drops;
+}
+/* ------------------------------------------------------------------------------
+ * waits for the answers and reports of 'sent' messages, the dropped ones
+ * aside
+ * @return - 'false' if some are still missing after STALL_NS.
+ * */
+static bool drain(Kubix &bus, Point *pt, unsigned long sent,
+                  unsigned long dropped)
+{
+    __u64 until = kbx_now_ns() + STALL_NS;
+    while(pt->done() + drops(bus) - dropped < sent){
+        if(kbx_now_ns() > until)
+            return false;
+        sched_yield();
+    }
+    return true;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static bool openChannels(Kubix &bus, LoopbackTransport &lt,
+                         std::vector<Channel> &chans, int window)
+{
+    Point pt;
+    Reader reader;
+    unsigned long sent = 0;
+    bool ok = true;
+
+    startReader(reader, lt, &pt);
+    for(Channel &ch : chans){
+        while(sent - pt.done() >= (unsigned long)window)
+            sched_yield();
+        if(lt.peerSend(ch.pid, ch.uid, KUBIX_CHANNEL, 0, ++ch.seq, "open", 5)){
+            ok = false;
+            break;
+        }
+        sent++;
+    }
+    ok = ok && drain(bus, &pt, sent, drops(bus));
+    stopReader(reader);
+    return ok;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void printLatency(FILE *out, const char *name, const KubixHistogram &h)
+{
+    fprintf(out, "\"%s\": {\"count\": %lu, \"p50\": %llu, \"p99\": %llu, "
+            "\"p999\": %llu, \"max\": %llu}", name, h.count(),
+            (unsigned long long)h.percentile(500),
+            (unsigned long long)h.percentile(990),
+            (unsigned long long)h.percentile(999),
+            (unsigned long long)h.max());
+}
+/* ------------------------------------------------------------------------------
+ * one point of the sweep on an open bus
+ * */
+static void run(FILE *out, bool first, Kubix &bus, LoopbackTransport &lt,
+                std::vector<Channel> &chans, const Options &opts, int workers,
+                int size, int requests, bool open)
+{
+    static char payload[PAYLOAD_MAX_SIZE];
+    Point *pt = new Point;
+    Reader reader;
+    struct rusage self0, self1, peer0, peer1;
+    unsigned long dropped = drops(bus);
+    unsigned long sent = 0;
+    size_t next = 0;
+    bool stalled = false;
+
+    startReader(reader, lt, pt);
+    getrusage(RUSAGE_SELF, &self0);
+    getrusage(RUSAGE_THREAD, &peer0);
+    __u64 start = kbx_now_ns();
+    __u64 end = start + (__u64)(opts.seconds * 1e9);
+    for(;;){
+        __u64 due;
+        if(open){
+            due = start + (__u64)(sent * 1e9 / opts.rate);
+            if(due >= end)
+                break;
+            waitUntil(due);
+        }
+        else{
+            __u64 stall = kbx_now_ns() + STALL_NS;
+            while(sent - pt->done() - (drops(bus) - dropped) >=
+                  (unsigned long)opts.window){
+                if(kbx_now_ns() > stall)
+                    break;
+                sched_yield();
+            }
+            due = kbx_now_ns();
+            if(due >= end)
+                break;
+            if(due > stall){
+                stalled = true;
+                break;
+            }
+        }
+        int op = (int)(sent % 100) < requests ? KERNEL_REQUEST : KERNEL_REPORT;
+        memcpy(payload, &due, sizeof(due));
+        Channel &ch = chans[next];
+        next = next + 1 == chans.size() ? 0 : next + 1;
+        if(lt.peerSend(ch.pid, ch.uid, op, 0, ++ch.seq, payload, size)){
+            stalled = true;
+            break;
+        }
+        sent++;
+    }
+    stalled = !drain(bus, pt, sent, dropped) || stalled;
+    __u64 elapsed = kbx_now_ns() - start;
+    getrusage(RUSAGE_THREAD, &peer1);
+    stopReader(reader);
+    getrusage(RUSAGE_SELF, &self1);
+
+    unsigned long done = pt->done();
+    unsigned long lost = drops(bus) - dropped;
+    __u64 peer = cpuNs(peer1) - cpuNs(peer0) + cpuNs(reader.usage);
+    __u64 self = cpuNs(self1) - cpuNs(self0);
+    double secs = elapsed / 1e9;
+
+    fprintf(out, "%s\n    {\"workers\": %d, \"channels\": %zu, \"size\": %d, "
+            "\"requests\": %d, \"mode\": \"%s\", ", first ? "" : ",", workers,
+            chans.size(), size, requests, open ? "open" : "closed");
+    if(open)
+        fprintf(out, "\"rate\": %d, ", opts.rate);
+    else
+        fprintf(out, "\"window\": %d, ", opts.window);
+    fprintf(out, "\"seconds\": %.3f, \"sent\": %lu, \"messages\": %lu, "
+            "\"drops\": %lu, \"stalled\": %s, \"msgs_per_s\": %.0f, "
+            "\"bytes_per_s\": %.0f, \"cpu_ns_per_msg\": %.0f,\n     ", secs,
+            sent, done, lost, stalled ? "true" : "false", done / secs,
+            (double)done * size / secs,
+            done && self > peer ? (double)(self - peer) / done : 0.0);
+    printLatency(out, "request_ns", pt->request);
+    fprintf(out, ", ");
+    printLatency(out, "report_ns", pt->report);
+    fprintf(out, "}");
+    fflush(out);
+
+    fprintf(stderr, "workers %d channels %zu size %d requests %d%% %s: "
+            "%.0f msg/s, request p99 %llu ns%s\n", workers, chans.size(),
+            size, requests, open ? "open" : "closed", done / secs,
+            (unsigned long long)pt->request.percentile(990),
+            stalled ? ", stalled" : "");
+    delete pt;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static std::vector<int> list(const char *arg)
+{
+    std::vector<int> values;
+    for(char *end; *arg; arg = *end ? end + 1 : end){
+        values.push_back(strtol(arg, &end, 0));
+        if(end == arg)
+            break;
+    }
+    return values;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void usage()
+{
+    fprintf(stderr, "usage: bus_bench [-s sizes] [-c channels] "
+            "[-m request %%s] [-w workers] [-l closed,open] [-q window] "
+            "[-r msg/s] [-d seconds] [-o file]\n");
+    exit(2);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int main(int argc, char **argv)
+{
+    Options opts;
+    const char *path = NULL;
+    int opt;
+
+    opts.sizes = list("16,64,256,1024");
+    opts.channels = list("1,64,4096");
+    opts.requests = list("100,50,0");
+    opts.workers = list("1,4");
+    opts.closed = opts.open = true;
+    opts.window = 32;
+    opts.rate = 50000;
+    opts.seconds = 0.5;
+    while((opt = getopt(argc, argv, "s:c:m:w:l:q:r:d:o:h")) != -1){
+        switch(opt){
+        case 's': opts.sizes = list(optarg); break;
+        case 'c': opts.channels = list(optarg); break;
+        case 'm': opts.requests = list(optarg); break;
+        case 'w': opts.workers = list(optarg); break;
+        case 'l':
+            opts.closed = strstr(optarg, "closed") != NULL;
+            opts.open = strstr(optarg, "open") != NULL;
+            break;
+        case 'q': opts.window = atoi(optarg); break;
+        case 'r': opts.rate = atoi(optarg); break;
+        case 'd': opts.seconds = atof(optarg); break;
+        case 'o': path = optarg; break;
+        default: usage();
+        }
+    }
+    for(int size : opts.sizes)
+        if(size < (int)sizeof(__u64) || size > PAYLOAD_MAX_SIZE){
+            fprintf(stderr, "payload sizes are %zu to %d bytes\n",
+                    sizeof(__u64), PAYLOAD_MAX_SIZE);
+            return 2;
+        }
+    if(opts.window < 1 || opts.rate < 1 || opts.seconds <= 0 ||
+       (!opts.closed && !opts.open))
+        usage();
+    FILE *out = path ? fopen(path, "w") : stdout;
+    if(!out){
+        perror(path);
+        return 1;
+    }
+    /* a drop per message in an overloaded open loop is no news */
+    kbx_log_level = KBX_LOG_ERR;
+
+    fprintf(out, "{\"bench\": \"bus_bench\", \"payload_max\": %d, "
+            "\"points\": [", PAYLOAD_MAX_SIZE);
+    bool first = true;
+    for(int workers : opts.workers){
+        for(int channels : opts.channels){
+            /* the closed loop window never overflows a channel queue */
+            KubixConfig config;
+            while(config.queue_depth < opts.window)
+                config.queue_depth <<= 1;
+            config.workers = workers;
+
+            LoopbackTransport lt;
+            Kubix bus(&lt, config);
+            bus._user_view_callback = &benchCallback;
+            bus.runBus();
+
+            std::vector<Channel> chans(channels);
+            for(int i = 0; i < channels; i++){
+                chans[i].pid = BENCH_PID + i / UIDS_PER_PID;
+                chans[i].uid = 1 + i % UIDS_PER_PID;
+                chans[i].seq = 0;
+            }
+            if(!openChannels(bus, lt, chans, opts.window)){
+                fprintf(stderr, "failed to open %d channels\n", channels);
+                lt.peerClose();
+                bus.joinBus();
+                continue;
+            }
+            for(int size : opts.sizes)
+                for(int requests : opts.requests){
+                    if(opts.closed){
+                        run(out, first, bus, lt, chans, opts, workers, size,
+                            requests, false);
+                        first = false;
+                    }
+                    if(opts.open){
+                        run(out, first, bus, lt, chans, opts, workers, size,
+                            requests, true);
+                        first = false;
+                    }
+                }
+            lt.peerClose();
+            bus.joinBus();
+        }
+    }
+    fprintf(out, "\n]}\n");
+    if(path)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ *     map_bench.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* KubixFlatMap against the std::unordered_map the bus used to keep, sized
+ * with BUS_HT_BITS buckets as it was. The keys are what the kernel sends:
+ * one pid and sequential socket uids. Lookups hit in random order, misses
+ * use uids past the last one; nanoseconds per operation, single thread.
+ *
+ *     map_bench [channels ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+#include "kubix.h"
+#include "kbx_futex.h"
+#include "kbx_ebr.h"
+
+#define BENCH_PID		4242
+
+static Node *fake_node(int uid) { return (Node*)(uintptr_t)(((uint64_t)uid << 4) | 8); }
+
+struct BenchResult{
+    double insert;
+    double hit;
+    double miss;
+    double erase;
+    long found;
+};
+
+/* ------------------------------------------------------------------------------ */
+static BenchResult bench_unordered(const std::vector<int> &uids, int n)
+{
+    std::unordered_map<int64_t, Node*> map(1 << BUS_HT_BITS);
+    BenchResult r = { 0, 0, 0, 0, 0 };
+
+    __u64 t0 = kbx_now_ns();
+    for(int i = 0; i < n; i++)
+        map[get_composite_key(BENCH_PID, i)] = fake_node(i);
+    __u64 t1 = kbx_now_ns();
+    for(int uid : uids){
+        auto it = map.find(get_composite_key(BENCH_PID, uid));
+        r.found += it != map.end() && it->second;
+    }
+    __u64 t2 = kbx_now_ns();
+    for(int uid : uids)
+        r.found += map.count(get_composite_key(BENCH_PID, uid + n));
+    __u64 t3 = kbx_now_ns();
+    for(int uid : uids)
+        map.erase(get_composite_key(BENCH_PID, uid));
+    __u64 t4 = kbx_now_ns();
+
+    r.insert = (double)(t1 - t0) / n;
+    r.hit = (double)(t2 - t1) / n;
+    r.miss = (double)(t3 - t2) / n;
+    r.erase = (double)(t4 - t3) / n;
+    return r;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static BenchResult bench_flat(const std::vector<int> &uids, int n)
+{
+    KubixFlatMap<Node*> map(1 << BUS_HT_BITS);
+    BenchResult r = { 0, 0, 0, 0, 0 };
+
+    __u64 t0 = kbx_now_ns();
+    for(int i = 0; i < n; i++)
+        map.put(get_composite_key(BENCH_PID, i), fake_node(i));
+    __u64 t1 = kbx_now_ns();
+    {
+        /* one guard per batch, the way the dispatcher reads */
+        KubixEpoch epoch;
+        for(int uid : uids)
+            r.found += map.find(get_composite_key(BENCH_PID, uid)) != nullptr;
+    }
+    __u64 t2 = kbx_now_ns();
+    {
+        KubixEpoch epoch;
+        for(int uid : uids)
+            r.found += map.find(get_composite_key(BENCH_PID, uid + n)) != nullptr;
+    }
+    __u64 t3 = kbx_now_ns();
+    for(int uid : uids)
+        map.remove(get_composite_key(BENCH_PID, uid));
+    __u64 t4 = kbx_now_ns();
+    KubixEbr::synchronize();
+
+    r.insert = (double)(t1 - t0) / n;
+    r.hit = (double)(t2 - t1) / n;
+    r.miss = (double)(t3 - t2) / n;
+    r.erase = (double)(t4 - t3) / n;
+    return r;
+}
+/* ------------------------------------------------------------------------------ */
+int main(int argc, char **argv)
+{
+    std::vector<int> sizes;
+    for(int i = 1; i < argc; i++)
+        sizes.push_back(atoi(argv[i]));
+    if(sizes.empty())
+        sizes = { 1000, 100000, 1000000 };
+
+    printf("%-14s %9s %9s %9s %9s %9s  (ns/op)\n",
+           "map", "channels", "insert", "hit", "miss", "erase");
+    for(int n : sizes){
+        std::vector<int> uids(n);
+        for(int i = 0; i < n; i++)
+            uids[i] = i;
+        std::shuffle(uids.begin(), uids.end(), std::mt19937(n));
+
+        BenchResult u = bench_unordered(uids, n);
+        BenchResult f = bench_flat(uids, n);
+        if(u.found != n || f.found != n)
+            fprintf(stderr, "%d:%s: lookup mismatch %ld/%ld of %d\n",
+                    __LINE__, __func__, u.found, f.found, n);
+        printf("%-14s %9d %9.1f %9.1f %9.1f %9.1f\n", "unordered_map", n,
+               u.insert, u.hit, u.miss, u.erase);
+        printf("%-14s %9d %9.1f %9.1f %9.1f %9.1f\n", "KubixFlatMap", n,
+               f.insert, f.hit, f.miss, f.erase);
+    }
+    return 0;
+}
@@ -0,0 +1,558 @@
+/*
+ *     node_bench.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Contention of the channel table operations, createNode, findNode and
+ * eraseNode, against the number of threads, for several tables side by
+ * side. A table is a class with create, find and erase of a (pid, uid)
+ * channel; TABLES lists the ones compared:
+ *
+ *     bus      Kubix::createNode/findNode/eraseNode of an idle bus, the
+ *              whole path with the counter slots
+ *     sharded  NodeTable, NODE_TABLE_SHARDS shards
+ *     single   NodeTable, one shard
+ *     locked   std::unordered_map under a rwlock, the baseline
+ *
+ * The keys are laid out as the kernel hands them out: 'sockets' are
+ * sequential socket uids of a few processes, 'pids' are many processes
+ * with two sockets each. The workloads:
+ *
+ *     find     lookups of random live channels
+ *     mixed    one erase and re-create per WRITE_EVERY ops of a thread
+ *              on its own channels, the rest lookups
+ *     churn    open/close cycles: a thread creates a channel with the
+ *              next uid, looks it up and erases its oldest one
+ *
+ * One op in LAT_EVERY is timed for the latency percentiles, a clock read
+ * per op would cost more than a lookup. The resident memory per 100k
+ * channels is measured in a child process per table, before the threads.
+ *
+ *     node_bench [-t tables] [-k keys] [-w workloads] [-n channels]
+ *                [-o ops per thread] [-T max threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <unordered_map>
+#include "kubix.h"
+#include "kbx_transport.h"
+#include "kbx_futex.h"
+#include "kbx_ebr.h"
+#include "kbx_hist.h"
+#include "kbx_log.h"
+
+#define MAX_THREADS		64
+#define WRITE_EVERY		64
+#define LAT_EVERY		16
+#define BENCH_PID		1000
+
+struct Layout{
+    const char *name;
+    int uids;			/* sockets per process */
+    int stride;			/* pid distance between the processes */
+};
+static const Layout LAYOUTS[] = {
+    { "sockets", 1024, 1 },
+    { "pids", 2, 7 },
+};
+
+enum { WL_FIND, WL_MIXED, WL_CHURN, WORKLOADS };
+static const char *WORKLOAD_NAMES[] = { "find", "mixed", "churn" };
+
+/* ------------------------------------------------------------------------------
+ * the channel of key index i
+ * */
+static inline int pidOf(const Layout *l, long i)
+{
+    return BENCH_PID + (int)(i / l->uids) * l->stride;
+}
+static inline int uidOf(const Layout *l, long i)
+{
+    return 1 + (int)(i % l->uids);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The tables. create() fails on a live channel, find() is a lookup the
+ * caller does not keep, erase() drops the node.
+ * */
+class BusTable{
+public:
+    BusTable(int) : _bus(&_lt, config()) {}
+    static const char *name() { return "bus"; }
+
+    bool create(int pid, int uid)
+    {
+        Node *node;
+        return _bus.createNode(pid, uid, node);
+    }
+    bool find(int pid, int uid)
+    {
+        Node *node;
+        return _bus.findNode(pid, uid, node);
+    }
+    bool erase(int pid, int uid)
+    {
+        Node *node;
+        if(!_bus.eraseNode(pid, uid, node))
+            return false;
+        node->put();
+        return true;
+    }
+
+private:
+    static KubixConfig config()
+    {
+        KubixConfig config;
+        config.stats = 0;
+        return config;
+    }
+    LoopbackTransport _lt;
+    Kubix _bus;
+};
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+template<int SHARDS>
+class NodeTableOf{
+public:
+    NodeTableOf(int capacity) : _table(SHARDS, capacity) {}
+    ~NodeTableOf() { _table.purify(); }
+    static const char *name() { return SHARDS == 1 ? "single" : "sharded"; }
+
+    bool create(int pid, int uid)
+    {
+        Node *node = new Node(pid, uid, NODE_QUEUE_DEPTH, OVERFLOW_DROP_NEWEST);
+        if(_table.insert(get_composite_key(pid, uid), node))
+            return true;
+        delete node;
+        return false;
+    }
+    bool find(int pid, int uid)
+    {
+        KubixEpoch epoch;
+        return _table.find(get_composite_key(pid, uid)) != nullptr;
+    }
+    bool erase(int pid, int uid)
+    {
+        Node *node = _table.erase(get_composite_key(pid, uid));
+        if(!node)
+            return false;
+        node->put();
+        return true;
+    }
+
+private:
+    NodeTable _table;
+};
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+class LockedMap{
+public:
+    LockedMap(int capacity)
+    {
+        pthread_rwlock_init(&_lock, NULL);
+        _map.reserve(capacity);
+    }
+    ~LockedMap()
+    {
+        for(auto &kv : _map)
+            kv.second->put();
+        pthread_rwlock_destroy(&_lock);
+    }
+    static const char *name() { return "locked"; }
+
+    bool create(int pid, int uid)
+    {
+        Node *node = new Node(pid, uid, NODE_QUEUE_DEPTH, OVERFLOW_DROP_NEWEST);
+        pthread_rwlock_wrlock(&_lock);
+        bool added = _map.emplace(get_composite_key(pid, uid), node).second;
+        pthread_rwlock_unlock(&_lock);
+        if(!added)
+            delete node;
+        return added;
+    }
+    bool find(int pid, int uid)
+    {
+        pthread_rwlock_rdlock(&_lock);
+        bool found = _map.count(get_composite_key(pid, uid)) != 0;
+        pthread_rwlock_unlock(&_lock);
+        return found;
+    }
+    bool erase(int pid, int uid)
+    {
+        Node *node = nullptr;
+        pthread_rwlock_wrlock(&_lock);
+        auto it = _map.find(get_composite_key(pid, uid));
+        if(it != _map.end()){
+            node = it->second;
+            _map.erase(it);
+        }
+        pthread_rwlock_unlock(&_lock);
+        /* the readers never hold a node past the lock */
+        if(node)
+            node->put();
+        return node != nullptr;
+    }
+
+private:
+    pthread_rwlock_t _lock;
+    std::unordered_map<int64_t, Node*> _map;
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * The op latencies of a thread in the KubixHistogram buckets, merged after
+ * the run
+ * */
+struct Latency{
+    unsigned long bucket[KBX_HIST_BUCKETS];
+    unsigned long count;
+    __u64 max;
+
+    void clear() { memset(this, 0, sizeof(*this)); }
+    void record(__u64 ns)
+    {
+        bucket[KubixHistogram::index(ns)]++;
+        count++;
+        if(ns > max)
+            max = ns;
+    }
+    void add(const Latency &other)
+    {
+        for(int i = 0; i < KBX_HIST_BUCKETS; i++)
+            bucket[i] += other.bucket[i];
+        count += other.count;
+        if(other.max > max)
+            max = other.max;
+    }
+    __u64 percentile(int permille) const
+    {
+        unsigned long rank = (count * permille + 999) / 1000;
+        unsigned long seen = 0;
+        for(int i = 0; i < KBX_HIST_BUCKETS; i++){
+            seen += bucket[i];
+            if(seen && seen >= rank)
+                return std::min(KubixHistogram::upper(i), max);
+        }
+        return max;
+    }
+};
+
+struct Options{
+    unsigned tables;	/* bits of TABLES */
+    unsigned layouts;
+    unsigned workloads;
+    int channels;
+    long ops;
+    int threads;
+};
+
+template<class Table>
+struct BenchCtx{
+    Table *table;
+    const Layout *layout;
+    int workload;
+    int channels;
+    long ops;
+    int id;
+    int threads;
+    pthread_barrier_t *start;
+    long misses;
+    Latency lat;
+};
+
+/* ------------------------------------------------------------------------------
+ * the ops of a thread; the writes of 'mixed' and 'churn' touch its own
+ * channels only, index % threads == id
+ * */
+template<class Table>
+static void *benchThread(void *c)
+{
+    BenchCtx<Table> *ctx = (BenchCtx<Table>*)c;
+    Table *table = ctx->table;
+    const Layout *l = ctx->layout;
+    unsigned long x = 0x9e3779b97f4a7c15ULL * (ctx->id + 1);
+    long oldest = ctx->id;
+    long next = ctx->id + (long)ctx->threads *
+                ((ctx->channels - ctx->id + ctx->threads - 1) / ctx->threads);
+    long misses = 0;
+
+    ctx->lat.clear();
+    pthread_barrier_wait(ctx->start);
+    for(long i = 0; i < ctx->ops; i++){
+        bool timed = i % LAT_EVERY == 0;
+        __u64 t0 = timed ? kbx_now_ns() : 0;
+        bool ok;
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        long key = x % ctx->channels;
+
+        switch(ctx->workload){
+        case WL_MIXED:
+            if(i % WRITE_EVERY == 0){
+                key -= key % ctx->threads - ctx->id;
+                if(key >= ctx->channels)
+                    key -= ctx->threads;
+                ok = table->erase(pidOf(l, key), uidOf(l, key)) &&
+                     table->create(pidOf(l, key), uidOf(l, key));
+                break;
+            }
+            /* fall through */
+        case WL_FIND:
+            ok = table->find(pidOf(l, key), uidOf(l, key));
+            break;
+        default:
+            /* create, find and erase in turn, one op each */
+            switch(i % 3){
+            case 0:
+                ok = table->create(pidOf(l, next), uidOf(l, next));
+                break;
+            case 1:
+                ok = table->find(pidOf(l, next), uidOf(l, next));
+                next += ctx->threads;
+                break;
+            default:
+                ok = table->erase(pidOf(l, oldest), uidOf(l, oldest));
+                oldest += ctx->threads;
+                break;
+            }
+            break;
+        }
+        if(!ok)
+            misses++;
+        if(timed)
+            ctx->lat.record(kbx_now_ns() - t0);
+    }
+    ctx->misses = misses;
+    return (void*)0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+template<class Table>
+static void run(const Options &opts, const Layout *layout, int workload,
+                int threads)
+{
+    Table *table = new Table(opts.channels);
+    pthread_barrier_t start;
+    pthread_t tids[MAX_THREADS];
+    static BenchCtx<Table> ctx[MAX_THREADS];
+    Latency lat;
+    long misses = 0;
+
+    for(long i = 0; i < opts.channels; i++)
+        table->create(pidOf(layout, i), uidOf(layout, i));
+    pthread_barrier_init(&start, NULL, threads + 1);
+    for(int i = 0; i < threads; i++){
+        ctx[i].table = table;
+        ctx[i].layout = layout;
+        ctx[i].workload = workload;
+        ctx[i].channels = opts.channels;
+        ctx[i].ops = opts.ops;
+        ctx[i].id = i;
+        ctx[i].threads = threads;
+        ctx[i].start = &start;
+        pthread_create(&tids[i], NULL, benchThread<Table>, &ctx[i]);
+    }
+    __u64 t0 = kbx_now_ns();
+    pthread_barrier_wait(&start);
+    lat.clear();
+    for(int i = 0; i < threads; i++){
+        pthread_join(tids[i], NULL);
+        lat.add(ctx[i].lat);
+        misses += ctx[i].misses;
+    }
+    __u64 ns = kbx_now_ns() - t0;
+    pthread_barrier_destroy(&start);
+    delete table;
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%s/%s/threads:%d", Table::name(),
+             layout->name, WORKLOAD_NAMES[workload], threads);
+    printf("%-32s %14.0f %8llu %8llu %8llu %10llu %8ld\n", name,
+           (double)opts.ops * threads * 1e9 / ns,
+           (unsigned long long)lat.percentile(500),
+           (unsigned long long)lat.percentile(990),
+           (unsigned long long)lat.percentile(999),
+           (unsigned long long)lat.max, misses);
+    fflush(stdout);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static long residentKb()
+{
+    long size, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if(f){
+        if(fscanf(f, "%ld %ld", &size, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+/* ------------------------------------------------------------------------------
+ * the resident memory of 'channels' channels, in a child: what the parent
+ * freed would be reused and hide the growth
+ * */
+template<class Table>
+static void memory(const Options &opts, const Layout *layout)
+{
+    int fds[2];
+    long kb = -1;
+
+    fflush(stdout);
+    if(pipe(fds))
+        return;
+    pid_t child = fork();
+    if(!child){
+        long before = residentKb();
+        Table *table = new Table(opts.channels);
+        for(long i = 0; i < opts.channels; i++)
+            table->create(pidOf(layout, i), uidOf(layout, i));
+        kb = residentKb() - before;
+        if(write(fds[1], &kb, sizeof(kb)) != sizeof(kb))
+            _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+    if(child < 0 || read(fds[0], &kb, sizeof(kb)) != sizeof(kb))
+        kb = -1;
+    close(fds[0]);
+    if(child > 0)
+        waitpid(child, NULL, 0);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%s", Table::name(), layout->name);
+    if(kb < 0)
+        printf("%-32s %14s\n", name, "failed");
+    else
+        printf("%-32s %14.0f %10.0f\n", name, kb * 100000.0 / opts.channels,
+               kb * 1024.0 / opts.channels);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+template<class Table>
+static void bench(const Options &opts)
+{
+    for(unsigned l = 0; l < sizeof(LAYOUTS) / sizeof(LAYOUTS[0]); l++){
+        if(!(opts.layouts & (1 << l)))
+            continue;
+        for(int w = 0; w < WORKLOADS; w++){
+            if(!(opts.workloads & (1 << w)))
+                continue;
+            for(int threads = 1; threads <= opts.threads; threads *= 2)
+                run<Table>(opts, &LAYOUTS[l], w, threads);
+        }
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+template<class Table>
+static void benchMemory(const Options &opts)
+{
+    for(unsigned l = 0; l < sizeof(LAYOUTS) / sizeof(LAYOUTS[0]); l++)
+        if(opts.layouts & (1 << l))
+            memory<Table>(opts, &LAYOUTS[l]);
+}
+
+/* ------------------------------------------------------------------------------
+ * the tables compared, a new design goes here
+ * */
+struct TableEntry{
+    const char *name;
+    void (*bench)(const Options &opts);
+    void (*memory)(const Options &opts);
+};
+static const TableEntry TABLES[] = {
+    { "bus", bench<BusTable>, benchMemory<BusTable> },
+    { "sharded", bench<NodeTableOf<NODE_TABLE_SHARDS> >,
+      benchMemory<NodeTableOf<NODE_TABLE_SHARDS> > },
+    { "single", bench<NodeTableOf<1> >, benchMemory<NodeTableOf<1> > },
+    { "locked", bench<LockedMap>, benchMemory<LockedMap> },
+};
+#define NTABLES		(int)(sizeof(TABLES) / sizeof(TABLES[0]))
+
+/* @brief  - the bits of the comma separated names found in 'names'
+ */
+static unsigned pick(const char *arg, const char *const *names, int count)
+{
+    unsigned bits = 0;
+    char *list = strdup(arg);
+    char *save;
+    for(char *name = strtok_r(list, ",", &save); name;
+        name = strtok_r(NULL, ",", &save)){
+        int i = 0;
+        while(i < count && strcmp(name, names[i]))
+            i++;
+        if(i == count){
+            fprintf(stderr, "unknown '%s'\n", name);
+            exit(2);
+        }
+        bits |= 1 << i;
+    }
+    free(list);
+    return bits;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void usage()
+{
+    fprintf(stderr, "usage: node_bench [-t bus,sharded,single,locked] "
+            "[-k sockets,pids] [-w find,mixed,churn] [-n channels] "
+            "[-o ops per thread] [-T max threads]\n");
+    exit(2);
+}
+/* ------------------------------------------------------------------------------ */
+int main(int argc, char **argv)
+{
+    const char *table_names[NTABLES];
+    const char *layout_names[] = { LAYOUTS[0].name, LAYOUTS[1].name };
+    Options opts = { (1u << NTABLES) - 1, 3, (1u << WORKLOADS) - 1, 100000,
+                     200000, 8 };
+    int opt;
+
+    for(int i = 0; i < NTABLES; i++)
+        table_names[i] = TABLES[i].name;
+    while((opt = getopt(argc, argv, "t:k:w:n:o:T:h")) != -1){
+        switch(opt){
+        case 't': opts.tables = pick(optarg, table_names, NTABLES); break;
+        case 'k': opts.layouts = pick(optarg, layout_names, 2); break;
+        case 'w':
+            opts.workloads = pick(optarg, WORKLOAD_NAMES, WORKLOADS);
+            break;
+        case 'n': opts.channels = atoi(optarg); break;
+        case 'o': opts.ops = atol(optarg); break;
+        case 'T': opts.threads = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if(opts.channels < 1 || opts.ops < 1 || opts.threads < 1 ||
+       opts.threads > MAX_THREADS)
+        usage();
+    /* the bus table warns of every failed create */
+    kbx_log_level = KBX_LOG_ERR;
+
+    printf("%d channels\n", opts.channels);
+    printf("%-32s %14s %10s\n", "memory", "kB/100k", "B/channel");
+    for(int t = 0; t < NTABLES; t++)
+        if(opts.tables & (1 << t))
+            TABLES[t].memory(opts);
+
+    printf("\n%ld ops per thread, latency of 1 op in %d, 1 write per %d ops "
+           "in mixed\n", opts.ops, LAT_EVERY, WRITE_EVERY);
+    printf("%-32s %14s %8s %8s %8s %10s %8s\n", "benchmark", "ops/s", "p50",
+           "p99", "p999", "max", "misses");
+    for(int t = 0; t < NTABLES; t++)
+        if(opts.tables & (1 << t))
+            TABLES[t].bench(opts);
+    return 0;
+}
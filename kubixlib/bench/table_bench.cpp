@@ -0,0 +1,126 @@
+/*
+ *     table_bench.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Node table operations per second against the number of threads, one
+ * shard versus NODE_TABLE_SHARDS; lookups are lock free in both, the shard
+ * count only spreads the writers. Every WRITE_EVERY-th operation of a
+ * thread erases and re-inserts one of its own channels, the rest are finds
+ * of random channels, the same mix as dispatcher + channel consumers.
+ *
+ *     table_bench [channels] [ops per thread]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "kubix.h"
+#include "kbx_futex.h"
+#include "kbx_ebr.h"
+
+#define MAX_THREADS		8
+#define WRITE_EVERY		64
+
+struct BenchCtx{
+    NodeTable *table;
+    int channels;
+    long ops;
+    int id;
+    int threads;
+    pthread_barrier_t *start;
+    long hits;
+};
+
+/* ------------------------------------------------------------------------------ */
+static void *benchThread(void *c)
+{
+    BenchCtx *ctx = (BenchCtx*)c;
+    unsigned long x = 0x9e3779b97f4a7c15ULL * (ctx->id + 1);
+    long hits = 0;
+
+    pthread_barrier_wait(ctx->start);
+    for(long i = 0; i < ctx->ops; i++){
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        int pid = x % ctx->channels;
+        if(i % WRITE_EVERY == 0){
+            /* own channels only: pid % threads == id */
+            pid -= pid % ctx->threads - ctx->id;
+            if(pid < 0 || pid >= ctx->channels)
+                continue;
+            int64_t key = get_composite_key(pid, pid);
+            Node *node = ctx->table->erase(key);
+            if(node){
+                node->put();
+                ctx->table->insert(key, new Node(pid, pid, 1,
+                                                 OVERFLOW_DROP_NEWEST));
+            }
+            continue;
+        }
+        KubixEpoch epoch;
+        if(ctx->table->find(get_composite_key(pid, pid)))
+            hits++;
+    }
+    ctx->hits = hits;
+    return (void*)0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static double run(int shards, int threads, int channels, long ops)
+{
+    NodeTable table(shards, channels);
+    pthread_barrier_t start;
+    pthread_t tids[MAX_THREADS];
+    BenchCtx ctx[MAX_THREADS];
+
+    for(int pid = 0; pid < channels; pid++)
+        table.insert(get_composite_key(pid, pid),
+                     new Node(pid, pid, 1, OVERFLOW_DROP_NEWEST));
+    pthread_barrier_init(&start, NULL, threads + 1);
+    for(int i = 0; i < threads; i++){
+        ctx[i] = { &table, channels, ops, i, threads, &start, 0 };
+        pthread_create(&tids[i], NULL, benchThread, &ctx[i]);
+    }
+    __u64 t0 = kbx_now_ns();
+    pthread_barrier_wait(&start);
+    for(int i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+    __u64 ns = kbx_now_ns() - t0;
+    pthread_barrier_destroy(&start);
+    table.purify();
+    return (double)ops * threads * 1e9 / ns;
+}
+/* ------------------------------------------------------------------------------ */
+int main(int argc, char **argv)
+{
+    int channels = argc > 1 ? atoi(argv[1]) : 4096;
+    long ops = argc > 2 ? atol(argv[2]) : 1000000;
+    int cfg[] = { 1, NODE_TABLE_SHARDS };
+
+    printf("%d channels, %ld ops per thread, 1 write per %d ops\n",
+           channels, ops, WRITE_EVERY);
+    printf("%8s %8s %14s %10s\n", "shards", "threads", "ops/s", "scaling");
+    for(int s = 0; s < 2; s++){
+        double base = 0;
+        for(int threads = 1; threads <= MAX_THREADS; threads *= 2){
+            double rate = run(cfg[s], threads, channels, ops);
+            if(threads == 1)
+                base = rate;
+            printf("%8d %8d %14.0f %9.2fx\n", cfg[s], threads, rate, rate / base);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ *     wake_bench.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Dispatcher-to-consumer handoff: the condvar path getMessage used to park
+ * on (mutex, pthread_cond_signal per message, a 1 second CLOCK_REALTIME
+ * timedwait) against KubixEvent. Two numbers per path:
+ *  - signal: what the dispatcher pays per message when nobody is parked;
+ *  - wakeup: stamp-to-running latency of a consumer parked on the path,
+ *    the producer lets the consumer park before every message.
+ *
+ *     wake_bench [messages]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include "kbx_futex.h"
+
+#define PARK_US		50	/* time given to the consumer to park */
+
+/* ------------------------------------------------------------------------------
+ * the path Node::setSignalLock/setWaitLock implemented
+ * */
+struct CondPath{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    std::atomic<__u64> stamp;
+
+    CondPath() : stamp(0)
+    {
+        mutex = PTHREAD_MUTEX_INITIALIZER;
+        cond = PTHREAD_COND_INITIALIZER;
+    }
+    void signal(__u64 ns)
+    {
+        stamp.store(ns, std::memory_order_release);
+        pthread_mutex_lock(&mutex);
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+    __u64 take()
+    {
+        __u64 ns;
+        struct timespec ts;
+        while(!(ns = stamp.exchange(0))){
+            pthread_mutex_lock(&mutex);
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1;
+            if(!stamp.load())
+                pthread_cond_timedwait(&cond, &mutex, &ts);
+            pthread_mutex_unlock(&mutex);
+        }
+        return ns;
+    }
+};
+
+/* ------------------------------------------------------------------------------
+ * the path Node::_event implements
+ * */
+struct EventPath{
+    KubixEvent event;
+    std::atomic<__u64> stamp;
+
+    EventPath() : stamp(0) {}
+    void signal(__u64 ns)
+    {
+        stamp.store(ns, std::memory_order_release);
+        event.signal();
+    }
+    __u64 take()
+    {
+        __u64 ns;
+        for(;;){
+            int seq = event.prepare();
+            if((ns = stamp.exchange(0)))
+                return ns;
+            event.wait(seq);
+        }
+    }
+};
+
+/* ------------------------------------------------------------------------------ */
+template<class Path>
+struct Bench{
+    Path path;
+    std::vector<__u64> lat;
+    int count;
+};
+
+template<class Path>
+static void *consumer(void *arg)
+{
+    Bench<Path> *b = (Bench<Path>*)arg;
+    for(int i = 0; i < b->count; i++){
+        __u64 sent = b->path.take();
+        b->lat.push_back(kbx_now_ns() - sent);
+    }
+    return (void*)0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+template<class Path>
+static void run(const char *name, int count)
+{
+    Bench<Path> b;
+    b.count = count;
+    b.lat.reserve(count);
+
+    /* nobody parked: the per message cost of the dispatcher */
+    const int signals = 1000000;
+    __u64 t0 = kbx_now_ns();
+    for(int i = 0; i < signals; i++)
+        b.path.signal(0);
+    double signal_ns = (double)(kbx_now_ns() - t0) / signals;
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, &consumer<Path>, &b);
+    for(int i = 0; i < count; i++){
+        usleep(PARK_US);
+        b.path.signal(kbx_now_ns());
+        /* the consumer takes the stamp before the next one */
+        while(b.path.stamp.load(std::memory_order_acquire))
+            sched_yield();
+    }
+    pthread_join(tid, NULL);
+
+    std::sort(b.lat.begin(), b.lat.end());
+    __u64 sum = 0;
+    for(__u64 ns : b.lat)
+        sum += ns;
+    printf("%-10s %9.1f %9.1f %9llu %9llu %9llu\n", name, signal_ns,
+           (double)sum / count,
+           (unsigned long long)b.lat[count / 2],
+           (unsigned long long)b.lat[count * 99 / 100],
+           (unsigned long long)b.lat[count - 1]);
+}
+/* ------------------------------------------------------------------------------ */
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 20000;
+    if(count <= 0)
+        count = 20000;
+
+    printf("%-10s %9s %9s %9s %9s %9s  (ns)\n",
+           "path", "signal", "wake avg", "p50", "p99", "max");
+    run<CondPath>("condvar", count);
+    run<EventPath>("KubixEvent", count);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ *     kbx_buf.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <new>
+#include "kbx_buf.h"
+
+/* ------------------------------------------------------------------------------ */
+void kbx_buf_release(KubixBuf *buf)
+{
+    if(buf && buf->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        buf->pool->recycle(buf);
+}
+/* ------------------------------------------------------------------------------ */
+void KubixView::hold()
+{
+    kbx_buf_hold(buf);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixView::release()
+{
+    kbx_buf_release(buf);
+    buf = nullptr;
+}
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
+KubixBufPool::KubixBufPool(int cache)
+    : _cache(cache)
+    , _slab(KubixSlab::forSize(sizeof(KubixBuf)))
+    , _outstanding(0)
+{
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixBufPool::~KubixBufPool()
+{
+    KubixBuf *buf;
+    while(_cache.pop(buf))
+        _slab->free(buf);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixBuf *KubixBufPool::take()
+{
+    KubixBuf *buf;
+    if(!_cache.pop(buf))
+        return alloc();
+    buf->refs.store(1, std::memory_order_relaxed);
+    _outstanding.fetch_add(1, std::memory_order_relaxed);
+    return buf;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixBuf *KubixBufPool::alloc()
+{
+    void *mem = _slab->alloc();
+    if(!mem)
+        return nullptr;
+    KubixBuf *buf = new (mem) KubixBuf;
+    buf->len = 0;
+    buf->trace = 0;
+    buf->refs.store(1, std::memory_order_relaxed);
+    buf->pool = this;
+    _outstanding.fetch_add(1, std::memory_order_relaxed);
+    return buf;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixBufPool::recycle(KubixBuf *buf)
+{
+    _outstanding.fetch_sub(1, std::memory_order_relaxed);
+    if(!_cache.push(buf))
+        _slab->free(buf);
+}
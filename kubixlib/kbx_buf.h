@@ -0,0 +1,83 @@
+/*
+ * 	kbx_buf.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "kbx_transport.h"
+#include "kbx_slab.h"
+
+#ifndef KBX_BUF_H
+#define KBX_BUF_H
+
+class KubixBufPool;
+/* ------------------------------------------------------------------------------
+ * One received datagram. recvmmsg writes straight into frame, the buffer
+ * then travels by pointer through the node queue to the consumer and goes
+ * back to its pool with the last release.
+ * */
+struct KubixBuf{
+	struct kubix_frame frame;
+	int len;					/* datagram length */
+	__u64 trace;				/* traced: queued then, see kbx_trace.h */
+	std::atomic<int> refs;
+	KubixBufPool *pool;
+};
+
+static inline void kbx_buf_hold(KubixBuf *buf)
+{
+	buf->refs.fetch_add(1, std::memory_order_relaxed);
+}
+void kbx_buf_release(KubixBuf *buf);
+
+/* ------------------------------------------------------------------------------
+ * Receive buffers of a bus. Released buffers from any thread are cached in
+ * a lock-free queue for the dispatcher to take again; what does not fit
+ * the cache goes back to the slab.
+ * */
+class KubixBufPool{
+public:
+	/* @brief  - an empty pool
+	 * @parm   - the number of released buffers kept for reuse
+	 */
+	KubixBufPool(int cache);
+	~KubixBufPool();
+
+	/* @brief  - dispatcher only: a cached buffer or a new one
+	 * @return	 - the buffer with one reference, or nullptr without memory.
+	 */
+	KubixBuf *take();
+
+	/* @brief  - any thread: a new buffer, the cache is not touched
+	 */
+	KubixBuf *alloc();
+
+	/* @brief  - the last reference is gone
+	 */
+	void recycle(KubixBuf *buf);
+
+	/* buffers out of the pool: in receive batches, queues or callbacks */
+	long outstanding() const { return _outstanding.load(std::memory_order_relaxed); }
+
+private:
+	MpscQueue<KubixBuf*> _cache;
+	KubixSlab *_slab;
+	std::atomic<long> _outstanding;
+};
+
+#endif
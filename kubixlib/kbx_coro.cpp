@@ -0,0 +1,230 @@
+/*
+ *     kbx_coro.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <new>
+#include <stdio.h>
+#include "kbx_coro.h"
+#include "kbx_sender.h"
+#include "kbx_slab.h"
+#include "kbx_ebr.h"
+#include "kbx_buf.h"
+#include "kbx_log.h"
+
+#define CORO_SLAB_CACHE		4	/* frame sizes a thread remembers */
+
+/* ------------------------------------------------------------------------------
+ * The slab of a frame size without the registry lock: a program has a few
+ * coroutine functions, so a few frame sizes
+ * */
+static KubixSlab *frameSlab(size_t size)
+{
+    static thread_local struct{
+        size_t size;
+        KubixSlab *slab;
+    } cache[CORO_SLAB_CACHE];
+    static thread_local int next = 0;
+
+    for(int i = 0; i < CORO_SLAB_CACHE; i++)
+        if(cache[i].slab && cache[i].size == size)
+            return cache[i].slab;
+    KubixSlab *slab = KubixSlab::forSize(size);
+    cache[next].size = size;
+    cache[next].slab = slab;
+    next = (next + 1) % CORO_SLAB_CACHE;
+    return slab;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void *KubixCoro::promise_type::operator new(size_t size)
+{
+    void *frame = frameSlab(size)->alloc();
+    if(!frame)
+        throw std::bad_alloc();
+    return frame;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixCoro::promise_type::operator delete(void *frame, size_t size)
+{
+    frameSlab(size)->free(frame);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void kbx_coro_resume(void *parked)
+{
+    KubixReceive *recv = (KubixReceive*)parked;
+    /* the message may be gone to a racing consumer, the coroutine waits on */
+    for(;;){
+        if(recv->take())
+            break;
+        if(recv->park())
+            return;
+    }
+    recv->coro.resume();
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void kbx_coro_answer(void *coro)
+{
+    std::coroutine_handle<>::from_address(coro).resume();
+}
+/* ------------------------------------------------------------------------------
+ * A reply queued without a waiter lives in a slab until the sender is done
+ * */
+static KubixSlab *replySlab()
+{
+    static KubixSlab *slab = KubixSlab::forSize(sizeof(KubixSendReq));
+    return slab;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void replyDone(KubixSendReq *req)
+{
+    req->~KubixSendReq();
+    replySlab()->free(req);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static int sendNoWait(Kubix *bus, int pid, int uid, int op, int ret,
+                      void *payload, int len)
+{
+    void *mem = replySlab()->alloc();
+    if(mem){
+        KubixSendReq *req = new(mem) KubixSendReq;
+        req->done = &replyDone;
+        if(!bus->send2kernelAsync(req, pid, uid, op, ret, payload, len))
+            return 0;
+        replyDone(req);
+    }
+    /* the sender stage is off or full */
+    return bus->send2kernel(pid, uid, op, ret, payload, len);
+}
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
+bool KubixReceive::attach()
+{
+    KubixEpoch epoch;
+    view.hdr = nullptr;
+    view.buf = nullptr;
+    node = nullptr;
+    if(!bus->findNode(pid, uid, node)){
+        KBX_WARN("no related node[%d.%d] object in Kubix", pid, uid);
+        node = nullptr;
+        return false;
+    }
+    /* the wait may outlast an eraseNode */
+    node->get();
+    return true;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool KubixReceive::take()
+{
+    KubixBuf *buf;
+    if(!node->_queue.pop(buf))
+        /* an erased channel gives no message but ends the wait */
+        return node->_queue.closed();
+    node->served();
+    bus->stampTaken(buf);
+    Kubix::setView(view, buf);
+    node->_opt = view.hdr->opt;
+    node->_ret = view.hdr->ret;
+    if(view.seq)
+        node->_taken.store(view.seq, std::memory_order_relaxed);
+    return true;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool KubixReceive::park()
+{
+    void *parked = this;
+    node->_coro.store(parked, std::memory_order_relaxed);
+    /* pairs with the fence in Kubix::routeMessage: either the dispatcher
+     * sees the awaiter, or we see its message */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(node->_queue.empty() && !node->_queue.closed())
+        return true;
+    /* a message slipped in or the channel is erased, take the awaiter back
+     * unless the dispatcher or eraseNode already has it */
+    return !node->_coro.compare_exchange_strong(parked, nullptr);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool KubixReceive::await_suspend(std::coroutine_handle<> handle)
+{
+    coro = handle;
+    for(;;){
+        if(park())
+            return true;
+        if(take())
+            return false;
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixView KubixReceive::await_resume()
+{
+    /* resumed with a message, or without on an erased channel, see
+     * kbx_coro_resume */
+    if(node)
+        node->put();
+    return view;
+}
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
+KubixRequest::KubixRequest(Kubix *bus, int pid, int uid, void *payload,
+                           int len)
+{
+    /* registered before the send, the answer cannot be missed */
+    failed = bus->sendRequest(pid, uid, payload, len, future) != 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool KubixRequest::await_suspend(std::coroutine_handle<> coro)
+{
+    future._coro = coro.address();
+    /* the dispatcher resumes it with the answer, unless it is in already */
+    int state = KBX_FUTURE_PENDING;
+    return future._state.compare_exchange_strong(state, KBX_FUTURE_PARKED);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixView KubixRequest::await_resume()
+{
+    KubixView view;
+    view.hdr = nullptr;
+    view.buf = nullptr;
+    if(!failed && future.ready())
+        future.take(view);
+    return view;
+}
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
+KubixReceive Kubix::receive(int pid, int uid)
+{
+    KubixReceive recv;
+    recv.bus = this;
+    recv.pid = pid;
+    recv.uid = uid;
+    recv.node = nullptr;
+    recv.view.hdr = nullptr;
+    recv.view.buf = nullptr;
+    return recv;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixReply Kubix::reply(int pid, int uid, int op, int ret, void *payload,
+                        int len)
+{
+    KubixReply reply;
+    reply.bus = this;
+    reply.result = sendNoWait(this, pid, uid, op, ret, payload, len);
+    return reply;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixRequest Kubix::request(int pid, int uid, void *payload, int len)
+{
+    return KubixRequest(this, pid, uid, payload, len);
+}
@@ -0,0 +1,141 @@
+/*
+ * 	kbx_coro.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#if __cplusplus < 202002L
+#error "kbx_coro.h needs C++20, build with -std=c++20"
+#endif
+
+#include <coroutine>
+#include "kubix.h"
+#include "kbx_future.h"
+
+#ifndef KBX_CORO_H
+#define KBX_CORO_H
+
+/* ------------------------------------------------------------------------------
+ * Channel conversations as C++20 coroutines. A conversation is a function
+ * returning KubixCoro; it starts at once and runs on the calling thread up
+ * to the first co_await which has to wait. From then on the Kubix
+ * dispatcher resumes it when a message arrives for its channel, right
+ * after the received batch is routed, so any number of conversations
+ * share the dispatcher thread:
+ *
+ *	KubixCoro echo(Kubix &bus, int pid, int uid)
+ *	{
+ *		for(;;){
+ *			KubixView view = co_await bus.receive(pid, uid);
+ *			if(!view.buf)
+ *				co_return;
+ *			co_await bus.reply(pid, uid, view.hdr->opt, 0,
+ *							   (void*)view.data, view.len);
+ *			view.release();
+ *		}
+ *	}
+ *
+ * A resumed conversation must not block, getMessage on the dispatcher
+ * thread never returns. The channel is read by one consumer, a coroutine
+ * or getMessage, and must not be served by _user_app_callback.
+ * Conversations still parked when the bus goes away are not resumed.
+ * */
+class KubixCoro{
+public:
+	struct promise_type{
+		KubixCoro get_return_object() { return KubixCoro(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+
+		/* @brief  - frames come from the slab of their size, the steady
+		 *		   state does not touch the heap
+		 */
+		static void *operator new(size_t size);
+		static void operator delete(void *frame, size_t size);
+	};
+};
+
+/* ------------------------------------------------------------------------------
+ * co_await bus.receive(pid, uid): the next message of the channel as a view
+ * of its receive buffer, the caller releases it. The view has no buffer
+ * if there is no such channel or it is erased; a wake which finds the
+ * queue empty, e.g. taken by a racing consumer, parks the coroutine again.
+ * */
+struct KubixReceive{
+	Kubix *bus;
+	int pid;
+	int uid;
+	Node *node;		/* referenced while the coroutine waits */
+	KubixView view;
+	std::coroutine_handle<> coro;
+
+	bool await_ready() { return !attach() || take(); }
+	bool await_suspend(std::coroutine_handle<> coro);
+	KubixView await_resume();
+
+	bool attach();
+
+	/* @brief  - takes the next message into the view
+	 * @return	 - 'true' with the message, or without one if the channel
+	 *			   is erased and drained; 'false' if there is none yet.
+	 */
+	bool take();
+
+	/* @brief  - hands the awaiter to the dispatcher of the channel
+	 * @return	 - 'false' if a message came meanwhile and it is back.
+	 */
+	bool park();
+};
+
+/* ------------------------------------------------------------------------------
+ * co_await bus.reply(pid, uid, op, ret, payload, len): send2kernel which
+ * does not wait for the sender stage to send, the request is queued to it
+ * if the stage is on. With the stage off or full the message is sent from
+ * the calling thread, which may block on a full socket. Returns 0, or -1
+ * if the message could not be sent.
+ * */
+struct KubixReply{
+	Kubix *bus;
+	int result;
+
+	bool await_ready() { return true; }
+	void await_suspend(std::coroutine_handle<>) {}
+	int await_resume() { return result; }
+};
+
+/* ------------------------------------------------------------------------------
+ * co_await bus.request(pid, uid, payload, len): sendRequest, then waits for
+ * the KERNEL_REPLY acking its sequence number; other messages of the
+ * channel stay queued for its reader. The view has no buffer if the send
+ * failed. A request the kernel never answers keeps the conversation
+ * parked.
+ * */
+struct KubixRequest{
+	KubixRequest(Kubix *bus, int pid, int uid, void *payload, int len);
+
+	KubixFuture future;
+	bool failed;
+
+	bool await_ready() { return failed || future.ready(); }
+	bool await_suspend(std::coroutine_handle<> coro);
+	KubixView await_resume();
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ *     kbx_ebr.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <sched.h>
+#include "kbx_ebr.h"
+
+std::atomic<unsigned long> KubixEbr::_epoch(1);
+std::atomic<KubixEbr::Record*> KubixEbr::_records(nullptr);
+pthread_mutex_t KubixEbr::_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector<KubixEbr::Retired> KubixEbr::_retired;
+thread_local KubixEbr::ThreadSlot KubixEbr::_slot = { nullptr };
+
+/* ------------------------------------------------------------------------------ */
+KubixEbr::ThreadSlot::~ThreadSlot()
+{
+    /* records are never freed, an exiting thread hands its one over */
+    if(rec){
+        rec->epoch.store(0);
+        rec->in_use.store(0);
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixEbr::Record *KubixEbr::acquire()
+{
+    for(Record *rec = _records.load(); rec; rec = rec->next){
+        int free = 0;
+        if(!rec->in_use.load(std::memory_order_relaxed) &&
+           rec->in_use.compare_exchange_strong(free, 1))
+            return rec;
+    }
+    Record *rec = new Record;
+    rec->epoch.store(0);
+    rec->in_use.store(1);
+    rec->depth = 0;
+    rec->next = _records.load();
+    while(!_records.compare_exchange_weak(rec->next, rec))
+        ;
+    return rec;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixEbr::enter()
+{
+    Record *rec = _slot.rec;
+    if(!rec)
+        rec = _slot.rec = acquire();
+    if(rec->depth++)
+        return;
+    /* publish an epoch which is still current after the publication, or
+     * an advance could slip between the load and the store */
+    unsigned long e = _epoch.load();
+    for(;;){
+        rec->epoch.store(e << 1 | 1);
+        unsigned long now = _epoch.load();
+        if(now == e)
+            break;
+        e = now;
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixEbr::exit()
+{
+    Record *rec = _slot.rec;
+    if(!--rec->depth)
+        rec->epoch.store(0, std::memory_order_release);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool KubixEbr::tryAdvance()
+{
+    unsigned long e = _epoch.load();
+    for(Record *rec = _records.load(); rec; rec = rec->next){
+        unsigned long local = rec->epoch.load();
+        if((local & 1) && (local >> 1) != e)
+            return false;
+    }
+    _epoch.store(e + 1);
+    return true;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixEbr::reclaim()
+{
+    unsigned long e = _epoch.load();
+    size_t kept = 0;
+    std::vector<Retired> ready;
+    for(size_t i = 0; i < _retired.size(); i++){
+        if(_retired[i].epoch + 2 <= e)
+            ready.push_back(_retired[i]);
+        else
+            _retired[kept++] = _retired[i];
+    }
+    _retired.resize(kept);
+    /* destructors run unlocked, they may retire again */
+    pthread_mutex_unlock(&_mutex);
+    for(auto &r : ready)
+        r.fn(r.arg);
+    pthread_mutex_lock(&_mutex);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixEbr::retire(void (*fn)(void *arg), void *arg)
+{
+    pthread_mutex_lock(&_mutex);
+    _retired.push_back({ _epoch.load(), fn, arg });
+    if(KBX_EBR_RECLAIM <= _retired.size()){
+        tryAdvance();
+        reclaim();
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixEbr::synchronize()
+{
+    pthread_mutex_lock(&_mutex);
+    while(!_retired.empty()){
+        if(!tryAdvance()){
+            pthread_mutex_unlock(&_mutex);
+            sched_yield();
+            pthread_mutex_lock(&_mutex);
+            continue;
+        }
+        reclaim();
+    }
+    pthread_mutex_unlock(&_mutex);
+}
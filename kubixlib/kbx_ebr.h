@@ -0,0 +1,92 @@
+/*
+ * 	kbx_ebr.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+
+#ifndef KBX_EBR_H
+#define KBX_EBR_H
+
+#define KBX_EBR_RECLAIM		64	/* retired objects which trigger a reclaim */
+
+/* ------------------------------------------------------------------------------
+ * Process wide epoch based reclamation, the userspace take on RCU.
+ * Readers bracket lock-free traversals with a KubixEpoch guard; writers
+ * unlink an object and retire() it, its destructor runs once every thread
+ * that was inside a guard at the time has left it. The global epoch moves
+ * on only when all active readers have observed the current one, so an
+ * object retired in epoch E is unreachable by the time the epoch is E + 2.
+ * */
+class KubixEbr{
+public:
+	/* @brief  - enters a read side critical section, nests
+	 */
+	static void enter();
+	static void exit();
+
+	/* @brief  - defers fn(arg) until no reader can hold arg any more
+	 */
+	static void retire(void (*fn)(void *arg), void *arg);
+
+	/* @brief  - waits until everything retired so far is reclaimed;
+	 *		   must not be called inside a guard
+	 */
+	static void synchronize();
+
+private:
+	struct Record{
+		std::atomic<unsigned long> epoch;	/* epoch << 1 | 1 while inside */
+		std::atomic<int> in_use;
+		int depth;
+		Record *next;
+	};
+	struct Retired{
+		unsigned long epoch;
+		void (*fn)(void *arg);
+		void *arg;
+	};
+	struct ThreadSlot{
+		Record *rec;
+		~ThreadSlot();
+	};
+
+	static Record *acquire();
+	static bool tryAdvance();
+	static void reclaim();
+
+	static std::atomic<unsigned long> _epoch;
+	static std::atomic<Record*> _records;
+	static pthread_mutex_t _mutex;		/* retire list and epoch advance */
+	static std::vector<Retired> _retired;
+	static thread_local ThreadSlot _slot;
+};
+
+/* ------------------------------------------------------------------------------
+ * Read side guard
+ * */
+class KubixEpoch{
+public:
+	KubixEpoch() { KubixEbr::enter(); }
+	~KubixEpoch() { KubixEbr::exit(); }
+};
+
+#endif
@@ -0,0 +1,380 @@
+/*
+ * 	kbx_flatmap.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <atomic>
+#include <stdint.h>
+#include "kbx_ebr.h"
+
+#ifndef KBX_FLATMAP_H
+#define KBX_FLATMAP_H
+
+#define KBX_MAP_MIN_SLOTS	16
+#define KBX_MAP_MIGRATE		16	/* old slots moved by every write in a resize */
+
+/* ------------------------------------------------------------------------------
+ * 64 bit finalizer of MurmurHash3: spreads sequential pids and socket uids
+ * over all bits of the key
+ * */
+static inline uint64_t kbx_mix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+/* ------------------------------------------------------------------------------
+ * Open addressing Robin Hood map from 64 bit composite keys to non-null
+ * pointers. The slots are one flat array probed linearly from the mixed
+ * key, next to a byte array of probe distances; an insert displaces entries
+ * closer to their home slot, so a lookup stops as soon as it meets one and
+ * compares keys only where the distances match, and an erase shifts the
+ * following cluster back by one slot instead of leaving a tombstone.
+ *
+ * Writers are serialized by the caller. Readers take no lock: they run
+ * inside a KubixEpoch guard and validate their probe against a sequence
+ * counter bumped around every write, retrying if a writer moved slots
+ * under them.
+ *
+ * Growing is incremental: a full array becomes the old one, each later
+ * write moves KBX_MAP_MIGRATE of its slots into the twice larger new array
+ * and marks them moved, lookups try the new array first. The old array is
+ * retired through KubixEbr once empty; no write rehashes everything.
+ * */
+template<typename V>
+class KubixFlatMap{
+public:
+	/* @brief  - allocates the slot array
+	 * @parm   - expected number of entries
+	 */
+	KubixFlatMap(int capacity = 0)
+		: _seq(0)
+		, _old(nullptr)
+		, _cursor(0)
+		, _count(0)
+	{
+		uint64_t slots = KBX_MAP_MIN_SLOTS;
+		while(slots * 7 / 8 < (uint64_t)capacity)
+			slots <<= 1;
+		_cur.store(allocate(slots), std::memory_order_relaxed);
+	}
+	~KubixFlatMap()
+	{
+		release(_cur.load(std::memory_order_relaxed));
+		release(_old.load(std::memory_order_relaxed));
+	}
+
+	/* @brief  - lock-free lookup, inside a KubixEpoch guard
+	 * @return	 - the value, or nullptr.
+	 */
+	V find(int64_t key) const
+	{
+		uint64_t h = kbx_mix64((uint64_t)key);
+		for(;;){
+			unsigned long seq = _seq.load(std::memory_order_acquire);
+			if(seq & 1)
+				continue;
+			V value = lookup(_cur.load(std::memory_order_acquire), key, h);
+			if(!value){
+				Table *old = _old.load(std::memory_order_acquire);
+				if(old && (value = lookup(old, key, h)) == moved())
+					value = nullptr;
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if(_seq.load(std::memory_order_relaxed) == seq)
+				return value;
+		}
+	}
+
+	/* @brief  - writer: adds or replaces the value of the key
+	 * @return	 - the replaced value, or nullptr.
+	 */
+	V put(int64_t key, V value)
+	{
+		uint64_t h = kbx_mix64((uint64_t)key);
+		writeBegin();
+		pull(key, h);
+		V prev = nullptr;
+		Table *t = _cur.load(std::memory_order_relaxed);
+		uint64_t i = locate(t, key, h);
+		if(i != NPOS){
+			prev = t->slots[i].value.load(std::memory_order_relaxed);
+			t->slots[i].value.store(value, std::memory_order_relaxed);
+		}
+		else{
+			if((_count + 1) * 8 > (t->mask + 1) * 7){
+				grow();
+				t = _cur.load(std::memory_order_relaxed);
+			}
+			place(t, key, h, value);
+			_count++;
+		}
+		migrate(KBX_MAP_MIGRATE);
+		writeEnd();
+		return prev;
+	}
+
+	/* @brief  - writer: removes the key
+	 * @return	 - the removed value, or nullptr.
+	 */
+	V remove(int64_t key)
+	{
+		uint64_t h = kbx_mix64((uint64_t)key);
+		writeBegin();
+		pull(key, h);
+		Table *t = _cur.load(std::memory_order_relaxed);
+		uint64_t i = locate(t, key, h);
+		V value = nullptr;
+		if(i != NPOS){
+			value = t->slots[i].value.load(std::memory_order_relaxed);
+			shiftBack(t, i);
+			_count--;
+		}
+		migrate(KBX_MAP_MIGRATE);
+		writeEnd();
+		return value;
+	}
+
+	/* @brief  - writer side walk over all entries
+	 */
+	template<typename F>
+	void forEach(F fn) const
+	{
+		Table *tables[2] = { _cur.load(std::memory_order_relaxed),
+							 _old.load(std::memory_order_relaxed) };
+		for(Table *t : tables){
+			if(!t)
+				continue;
+			for(uint64_t i = 0; i <= t->mask; i++){
+				V value = t->slots[i].value.load(std::memory_order_relaxed);
+				if(t->dist[i].load(std::memory_order_relaxed) && value != moved())
+					fn(t->slots[i].key.load(std::memory_order_relaxed), value);
+			}
+		}
+	}
+
+	uint64_t size() const { return _count; }
+	uint64_t capacity() const
+	{
+		return _cur.load(std::memory_order_relaxed)->mask + 1;
+	}
+	bool resizing() const { return _old.load(std::memory_order_relaxed); }
+
+private:
+	struct Slot{
+		std::atomic<int64_t> key;
+		std::atomic<V> value;
+	};
+	struct Table{
+		uint64_t mask;
+		std::atomic<uint8_t> *dist;	/* 0 - empty, else probe distance + 1 */
+		Slot *slots;
+	};
+	static const uint64_t NPOS = ~0ULL;
+	static const uint8_t DIST_SAT = 0xff;	/* far slot, distance from the key */
+
+	static V moved() { return reinterpret_cast<V>((uintptr_t)1); }
+
+	static Table *allocate(uint64_t slots)
+	{
+		Table *t = new Table;
+		t->mask = slots - 1;
+		t->dist = new std::atomic<uint8_t>[slots];
+		t->slots = new Slot[slots];
+		for(uint64_t i = 0; i < slots; i++){
+			t->dist[i].store(0, std::memory_order_relaxed);
+			t->slots[i].key.store(0, std::memory_order_relaxed);
+			t->slots[i].value.store(nullptr, std::memory_order_relaxed);
+		}
+		return t;
+	}
+	static void release(void *arg)
+	{
+		Table *t = (Table*)arg;
+		if(!t)
+			return;
+		delete[] t->slots;
+		delete[] t->dist;
+		delete t;
+	}
+
+	/* probe distance of the occupied slot i, the byte array spares
+	 * rehashing the keys on the way */
+	static uint64_t distance(const Table *t, uint64_t i, uint8_t m)
+	{
+		if(m != DIST_SAT)
+			return m - 1;
+		int64_t key = t->slots[i].key.load(std::memory_order_relaxed);
+		return (i - kbx_mix64((uint64_t)key)) & t->mask;
+	}
+	static void store(Table *t, uint64_t i, int64_t key, V value, uint64_t d)
+	{
+		t->dist[i].store(d < DIST_SAT - 1 ? d + 1 : DIST_SAT,
+						 std::memory_order_relaxed);
+		t->slots[i].key.store(key, std::memory_order_relaxed);
+		t->slots[i].value.store(value, std::memory_order_relaxed);
+	}
+
+	/* the slot of the key or NPOS; a probe stops at the first slot whose
+	 * entry is closer to home than the key would be. Readers may see a
+	 * torn view, it ends within one lap and is caught by _seq. */
+	static uint64_t probe(const Table *t, int64_t key, uint64_t h)
+	{
+		for(uint64_t d = 0; d <= t->mask; d++){
+			uint64_t i = (h + d) & t->mask;
+			/* a hit touches the slot line only, keys are unique */
+			if(t->slots[i].key.load(std::memory_order_relaxed) == key &&
+			   t->slots[i].value.load(std::memory_order_relaxed))
+				return i;
+			uint8_t m = t->dist[i].load(std::memory_order_relaxed);
+			if(!m || distance(t, i, m) < d)
+				return NPOS;
+		}
+		return NPOS;
+	}
+	static V lookup(const Table *t, int64_t key, uint64_t h)
+	{
+		uint64_t i = probe(t, key, h);
+		return i == NPOS ? nullptr :
+			t->slots[i].value.load(std::memory_order_relaxed);
+	}
+
+	/* writer side: live entries only */
+	static uint64_t locate(const Table *t, int64_t key, uint64_t h)
+	{
+		uint64_t i = probe(t, key, h);
+		if(i != NPOS &&
+		   t->slots[i].value.load(std::memory_order_relaxed) == moved())
+			return NPOS;
+		return i;
+	}
+
+	/* Robin Hood insert of a key known to be absent */
+	static void place(Table *t, int64_t key, uint64_t h, V value)
+	{
+		uint64_t i = h & t->mask;
+		for(uint64_t d = 0;; d++, i = (i + 1) & t->mask){
+			uint8_t m = t->dist[i].load(std::memory_order_relaxed);
+			if(!m){
+				store(t, i, key, value, d);
+				return;
+			}
+			uint64_t kd = distance(t, i, m);
+			if(kd < d){
+				/* the richer entry moves on, the poorer one stays */
+				int64_t k = t->slots[i].key.load(std::memory_order_relaxed);
+				V v = t->slots[i].value.load(std::memory_order_relaxed);
+				store(t, i, key, value, d);
+				key = k;
+				value = v;
+				d = kd;
+			}
+		}
+	}
+
+	/* backward shift delete: no tombstones, probe lengths stay short */
+	static void shiftBack(Table *t, uint64_t i)
+	{
+		for(;;){
+			uint64_t next = (i + 1) & t->mask;
+			uint8_t m = t->dist[next].load(std::memory_order_relaxed);
+			if(!m)
+				break;
+			uint64_t kd = distance(t, next, m);
+			if(!kd)
+				break;
+			store(t, i, t->slots[next].key.load(std::memory_order_relaxed),
+				  t->slots[next].value.load(std::memory_order_relaxed), kd - 1);
+			i = next;
+		}
+		t->dist[i].store(0, std::memory_order_relaxed);
+		t->slots[i].value.store(nullptr, std::memory_order_relaxed);
+	}
+
+	/* moves the key out of the old array ahead of the cursor */
+	void pull(int64_t key, uint64_t h)
+	{
+		Table *old = _old.load(std::memory_order_relaxed);
+		if(!old)
+			return;
+		uint64_t i = locate(old, key, h);
+		if(i == NPOS)
+			return;
+		V value = old->slots[i].value.load(std::memory_order_relaxed);
+		place(_cur.load(std::memory_order_relaxed), key, h, value);
+		old->slots[i].value.store(moved(), std::memory_order_relaxed);
+	}
+
+	void migrate(uint64_t steps)
+	{
+		Table *old = _old.load(std::memory_order_relaxed);
+		if(!old)
+			return;
+		Table *t = _cur.load(std::memory_order_relaxed);
+		for(; steps && _cursor <= old->mask; steps--, _cursor++){
+			Slot &s = old->slots[_cursor];
+			if(!old->dist[_cursor].load(std::memory_order_relaxed))
+				continue;
+			V v = s.value.load(std::memory_order_relaxed);
+			if(v == moved())
+				continue;
+			int64_t k = s.key.load(std::memory_order_relaxed);
+			place(t, k, kbx_mix64((uint64_t)k), v);
+			s.value.store(moved(), std::memory_order_relaxed);
+		}
+		if(_cursor > old->mask){
+			_old.store(nullptr, std::memory_order_relaxed);
+			KubixEbr::retire(&KubixFlatMap::release, old);
+		}
+	}
+
+	void grow()
+	{
+		/* one resize at a time: finish the previous one first */
+		migrate(NPOS);
+		Table *t = _cur.load(std::memory_order_relaxed);
+		_old.store(t, std::memory_order_relaxed);
+		_cur.store(allocate((t->mask + 1) * 2), std::memory_order_relaxed);
+		_cursor = 0;
+	}
+
+	void writeBegin()
+	{
+		_seq.store(_seq.load(std::memory_order_relaxed) + 1,
+				   std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+	void writeEnd()
+	{
+		_seq.store(_seq.load(std::memory_order_relaxed) + 1,
+				   std::memory_order_release);
+	}
+
+	std::atomic<unsigned long> _seq;	/* odd while a writer moves slots */
+	std::atomic<Table*> _cur;
+	std::atomic<Table*> _old;			/* being migrated into _cur */
+	uint64_t _cursor;					/* next old slot to migrate */
+	uint64_t _count;
+};
+
+#endif
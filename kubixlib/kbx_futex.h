@@ -0,0 +1,112 @@
+/*
+ * 	kbx_futex.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <atomic>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/types.h>
+
+#ifndef KBX_FUTEX_H
+#define KBX_FUTEX_H
+
+/* ------------------------------------------------------------------------------
+ * Process private futex on a 32 bit atomic word. The wait timeout is
+ * relative and measured on CLOCK_MONOTONIC.
+ * */
+static inline int kbx_futex_wait(std::atomic<int> *word, int val,
+								 const struct timespec *timeout)
+{
+	return syscall(SYS_futex, (int*)word, FUTEX_WAIT_PRIVATE, val, timeout,
+				   NULL, 0);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static inline int kbx_futex_wake(std::atomic<int> *word, int count)
+{
+	return syscall(SYS_futex, (int*)word, FUTEX_WAKE_PRIVATE, count, NULL,
+				   NULL, 0);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static inline __u64 kbx_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ------------------------------------------------------------------------------
+ * Wakeup of a consumer parked on a condition someone else makes true, e.g.
+ * a non-empty queue. The producer pays a futex syscall only if a consumer
+ * is actually parked, otherwise one atomic increment. Usage:
+ *	for(;;){
+ *		int seq = event.prepare();
+ *		if(condition) break;
+ *		event.wait(seq, timeout);
+ *	}
+ * and the producer makes the condition true, then calls signal().
+ * */
+class KubixEvent{
+public:
+	KubixEvent() : _seq(0), _waiters(0) {}
+
+	/* @brief  - snapshot to check the condition against
+	 */
+	int prepare() const { return _seq.load(std::memory_order_acquire); }
+
+	/* @brief  - parks unless signal() came after prepare() returned seq
+	 * @parm1 seq  - the value prepare() returned
+	 * @parm2 timeout - relative, CLOCK_MONOTONIC; null waits for a signal
+	 */
+	void wait(int seq, const struct timespec *timeout = nullptr)
+	{
+		/* pairs with the load of _waiters in signal(): either the
+		 * producer sees us, or we see its _seq increment */
+		_waiters.fetch_add(1, std::memory_order_seq_cst);
+		if(_seq.load(std::memory_order_seq_cst) == seq)
+			kbx_futex_wait(&_seq, seq, timeout);
+		_waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	/* @brief  - wakes up one parked consumer, if any
+	 */
+	void signal()
+	{
+		_seq.fetch_add(1, std::memory_order_seq_cst);
+		if(_waiters.load(std::memory_order_seq_cst))
+			kbx_futex_wake(&_seq, 1);
+	}
+
+	/* @brief  - wakes up all parked consumers, e.g. on shutdown
+	 */
+	void broadcast()
+	{
+		_seq.fetch_add(1, std::memory_order_seq_cst);
+		if(_waiters.load(std::memory_order_seq_cst))
+			kbx_futex_wake(&_seq, 0x7fffffff);
+	}
+
+private:
+	std::atomic<int> _seq;
+	std::atomic<int> _waiters;
+};
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ *     kbx_future.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <errno.h>
+#include "kbx_future.h"
+#include "kbx_futex.h"
+#include "kbx_buf.h"
+
+/* ------------------------------------------------------------------------------ */
+KubixFuture::KubixFuture()
+    : _bus(nullptr)
+    , _pid(0)
+    , _uid(0)
+    , _seq(0)
+    , _reply(nullptr)
+    , _coro(nullptr)
+    , _state(KBX_FUTURE_IDLE)
+{
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixFuture::~KubixFuture()
+{
+    cancel();
+    /* the dispatcher won the race, the reply is on its way */
+    int state = _state.load(std::memory_order_acquire);
+    while(state == KBX_FUTURE_PENDING || state == KBX_FUTURE_WAITING){
+        if(state == KBX_FUTURE_PENDING &&
+           !_state.compare_exchange_weak(state, KBX_FUTURE_WAITING))
+            continue;
+        kbx_futex_wait(&_state, KBX_FUTURE_WAITING, NULL);
+        state = _state.load(std::memory_order_acquire);
+    }
+    if(_reply)
+        kbx_buf_release(_reply);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int KubixFuture::wait(KubixView &view, int timeout_ms)
+{
+    int state = _state.load(std::memory_order_acquire);
+    if(state == KBX_FUTURE_IDLE)
+        return -EINVAL;
+
+    bool timed = 0 <= timeout_ms;
+    __u64 deadline = timed ? kbx_now_ns() + (__u64)timeout_ms * 1000000 : 0;
+    while(state == KBX_FUTURE_PENDING || state == KBX_FUTURE_WAITING){
+        if(state == KBX_FUTURE_PENDING &&
+           !_state.compare_exchange_weak(state, KBX_FUTURE_WAITING))
+            continue;
+        struct timespec ts, *timeout = NULL;
+        if(timed){
+            __u64 now = kbx_now_ns();
+            if(deadline <= now){
+                if(_bus->forgetRequest(this)){
+                    _state.store(KBX_FUTURE_CANCELED, std::memory_order_release);
+                    return -ETIMEDOUT;
+                }
+                /* too late to give up, the reply is being delivered */
+                timed = false;
+                continue;
+            }
+            ts.tv_sec = (deadline - now) / 1000000000ULL;
+            ts.tv_nsec = (deadline - now) % 1000000000ULL;
+            timeout = &ts;
+        }
+        kbx_futex_wait(&_state, KBX_FUTURE_WAITING, timeout);
+        state = _state.load(std::memory_order_acquire);
+    }
+    if(state != KBX_FUTURE_DONE)
+        return -ECANCELED;
+
+    take(view);
+    return 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixFuture::take(KubixView &view)
+{
+    Kubix::setView(view, _reply);
+    _reply = nullptr;
+    _state.store(KBX_FUTURE_IDLE, std::memory_order_relaxed);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixFuture::cancel()
+{
+    int state = _state.load(std::memory_order_acquire);
+    if(state != KBX_FUTURE_PENDING && state != KBX_FUTURE_WAITING)
+        return;
+    if(!_bus->forgetRequest(this))
+        return;
+    if(_state.exchange(KBX_FUTURE_CANCELED) == KBX_FUTURE_WAITING)
+        kbx_futex_wake(&_state, 0x7fffffff);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void *KubixFuture::complete(KubixBuf *buf)
+{
+    _reply = buf;
+    int state = _state.exchange(KBX_FUTURE_DONE);
+    /* the future lives in the frame of the parked coroutine, which stays
+     * suspended until it is resumed */
+    if(state == KBX_FUTURE_PARKED)
+        return _coro;
+    /* a syscall only if the owner went to sleep */
+    if(state == KBX_FUTURE_WAITING)
+        kbx_futex_wake(&_state, 0x7fffffff);
+    return nullptr;
+}
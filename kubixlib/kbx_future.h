@@ -0,0 +1,97 @@
+/*
+ * 	kbx_future.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <atomic>
+#include "kubix.h"
+
+#ifndef KBX_FUTURE_H
+#define KBX_FUTURE_H
+
+/* ------------------------------------------------------------------------------
+ * KubixFuture states
+ * */
+#define KBX_FUTURE_IDLE		0	/* not sent, or the reply has been taken */
+#define KBX_FUTURE_PENDING	1	/* sent, no reply yet */
+#define KBX_FUTURE_WAITING	2	/* sent, the owner sleeps on the state */
+#define KBX_FUTURE_DONE		3	/* the reply is in */
+#define KBX_FUTURE_CANCELED	4	/* given up by cancel() or a timeout */
+#define KBX_FUTURE_PARKED	5	/* sent, a coroutine awaits it, see
+								 * Kubix::request() */
+
+/* ------------------------------------------------------------------------------
+ * The answer of one Kubix::sendRequest. The request carries a sequence
+ * number of its own, the kernel acks it in the KERNEL_REPLY and the
+ * dispatcher hands the reply buffer to the future registered under it, so
+ * requests of one channel complete in any order. The future is owned by
+ * the caller, like a KubixSendReq, and may be reused once done or
+ * cancelled.
+ * */
+class KubixFuture{
+public:
+	KubixFuture();
+
+	/* @brief  - cancels a pending request and drops an unread reply
+	 */
+	~KubixFuture();
+
+	/* @brief  - blocks for the reply
+	 * @parm1 view - the reply as a view of its receive buffer, the caller
+	 *			   releases it; view.hdr->ret is the kernel return code
+	 * @parm2 timeout_ms - -1 waits for ever; when it expires the request
+	 *			   is cancelled
+	 * @return	 - 0 with the reply, -ETIMEDOUT, -ECANCELED, or -EINVAL
+	 *			   if nothing was sent.
+	 */
+	int wait(KubixView &view, int timeout_ms = -1);
+
+	/* @brief  - gives up the request, a wait() returns -ECANCELED; a
+	 *		   reply the dispatcher is delivering already still comes
+	 */
+	void cancel();
+
+	bool ready() const { return _state.load(std::memory_order_acquire) == KBX_FUTURE_DONE; }
+	int state() const { return _state.load(std::memory_order_acquire); }
+	__u32 seq() const { return _seq; }
+
+private:
+	friend class Kubix;
+	friend struct KubixRequest;
+
+	/* @brief  - hands the reply over to the owner
+	 * @return	 - the coroutine parked on the future, to be resumed by
+	 *			   the caller; nullptr if there is none.
+	 */
+	void *complete(KubixBuf *buf);
+
+	/* @brief  - the reply into the view, the future becomes idle
+	 */
+	void take(KubixView &view);
+
+	Kubix *_bus;
+	int _pid;
+	int _uid;
+	__u32 _seq;
+	KubixBuf *_reply;
+	void *_coro;		/* KBX_FUTURE_PARKED: the coroutine handle address */
+	std::atomic<int> _state;
+};
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ *     kbx_hist.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "kbx_hist.h"
+
+/* ------------------------------------------------------------------------------ */
+KubixHistogram::KubixHistogram()
+    : _count(0)
+    , _max(0)
+{
+    for(int i = 0; i < KBX_HIST_BUCKETS; i++)
+        _bucket[i].store(0, std::memory_order_relaxed);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int KubixHistogram::index(__u64 ns)
+{
+    if(ns < KBX_HIST_SUB)
+        return ns;
+    int msb = 63 - __builtin_clzll(ns);
+    if(msb >= KBX_HIST_MAX_BITS)
+        return KBX_HIST_BUCKETS - 1;
+    int shift = msb - KBX_HIST_SUB_BITS;
+    return (shift + 1) * KBX_HIST_SUB + ((ns >> shift) & (KBX_HIST_SUB - 1));
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+__u64 KubixHistogram::upper(int idx)
+{
+    if(idx < KBX_HIST_SUB)
+        return idx;
+    int shift = idx / KBX_HIST_SUB - 1;
+    return ((__u64)(KBX_HIST_SUB + idx % KBX_HIST_SUB + 1) << shift) - 1;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixHistogram::record(__u64 ns)
+{
+    _bucket[index(ns)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    __u64 max = _max.load(std::memory_order_relaxed);
+    while(max < ns && !_max.compare_exchange_weak(max, ns,
+                                                  std::memory_order_relaxed))
+        ;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+__u64 KubixHistogram::percentile(int permille) const
+{
+    unsigned long count = this->count();
+    __u64 max = this->max();
+    if(!count)
+        return 0;
+    /* the buckets may run ahead of the count, never behind it */
+    unsigned long rank = (count * permille + 999) / 1000;
+    unsigned long seen = 0;
+    for(int i = 0; i < KBX_HIST_BUCKETS; i++){
+        seen += _bucket[i].load(std::memory_order_relaxed);
+        if(seen >= rank)
+            return upper(i) < max ? upper(i) : max;
+    }
+    return max;
+}
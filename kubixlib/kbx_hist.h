@@ -0,0 +1,65 @@
+/*
+ * 	kbx_hist.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <atomic>
+#include <linux/types.h>
+
+#ifndef KBX_HIST_H
+#define KBX_HIST_H
+
+/* ------------------------------------------------------------------------------
+ * HDR style histogram of nanoseconds, the buckets of the kubix module
+ * (kbx_latency.h): values under KBX_HIST_SUB count one by one, each power
+ * of two over it splits in KBX_HIST_SUB buckets, so a bucket is at most
+ * 1/16 wide; the last one takes everything past 2^36 ns. Any thread
+ * records, readers walk the buckets without a lock.
+ * */
+#define KBX_HIST_SUB_BITS	4
+#define KBX_HIST_SUB		(1 << KBX_HIST_SUB_BITS)
+#define KBX_HIST_MAX_BITS	36
+#define KBX_HIST_BUCKETS	((KBX_HIST_MAX_BITS - KBX_HIST_SUB_BITS + 1) * \
+							 KBX_HIST_SUB)
+
+class KubixHistogram{
+public:
+	KubixHistogram();
+
+	void record(__u64 ns);
+
+	/* @brief  - the upper bound of the bucket holding the value at
+	 *		   'permille' of the recorded ones, the max if that is lower
+	 * @return	 - 0 if nothing is recorded yet.
+	 */
+	__u64 percentile(int permille) const;
+
+	unsigned long count() const { return _count.load(std::memory_order_relaxed); }
+	__u64 max() const { return _max.load(std::memory_order_relaxed); }
+
+	static int index(__u64 ns);
+	static __u64 upper(int idx);
+
+private:
+	std::atomic<unsigned long> _count;
+	std::atomic<__u64> _max;
+	std::atomic<unsigned long> _bucket[KBX_HIST_BUCKETS];
+};
+
+#endif
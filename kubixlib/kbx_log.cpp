@@ -0,0 +1,254 @@
+/*
+ *     kbx_log.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+#include "kbx_log.h"
+#include "kbx_queue.h"
+
+#define KBX_LOG_LINE		1024	/* longest formatted line */
+#define KBX_LOG_OUT			(64 << 10)	/* lines written by one write() */
+#define KBX_LOG_IDLE_US		1000	/* the drainer sleeps between sweeps, */
+#define KBX_LOG_IDLE_MAX_US	16000	/* twice as long after an empty one */
+
+int kbx_log_level = KBX_LOG_LEVEL;
+
+/* ------------------------------------------------------------------------------
+ * The ring of one thread: the thread is the only producer, the drainer the
+ * only consumer. A ring outlives its thread until it is drained.
+ * */
+struct KubixLogRing{
+    KubixLogRing()
+        : head(0), tail(0), orphan(0), next(nullptr), end(0), gone(0) {}
+
+    alignas(KBX_CACHE_LINE) std::atomic<__u64> head;	/* drainer */
+    alignas(KBX_CACHE_LINE) std::atomic<__u64> tail;	/* the thread */
+    std::atomic<int> orphan;	/* the thread is gone */
+    KubixLogRing *next;
+    __u64 end;					/* the drainer: tail at the sweep */
+    int gone;					/* and orphan */
+    KubixLogRecord recs[KBX_LOG_RING];
+};
+
+/* ------------------------------------------------------------------------------
+ * The rings and the drainer, never destroyed: threads may log while the
+ * static objects go away at exit
+ * */
+struct KubixLog{
+    pthread_mutex_t mutex;		/* the ring list, one drain at a time */
+    KubixLogRing *rings;
+    std::atomic<unsigned long> lost;
+    std::atomic<int> running;
+    pthread_t tid;
+    int used;
+    char out[KBX_LOG_OUT];
+};
+static void *kbx_log_thread(void *arg);
+static void kbx_log_stop();
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static KubixLog *kbx_log()
+{
+    static KubixLog *log = []{
+        KubixLog *log = new KubixLog;
+        log->mutex = PTHREAD_MUTEX_INITIALIZER;
+        log->rings = nullptr;
+        log->lost = 0;
+        log->used = 0;
+        log->running = 1;
+        pthread_create(&log->tid, NULL, &kbx_log_thread, log);
+        atexit(&kbx_log_stop);
+        return log;
+    }();
+    return log;
+}
+
+/* ------------------------------------------------------------------------------
+ * the calling thread ring, taken on its first record and left to the
+ * drainer when the thread exits
+ * */
+struct KubixLogOwner{
+    KubixLogRing *ring = nullptr;
+    ~KubixLogOwner()
+    {
+        if(ring)
+            ring->orphan.store(1, std::memory_order_release);
+        ring = nullptr;
+    }
+};
+static thread_local KubixLogOwner kbx_log_owner;
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static KubixLogRing *kbx_log_ring()
+{
+    KubixLog *log = kbx_log();
+    KubixLogRing *ring = new(std::nothrow) KubixLogRing;
+    if(!ring)
+        return nullptr;
+    pthread_mutex_lock(&log->mutex);
+    ring->next = log->rings;
+    log->rings = ring;
+    pthread_mutex_unlock(&log->mutex);
+    kbx_log_owner.ring = ring;
+    return ring;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixLogRecord *kbx_log_claim()
+{
+    KubixLogRing *ring = kbx_log_owner.ring;
+    if(!ring && !(ring = kbx_log_ring()))
+        return nullptr;
+    __u64 tail = ring->tail.load(std::memory_order_relaxed);
+    if(tail - ring->head.load(std::memory_order_acquire) == KBX_LOG_RING){
+        kbx_log()->lost.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return &ring->recs[tail % KBX_LOG_RING];
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void kbx_log_commit([[maybe_unused]] KubixLogRecord *rec)
+{
+    /* one record at a time: the claimed one is at the tail */
+    KubixLogRing *ring = kbx_log_owner.ring;
+    ring->tail.store(ring->tail.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_release);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+unsigned long kbx_log_lost()
+{
+    return kbx_log()->lost.load(std::memory_order_relaxed);
+}
+
+/* ------------------------------------------------------------------------------
+ * the drain, log->mutex held
+ * */
+static void kbx_log_write_out(KubixLog *log)
+{
+    int done = 0;
+    while(done < log->used){
+        int n = write(STDERR_FILENO, log->out + done, log->used - done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        done += n;
+    }
+    log->used = 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void kbx_log_format(KubixLog *log, const KubixLogRecord *rec)
+{
+    if((int)sizeof(log->out) - log->used < KBX_LOG_LINE)
+        kbx_log_write_out(log);
+    char *line = log->out + log->used;
+    const KubixLogSite *site = rec->site;
+    int n = snprintf(line, KBX_LOG_LINE, "%llu.%06llu %c %d:%s: ",
+                     (unsigned long long)(rec->ns / 1000000000ULL),
+                     (unsigned long long)(rec->ns % 1000000000ULL / 1000),
+                     "EWID"[site->level & 3], site->line, site->func);
+    int len = rec->format(line + n, KBX_LOG_LINE - n, rec);
+    if(0 < len)
+        n += len;
+    if(KBX_LOG_LINE - 1 <= n)
+        n = KBX_LOG_LINE - 2;
+    line[n++] = '\n';
+    log->used += n;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static bool kbx_log_drain(KubixLog *log)
+{
+    bool drained = false;
+    /* what the rings hold now; no more records once a thread is seen gone */
+    for(KubixLogRing *ring = log->rings; ring; ring = ring->next){
+        ring->gone = ring->orphan.load(std::memory_order_acquire);
+        ring->end = ring->tail.load(std::memory_order_acquire);
+    }
+    /* the oldest head of all the rings first, the threads interleave */
+    for(;;){
+        KubixLogRing *first = nullptr;
+        __u64 first_ns = 0;
+        for(KubixLogRing *ring = log->rings; ring; ring = ring->next){
+            __u64 head = ring->head.load(std::memory_order_relaxed);
+            if(head == ring->end)
+                continue;
+            __u64 ns = ring->recs[head % KBX_LOG_RING].ns;
+            if(!first || ns < first_ns){
+                first = ring;
+                first_ns = ns;
+            }
+        }
+        if(!first)
+            break;
+        __u64 head = first->head.load(std::memory_order_relaxed);
+        kbx_log_format(log, &first->recs[head % KBX_LOG_RING]);
+        first->head.store(head + 1, std::memory_order_release);
+        drained = true;
+    }
+    KubixLogRing **link = &log->rings;
+    while(KubixLogRing *ring = *link){
+        if(ring->gone){
+            *link = ring->next;
+            delete ring;
+            continue;
+        }
+        link = &ring->next;
+    }
+    kbx_log_write_out(log);
+    return drained;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void kbx_log_flush()
+{
+    KubixLog *log = kbx_log();
+    pthread_mutex_lock(&log->mutex);
+    kbx_log_drain(log);
+    pthread_mutex_unlock(&log->mutex);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void *kbx_log_thread(void *arg)
+{
+    KubixLog *log = (KubixLog*)arg;
+    int idle_us = KBX_LOG_IDLE_US;
+
+    while(log->running.load(std::memory_order_acquire)){
+        pthread_mutex_lock(&log->mutex);
+        bool drained = kbx_log_drain(log);
+        pthread_mutex_unlock(&log->mutex);
+        /* the producers never wake the drainer, it polls */
+        if(drained)
+            idle_us = KBX_LOG_IDLE_US;
+        else if(idle_us < KBX_LOG_IDLE_MAX_US)
+            idle_us <<= 1;
+        usleep(idle_us);
+    }
+    return (void*)0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void kbx_log_stop()
+{
+    KubixLog *log = kbx_log();
+    log->running.store(0, std::memory_order_release);
+    pthread_join(log->tid, NULL);
+    kbx_log_flush();
+}
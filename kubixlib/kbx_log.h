@@ -0,0 +1,235 @@
+/*
+ * 	kbx_log.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <tuple>
+#include <type_traits>
+#include <linux/types.h>
+
+#ifndef KBX_LOG_H
+#define KBX_LOG_H
+
+/* ------------------------------------------------------------------------------
+ * Severities; the ones over KBX_LOG_LEVEL are compiled out, the format is
+ * still checked. The Makefile passes LOG_LEVEL as KBX_LOG_LEVEL.
+ * */
+#define KBX_LOG_ERR			0
+#define KBX_LOG_WARN		1
+#define KBX_LOG_INFO		2
+#define KBX_LOG_DEBUG		3
+#ifndef KBX_LOG_LEVEL
+#define KBX_LOG_LEVEL		KBX_LOG_INFO
+#endif
+
+#define KBX_LOG_RING		1024	/* records a thread may have undrained */
+#define KBX_LOG_RECORD		128		/* bytes of a record */
+
+/* ------------------------------------------------------------------------------
+ * A log statement, one static instance per call site
+ * */
+struct KubixLogSite{
+	const char *fmt;
+	const char *func;
+	int line;
+	int level;
+};
+
+/* ------------------------------------------------------------------------------
+ * What a thread puts in its ring: the call site, the time and the arguments
+ * in binary; the drainer formats them with the formatter of the argument
+ * types. Scalars go first, the strings are copied after them and may be
+ * cut short.
+ * */
+struct KubixLogRecord{
+	const KubixLogSite *site;
+	int (*format)(char *out, size_t size, const KubixLogRecord *rec);
+	__u64 ns;
+	char args[KBX_LOG_RECORD - 3 * sizeof(__u64)];
+};
+
+/* @brief  - the next free record of the calling thread ring
+ * @return	 - nullptr if the ring is full, the record is counted lost.
+ */
+KubixLogRecord *kbx_log_claim();
+
+/* @brief  - hands the record claimed last over to the drainer
+ */
+void kbx_log_commit(KubixLogRecord *rec);
+
+/* @brief  - formats and writes what every ring holds, from the caller
+ */
+void kbx_log_flush();
+
+/* @brief  - records lost to full rings since the start
+ */
+unsigned long kbx_log_lost();
+
+/* @brief  - the runtime threshold, KBX_LOG_LEVEL at most
+ */
+extern int kbx_log_level;
+
+/* ------------------------------------------------------------------------------
+ * argument packing, see KubixLogRecord
+ * */
+template<typename T>
+struct KubixLogArg{
+	typedef typename std::decay<T>::type type;
+	static const bool string = std::is_same<type, char*>::value ||
+							   std::is_same<type, const char*>::value;
+	static const size_t bytes = string ? 0 : sizeof(type);
+	static_assert(string || (std::is_trivially_copyable<type>::value &&
+							 sizeof(type) <= 8),
+				  "log arguments are scalars, pointers or C strings");
+};
+struct KubixLogCursor{
+	char *scalar;
+	char *str;
+	char *end;
+	size_t strings;		/* still to put, a byte each at least */
+};
+template<typename T>
+static inline void kbx_log_put(KubixLogCursor &c, T value)
+{
+	memcpy(c.scalar, &value, sizeof(T));
+	c.scalar += sizeof(T);
+}
+static inline void kbx_log_put(KubixLogCursor &c, const char *value)
+{
+	size_t room = c.end - c.str - --c.strings;
+	size_t len = value ? strnlen(value, room - 1) : 0;
+	if(len)
+		memcpy(c.str, value, len);
+	c.str[len] = 0;
+	c.str += len + 1;
+}
+struct KubixLogReader{
+	const char *scalar;
+	const char *str;
+};
+template<typename T>
+struct KubixLogGet{
+	static T get(KubixLogReader &r)
+	{
+		T value;
+		memcpy(&value, r.scalar, sizeof(T));
+		r.scalar += sizeof(T);
+		return value;
+	}
+};
+template<>
+struct KubixLogGet<const char*>{
+	static const char *get(KubixLogReader &r)
+	{
+		const char *value = r.str;
+		r.str += strlen(value) + 1;
+		return value;
+	}
+};
+template<>
+struct KubixLogGet<char*>{
+	static const char *get(KubixLogReader &r) { return KubixLogGet<const char*>::get(r); }
+};
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+template<typename... A>
+struct KubixLogFormat{
+	static const size_t scalars = (0 + ... + KubixLogArg<A>::bytes);
+	static const size_t strings = (0 + ... + (KubixLogArg<A>::string ? 1 : 0));
+	static_assert(scalars + strings <= sizeof(KubixLogRecord::args),
+				  "too many log arguments");
+
+	static int format(char *out, size_t size, const KubixLogRecord *rec)
+	{
+		[[maybe_unused]] KubixLogReader r = { rec->args, rec->args + scalars };
+		/* a braced list reads the arguments left to right */
+		std::tuple<typename std::conditional<KubixLogArg<A>::string, const char*,
+						typename KubixLogArg<A>::type>::type...> args{
+			KubixLogGet<typename KubixLogArg<A>::type>::get(r)... };
+		return std::apply([&](auto... a){
+			return snprintf(out, size, rec->site->fmt, a...); }, args);
+	}
+};
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+template<typename... A>
+static inline void kbx_log_write(const KubixLogSite *site, __u64 ns, A... args)
+{
+	KubixLogRecord *rec = kbx_log_claim();
+	if(!rec)
+		return;
+	rec->site = site;
+	rec->format = &KubixLogFormat<A...>::format;
+	rec->ns = ns;
+	[[maybe_unused]] KubixLogCursor c = { rec->args,
+		rec->args + KubixLogFormat<A...>::scalars,
+						 rec->args + sizeof(rec->args),
+						 KubixLogFormat<A...>::strings };
+	(kbx_log_put(c, (typename std::conditional<KubixLogArg<A>::string,
+					 const char*, typename KubixLogArg<A>::type>::type)args), ...);
+	kbx_log_commit(rec);
+}
+
+/* ------------------------------------------------------------------------------
+ * printf like statements; a few stores into the thread ring, no lock and
+ * no syscall. The arguments are scalars, pointers or C strings, the drainer
+ * adds the time, the severity, the line and the function. It merges the
+ * rings by time at every sweep; a record committed during a sweep comes
+ * with the next one, after the lines of this sweep.
+ * */
+#define KBX_LOG(level, fmt, ...) do{ \
+	if(0) fprintf(stderr, fmt, ##__VA_ARGS__); \
+	if((level) <= kbx_log_level){ \
+		static const KubixLogSite kbx_log_site = { fmt, __func__, __LINE__, level }; \
+		kbx_log_write(&kbx_log_site, kbx_log_now(), ##__VA_ARGS__); \
+	} \
+}while(0)
+#define KBX_LOG_OFF(fmt, ...) do{ \
+	if(0) fprintf(stderr, fmt, ##__VA_ARGS__); \
+}while(0)
+
+#define KBX_ERR(fmt, ...)	KBX_LOG(KBX_LOG_ERR, fmt, ##__VA_ARGS__)
+#if KBX_LOG_WARN <= KBX_LOG_LEVEL
+#define KBX_WARN(fmt, ...)	KBX_LOG(KBX_LOG_WARN, fmt, ##__VA_ARGS__)
+#else
+#define KBX_WARN(fmt, ...)	KBX_LOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+#if KBX_LOG_INFO <= KBX_LOG_LEVEL
+#define KBX_INFO(fmt, ...)	KBX_LOG(KBX_LOG_INFO, fmt, ##__VA_ARGS__)
+#else
+#define KBX_INFO(fmt, ...)	KBX_LOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+#if KBX_LOG_DEBUG <= KBX_LOG_LEVEL
+#define KBX_DEBUG(fmt, ...)	KBX_LOG(KBX_LOG_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define KBX_DEBUG(fmt, ...)	KBX_LOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+
+/* @brief  - the record time, CLOCK_MONOTONIC_COARSE: no syscall and no
+ *		   TSC read, good to a tick
+ */
+static inline __u64 kbx_log_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ *     kbx_nodes.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <iostream>
+#include <vector>
+#include "kubix.h"
+#include "kbx_ebr.h"
+
+/* ------------------------------------------------------------------------------ */
+NodeTable::NodeTable(int shards, int capacity)
+{
+    int bits = 0;
+    while((1 << bits) < shards && bits < 16)
+        bits++;
+    _mask = (1 << bits) - 1;
+    /* top bits of the mixed key, the maps index by the low ones */
+    _shift = 64 - bits;
+    _shards = new Shard[_mask + 1];
+    for(int i = 0; i <= _mask; i++){
+        _shards[i].mutex = PTHREAD_MUTEX_INITIALIZER;
+        _shards[i].map = new KubixFlatMap<Node*>(capacity / (_mask + 1));
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+NodeTable::~NodeTable()
+{
+    purify();
+    KubixEbr::synchronize();
+    for(int i = 0; i <= _mask; i++){
+        pthread_mutex_destroy(&_shards[i].mutex);
+        delete _shards[i].map;
+    }
+    delete[] _shards;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void NodeTable::retireNode(Node *node)
+{
+    KubixEbr::retire([](void *arg){ ((Node*)arg)->put(); }, node);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void NodeTable::closeNode(Node *node)
+{
+    node->_state = Node::NLC_DESTROY;
+    /* a dispatcher parked on the full queue is not to wait for a reader,
+     * a reader parked on the empty one is not to wait for the dispatcher */
+    node->_queue.close();
+    node->_event.broadcast();
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool NodeTable::insert(int64_t key, Node *node)
+{
+    Shard &shard = _shards[shardOf(key)];
+    Kubix::setLock lock(&shard.mutex);
+    if(shard.map->find(key))
+        return false;
+    shard.map->put(key, node);
+    return true;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+Node *NodeTable::find(int64_t key)
+{
+    return _shards[shardOf(key)].map->find(key);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+Node *NodeTable::erase(int64_t key)
+{
+    Shard &shard = _shards[shardOf(key)];
+    Kubix::setLock lock(&shard.mutex);
+    Node *node = shard.map->remove(key);
+    if(!node)
+        return nullptr;
+    closeNode(node);
+    node->get();
+    retireNode(node);
+    return node;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void NodeTable::dump()
+{
+    for(int i = 0; i <= _mask; i++){
+        Kubix::setLock lock(&_shards[i].mutex);
+        KubixFlatMap<Node*> *map = _shards[i].map;
+        if(!map->size())
+            continue;
+        std::cerr << "shard #" << i << " [" << map->size() << "/"
+            << map->capacity() << (map->resizing() ? ", resizing" : "")
+            << "] contains:";
+        map->forEach([](int64_t key, Node *node){
+                std::cerr << " " << key << ": "
+                    << "Node[" << node->_pid << "," << node->_unique
+                    << "], " << strNodeState(node->_state);
+            });
+        std::cerr << std::endl;
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void NodeTable::purify()
+{
+    for(int i = 0; i <= _mask; i++){
+        Kubix::setLock lock(&_shards[i].mutex);
+        std::vector<int64_t> keys;
+        _shards[i].map->forEach([&keys](int64_t key, Node*){
+                keys.push_back(key);
+            });
+        for(int64_t key : keys){
+            Node *node = _shards[i].map->remove(key);
+            closeNode(node);
+            retireNode(node);
+        }
+    }
+}
@@ -0,0 +1,107 @@
+/*
+ * 	kbx_nodes.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include "kbx_flatmap.h"
+
+#ifndef KBX_NODES_H
+#define KBX_NODES_H
+
+/* included by kubix.h, KBX_CACHE_LINE comes from kbx_queue.h */
+#define get_composite_key(v1, v2) (int64_t)((((uint64_t)v2) << 32) | (uint64_t)v1)
+
+class Node;
+/* ------------------------------------------------------------------------------
+ * Channel node table split into shards; the shard is chosen by the top bits
+ * of the mixed (pid, uid) key, each shard is a KubixFlatMap. Readers look
+ * up without a lock inside a KubixEpoch guard, writers serialize on the
+ * shard mutex and retire removed nodes through KubixEbr. The table holds
+ * one reference of every node it contains.
+ * */
+class NodeTable{
+public:
+	/* @brief  - creates the shards
+	 * @parm1 shards  - number of shards, rounded up to a power of two
+	 * @parm2 capacity - expected number of nodes over all shards
+	 */
+	NodeTable(int shards, int capacity);
+	~NodeTable();
+
+	/* @brief  - adds a node unless one has the key; an erased node is out
+	 *		   of the table already
+	 * @parm1 key  - get_composite_key(pid, uid)
+	 * @parm2 node - the new node, the table takes over its reference
+	 * @return	 - 'true' if the node was added.
+	 */
+	bool insert(int64_t key, Node *node);
+
+	/* @brief  - lock-free lookup, the caller must be inside a KubixEpoch
+	 *		   guard and take a reference to keep the node past it
+	 */
+	Node *find(int64_t key);
+
+	/* @brief  - unlinks the node, closes it and retires the table's
+	 *		   reference; a getMessage parked on it returns
+	 * @return	 - the node with a reference for the caller, or nullptr.
+	 */
+	Node *erase(int64_t key);
+
+	/* @brief  - calls fn(node) for every node, under the shard lock
+	 */
+	template<typename F>
+	void forEach(F fn)
+	{
+		for(int i = 0; i <= _mask; i++){
+			pthread_mutex_lock(&_shards[i].mutex);
+			_shards[i].map->forEach([&fn](int64_t, Node *node){ fn(node); });
+			pthread_mutex_unlock(&_shards[i].mutex);
+		}
+	}
+
+	/* @brief  - prints the nodes shard by shard
+	 */
+	void dump();
+
+	/* @brief  - unlinks and retires all nodes
+	 */
+	void purify();
+
+	int shards() const { return _mask + 1; }
+	int shardOf(int64_t key) const
+	{
+		return _mask ? (int)(kbx_mix64((uint64_t)key) >> _shift) : 0;
+	}
+
+private:
+	struct alignas(KBX_CACHE_LINE) Shard{
+		pthread_mutex_t mutex;		/* writers only */
+		KubixFlatMap<Node*> *map;
+	};
+	static void retireNode(Node *node);
+	static void closeNode(Node *node);
+
+	Shard *_shards;
+	int _mask;
+	int _shift;
+};
+
+#endif
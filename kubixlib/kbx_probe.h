@@ -0,0 +1,64 @@
+/*
+ * 	kbx_probe.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef KBX_PROBE_H
+#define KBX_PROBE_H
+
+/* ------------------------------------------------------------------------------
+ * USDT probes of the kubix provider: a nop in the code and a note in the
+ * ELF until bpftrace, perf or systemtap attaches to one, so they stay on in
+ * production builds. The Makefile passes USDT as KBX_USDT; without
+ * <sys/sdt.h> (systemtap-sdt-dev) they compile to nothing.
+ *
+ * Every probe takes the channel and the message: pid, uid, op, payload
+ * length and connector seq, 0 where there is none.
+ *
+ *   receive         the dispatcher took a datagram of the bus
+ *   node_create     a channel node went into the table
+ *   node_erase      and out of it
+ *   enqueue         a message went into its channel queue
+ *   drop            the channel queue was full
+ *   wake            the dispatcher woke the consumer of the channel
+ *   callback_begin  the user callback starts on a message
+ *   callback_end    and returns
+ *   send            send2kernel sends to the kernel
+ *
+ *   bpftrace -e 'usdt:./lib64/libkubix.so:kubix:enqueue { @[arg2] = count(); }'
+ * */
+#ifndef KBX_USDT
+#define KBX_USDT	1
+#endif
+
+#if KBX_USDT && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define KBX_PROBE(name, pid, uid, op, len, seq) \
+	DTRACE_PROBE5(kubix, name, pid, uid, op, len, seq)
+#endif
+#endif
+
+/* the arguments are still evaluated: the locals kept for a probe are used */
+#ifndef KBX_PROBE
+#define KBX_PROBE(name, pid, uid, op, len, seq) \
+	do{ (void)(pid); (void)(uid); (void)(op); (void)(len); (void)(seq); }while(0)
+#endif
+
+#endif
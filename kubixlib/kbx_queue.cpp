@@ -0,0 +1,149 @@
+/*
+ *     kbx_queue.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stddef.h>
+#include "kubix.h"
+#include "kbx_buf.h"
+
+/* ------------------------------------------------------------------------------ */
+const char *str_overflow_policy(int policy)
+{
+    switch(policy){
+    case OVERFLOW_BLOCK: return "OVERFLOW_BLOCK"; break;
+    case OVERFLOW_DROP_OLDEST: return "OVERFLOW_DROP_OLDEST"; break;
+    case OVERFLOW_DROP_NEWEST: return "OVERFLOW_DROP_NEWEST"; break;
+    default: return "undefined"; }
+}
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
+NodeQueue::NodeQueue(int depth, int policy)
+    : _head(0)
+    , _tail(0)
+    , _dropped(0)
+    , _closed(false)
+    , _policy(policy)
+{
+    __u64 slots = 1;
+    while((int)slots < depth)
+        slots <<= 1;
+    _mask = slots - 1;
+    _slots = nullptr;
+    _ring = KubixSlab::forSize(slots * sizeof(*_slots));
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+NodeQueue::~NodeQueue()
+{
+    KubixBuf *buf;
+    while(pop(buf))
+        kbx_buf_release(buf);
+    _ring->free(_slots);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool NodeQueue::push(KubixBuf *buf, const std::atomic<int> *running)
+{
+    __u64 tail = _tail.load(std::memory_order_relaxed);
+    __u64 head = _head.load(std::memory_order_acquire);
+
+    while(tail - head > _mask){
+        switch(_policy){
+        case OVERFLOW_DROP_NEWEST:
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        case OVERFLOW_DROP_OLDEST:
+            {
+                /* steal the head slot; losing the race means the consumer
+                 * has just taken it */
+                KubixBuf *old = _slots[head & _mask].load(
+                                        std::memory_order_relaxed);
+                if(_head.compare_exchange_strong(head, head + 1,
+                                                 std::memory_order_acq_rel)){
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    kbx_buf_release(old);
+                }
+                head = _head.load(std::memory_order_acquire);
+            }
+            break;
+        case OVERFLOW_BLOCK:
+        default:
+            {
+                int seq = _space.prepare();
+                if(_closed.load(std::memory_order_seq_cst) ||
+                   (running && !running->load(std::memory_order_seq_cst))){
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                head = _head.load(std::memory_order_acquire);
+                if(tail - head > _mask)
+                    _space.wait(seq);
+                head = _head.load(std::memory_order_acquire);
+            }
+            break;
+        }
+    }
+
+    /* the consumer sees the slots through the release of _tail */
+    if(!_slots){
+        _slots = (std::atomic<KubixBuf*>*)_ring->alloc();
+        if(!_slots){
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+    _slots[tail & _mask].store(buf, std::memory_order_relaxed);
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool NodeQueue::pop(KubixBuf *(&buf))
+{
+    __u64 head = _head.load(std::memory_order_acquire);
+
+    for(;;){
+        if(head == _tail.load(std::memory_order_acquire))
+            return false;
+        buf = _slots[head & _mask].load(std::memory_order_relaxed);
+        if(_head.compare_exchange_strong(head, head + 1))
+            break;
+        /* lost the slot to the producer, head has been reloaded */
+    }
+
+    if(_policy == OVERFLOW_BLOCK)
+        _space.signal();
+    return true;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void NodeQueue::close()
+{
+    _closed.store(true, std::memory_order_seq_cst);
+    _space.broadcast();
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool NodeQueue::empty() const
+{
+    return _head.load(std::memory_order_acquire) ==
+           _tail.load(std::memory_order_acquire);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int NodeQueue::size() const
+{
+    __u64 head = _head.load(std::memory_order_acquire);
+    __u64 tail = _tail.load(std::memory_order_acquire);
+    return tail > head ? (int)(tail - head) : 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * 	kbx_queue.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <atomic>
+#include <linux/types.h>
+#include "kbx_slab.h"
+#include "kbx_futex.h"
+
+#ifndef KBX_QUEUE_H
+#define KBX_QUEUE_H
+
+/* included by kubix.h once PAYLOAD_MAX_SIZE is defined */
+#define KBX_CACHE_LINE		64
+
+/* ------------------------------------------------------------------------------
+ * What the dispatcher does when a node queue is full
+ * */
+enum OVERFLOW_POLICY{
+	OVERFLOW_BLOCK,			/* wait until the consumer frees a slot */
+	OVERFLOW_DROP_OLDEST,	/* discard the oldest queued message */
+	OVERFLOW_DROP_NEWEST,	/* count and discard the incoming message */
+};
+const char *str_overflow_policy(int policy);
+
+struct KubixBuf;
+/* ------------------------------------------------------------------------------
+ * Bounded single-producer/single-consumer ring of a Node holding received
+ * buffers by pointer. The dispatcher is the only producer, the channel
+ * consumer is the only consumer; neither takes a lock or copies payload.
+ * Under OVERFLOW_DROP_OLDEST the producer may steal the head slot, so the
+ * consumer claims each slot by advancing the head with a compare-and-swap
+ * and retries if it lost. The slots are taken from the slab of the ring
+ * size by the first push, a channel which never receives costs nothing.
+ * */
+class NodeQueue{
+public:
+	/* @brief  - allocates the ring
+	 * @parm1 depth  - number of slots, rounded up to a power of two
+	 * @parm2 policy - OVERFLOW_POLICY applied when the ring is full
+	 */
+	NodeQueue(int depth, int policy);
+	~NodeQueue();
+
+	/* @brief  - producer: queues a received buffer
+	 * @parm1 buf  - the buffer; the queue owns its reference on success
+	 * @parm2 running - OVERFLOW_BLOCK: the wait for a slot is given up
+	 *			   once it drops to 0, see interrupt()
+	 * @return	 - 'false' if the message was dropped, the caller keeps
+	 *			   the buffer.
+	 */
+	bool push(KubixBuf *buf, const std::atomic<int> *running = nullptr);
+
+	/* @brief  - wakes up a producer parked on the full ring to look at
+	 *		   its 'running' flag
+	 */
+	void interrupt() { _space.broadcast(); }
+
+	/* @brief  - a closed queue drops what is pushed instead of waiting,
+	 *		   the node is on its way out
+	 */
+	void close();
+	bool closed() const { return _closed.load(std::memory_order_seq_cst); }
+
+	/* @brief  - consumer: takes the oldest buffer out of the ring
+	 * @parm   - the buffer, the caller owns its reference
+	 * @return	 - 'false' if the ring is empty.
+	 */
+	bool pop(KubixBuf *(&buf));
+
+	bool empty() const;
+	int  size() const;
+	int  depth() const { return _mask + 1; }
+	int  policy() const { return _policy; }
+	unsigned long dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+	alignas(KBX_CACHE_LINE) std::atomic<__u64> _head;	/* consumer side */
+	alignas(KBX_CACHE_LINE) std::atomic<__u64> _tail;	/* producer side */
+	std::atomic<unsigned long> _dropped;
+	std::atomic<bool> _closed;
+
+	std::atomic<KubixBuf*> *_slots;	/* from _ring on the first push */
+	KubixSlab *_ring;
+	__u64 _mask;
+	int   _policy;
+
+	/* OVERFLOW_BLOCK only: the producer sleeps here for a free slot */
+	KubixEvent _space;
+};
+
+/* ------------------------------------------------------------------------------
+ * Bounded lock-free multi-producer/single-consumer queue of small values
+ * (pointers), the array based design of D. Vyukov: every cell carries a
+ * sequence number telling producers and the consumer whose turn it is.
+ * */
+template<typename T>
+class MpscQueue{
+public:
+	MpscQueue(int depth)
+		: _tail(0)
+		, _head(0)
+	{
+		__u64 cells = 2;
+		while((int)cells < depth)
+			cells <<= 1;
+		_mask = cells - 1;
+		_cells = new Cell[cells];
+		for(__u64 i = 0; i < cells; i++)
+			_cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+	~MpscQueue()
+	{
+		delete[] _cells;
+	}
+
+	/* @brief  - producer: appends a value, any thread
+	 * @return	 - 'false' if the queue is full.
+	 */
+	bool push(T value)
+	{
+		__u64 pos = _tail.load(std::memory_order_relaxed);
+		Cell *cell;
+		for(;;){
+			cell = &_cells[pos & _mask];
+			__s64 diff = (__s64)cell->seq.load(std::memory_order_acquire) -
+						 (__s64)pos;
+			if(diff == 0){
+				if(_tail.compare_exchange_weak(pos, pos + 1,
+											   std::memory_order_relaxed))
+					break;
+			}
+			else if(diff < 0)
+				return false;
+			else
+				pos = _tail.load(std::memory_order_relaxed);
+		}
+		cell->value = value;
+		cell->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* @brief  - consumer: takes the oldest value, one thread only
+	 * @return	 - 'false' if the queue is empty.
+	 */
+	bool pop(T &value)
+	{
+		__u64 pos = _head.load(std::memory_order_relaxed);
+		Cell *cell = &_cells[pos & _mask];
+		if((__s64)cell->seq.load(std::memory_order_acquire) -
+		   (__s64)(pos + 1) < 0)
+			return false;
+		value = cell->value;
+		cell->seq.store(pos + _mask + 1, std::memory_order_release);
+		_head.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	int size() const
+	{
+		__s64 n = (__s64)(_tail.load(std::memory_order_relaxed) -
+						  _head.load(std::memory_order_relaxed));
+		return n > 0 ? (int)n : 0;
+	}
+
+private:
+	struct Cell{
+		std::atomic<__u64> seq;
+		T value;
+	};
+	alignas(KBX_CACHE_LINE) std::atomic<__u64> _tail;	/* producers */
+	alignas(KBX_CACHE_LINE) std::atomic<__u64> _head;	/* consumer */
+	Cell *_cells;
+	__u64 _mask;
+};
+
+#endif
@@ -0,0 +1,266 @@
+/*
+ *     kbx_sender.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include "kbx_sender.h"
+#include "kbx_log.h"
+
+/* ------------------------------------------------------------------------------ */
+KubixSender::KubixSender(int depth, int batch, int flush_us)
+    : _queue(depth)
+    , _batch(batch < 1 ? 1 : batch)
+    , _flush_us(flush_us < 0 ? 0 : flush_us)
+    , _fd(-1)
+    , _running(0)
+    , _parked(0)
+    , _wake_seq(0)
+    , _syscalls(0)
+    , _sent(0)
+    , _ring(nullptr)
+    , _uring(false)
+{
+    _msgs = new struct mmsghdr[_batch];
+    _iovs = new struct iovec[_batch];
+    memset(_msgs, 0, sizeof(*_msgs) * _batch);
+    for(int i = 0; i < _batch; i++){
+        _msgs[i].msg_hdr.msg_iov = &_iovs[i];
+        _msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixSender::~KubixSender()
+{
+    stop();
+    delete[] _iovs;
+    delete[] _msgs;
+    delete _ring;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixSender::start(int fd, bool uring)
+{
+    _fd = fd;
+    if(uring){
+        _ring = new KubixUring();
+        int ret = _ring->open(_batch);
+        if(ret){
+            KBX_WARN("io_uring '%s' [%d], sendmmsg instead", strerror(-ret),
+                     -ret);
+            delete _ring;
+            _ring = nullptr;
+        }
+        _uring = _ring != nullptr;
+    }
+    _running = 1;
+    pthread_create(&_tid, NULL, &KubixSender::senderThread, this);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixSender::stop()
+{
+    if(!_running.exchange(0))
+        return;
+    _wake_seq.fetch_add(1);
+    kbx_futex_wake(&_wake_seq, 1);
+    pthread_join(_tid, NULL);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool KubixSender::submit(KubixSendReq *req)
+{
+    req->status.store(KBX_SEND_PENDING, std::memory_order_relaxed);
+    if(!_queue.push(req))
+        return false;
+    /* pairs with the fence in senderThread before it parks */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(_parked.load(std::memory_order_relaxed)){
+        _wake_seq.fetch_add(1);
+        kbx_futex_wake(&_wake_seq, 1);
+    }
+    return true;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int KubixSender::wait(KubixSendReq *req)
+{
+    int status = req->status.load(std::memory_order_acquire);
+    while(status == KBX_SEND_PENDING || status == KBX_SEND_WAITING){
+        if(status == KBX_SEND_PENDING &&
+           !req->status.compare_exchange_weak(status, KBX_SEND_WAITING))
+            continue;
+        kbx_futex_wait(&req->status, KBX_SEND_WAITING, NULL);
+        status = req->status.load(std::memory_order_acquire);
+    }
+    return status;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixSender::complete(KubixSendReq *req, int status)
+{
+    if(req->done){
+        req->status.store(status, std::memory_order_release);
+        req->done(req);
+        return;
+    }
+    /* a syscall only if the caller went to sleep */
+    if(req->status.exchange(status) == KBX_SEND_WAITING)
+        kbx_futex_wake(&req->status, 1);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixSender::flush(KubixSendReq **reqs, int count)
+{
+    for(int i = 0; i < count; i++){
+        _iovs[i].iov_base = &reqs[i]->frame;
+        _iovs[i].iov_len = reqs[i]->frame_len;
+    }
+    int done = 0;
+    while(done < count){
+        int sent = sendmmsg(_fd, &_msgs[done], count - done, MSG_NOSIGNAL);
+        _syscalls.fetch_add(1, std::memory_order_relaxed);
+        if(sent == -1){
+            if(errno == EINTR)
+                continue;
+            /* the head of the rest failed, the tail gets another chance */
+            KBX_ERR("sendmmsg errno '%s' [%d]", strerror(errno), errno);
+            complete(reqs[done++], -errno);
+            continue;
+        }
+        for(int i = done; i < done + sent; i++)
+            complete(reqs[i], 0);
+        done += sent;
+        _sent.fetch_add(sent, std::memory_order_relaxed);
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixSender::flushUring(KubixSendReq **reqs, int count)
+{
+    int done = 0;
+    while(done < count){
+        /* linked, so the replies leave in order: a failed send cancels
+         * the rest of the chain, which is resubmitted after it */
+        int queued = 0;
+        struct io_uring_sqe *sqe = nullptr;
+        for(int i = done; i < count; i++){
+            if(!(sqe = _ring->getSqe()))
+                break;
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = _fd;
+            sqe->addr = (unsigned long)&reqs[i]->frame;
+            sqe->len = reqs[i]->frame_len;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = i;
+            queued++;
+        }
+        if(!queued)
+            break;
+        sqe->flags = 0;
+        int ret = _ring->submit(queued);
+        _syscalls.fetch_add(1, std::memory_order_relaxed);
+        if(ret < 0){
+            /* the SQEs are published but not taken: another enter would
+             * send them after the fallback below. The ring is not entered
+             * again, its fd goes with the sender and the SQEs with it */
+            KBX_ERR("io_uring_enter '%s' [%d], sendmmsg from now on",
+                    strerror(-ret), -ret);
+            _uring = false;
+            break;
+        }
+
+        int failed = count;
+        for(int reaped = 0; reaped < queued; ){
+            struct io_uring_cqe *cqe = _ring->peekCqe();
+            if(!cqe){
+                _ring->submit(queued - reaped);
+                continue;
+            }
+            int i = (int)cqe->user_data;
+            if(cqe->res == -ECANCELED){
+                if(i < failed)
+                    failed = i;
+            }else if(cqe->res < 0){
+                KBX_ERR("send errno '%s' [%d]", strerror(-cqe->res), -cqe->res);
+                complete(reqs[i], cqe->res);
+                if(i + 1 < failed)
+                    failed = i + 1;
+            }else{
+                complete(reqs[i], 0);
+                _sent.fetch_add(1, std::memory_order_relaxed);
+            }
+            _ring->cqAdvance(1);
+            reaped++;
+        }
+        done = failed < done + queued ? failed : done + queued;
+    }
+    /* the ring failed under us, the rest goes the old way */
+    if(done < count)
+        flush(reqs + done, count - done);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void *KubixSender::senderThread(void *c)
+{
+    KubixSender *sender = (KubixSender*)c;
+    KubixSendReq **reqs = new KubixSendReq*[sender->_batch];
+    __u64 flush_ns = (__u64)sender->_flush_us * 1000;
+    __u64 deadline = 0;
+    int count = 0;
+
+    KBX_INFO("sender on fd %d, batch %d, flush %d us%s", sender->_fd,
+             sender->_batch, sender->_flush_us,
+             sender->uring() ? ", io_uring" : "");
+
+    for(;;){
+        KubixSendReq *req;
+        if(count < sender->_batch && sender->_queue.pop(req)){
+            if(!count)
+                deadline = kbx_now_ns() + flush_ns;
+            reqs[count++] = req;
+            continue;
+        }
+        __u64 now = 0;
+        if(count &&
+           (count == sender->_batch || (now = kbx_now_ns()) >= deadline ||
+            !sender->_running)){
+            if(sender->uring())
+                sender->flushUring(reqs, count);
+            else
+                sender->flush(reqs, count);
+            count = 0;
+            continue;
+        }
+        if(!sender->_running && !count && !sender->_queue.size())
+            break;
+
+        /* nothing to take: sleep until a submit or the flush deadline */
+        int seq = sender->_wake_seq.load();
+        sender->_parked.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!sender->_queue.size() && sender->_running){
+            struct timespec ts, *timeout = NULL;
+            if(count){
+                __u64 left = deadline - now;
+                ts.tv_sec = left / 1000000000ULL;
+                ts.tv_nsec = left % 1000000000ULL;
+                timeout = &ts;
+            }
+            kbx_futex_wait(&sender->_wake_seq, seq, timeout);
+        }
+        sender->_parked.store(0, std::memory_order_relaxed);
+    }
+    delete[] reqs;
+    return (void*)0;
+}
@@ -0,0 +1,111 @@
+/*
+ * 	kbx_sender.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "kbx_transport.h"
+#include "kbx_futex.h"
+#include "kbx_uring.h"
+
+#ifndef KBX_SENDER_H
+#define KBX_SENDER_H
+
+/* ------------------------------------------------------------------------------
+ * KubixSendReq::status values besides 0-success and -errno
+ * */
+#define KBX_SEND_PENDING	1	/* queued, not sent yet */
+#define KBX_SEND_WAITING	2	/* queued, the caller sleeps on the status */
+
+/* ------------------------------------------------------------------------------
+ * A reply queued to the sender stage; owned by the caller until completion
+ * */
+struct KubixSendReq{
+	KubixSendReq() : done(nullptr) {}
+
+	struct kubix_frame frame;
+	int frame_len;
+	std::atomic<int> status;
+	/* if set, the sender thread calls it with the final status instead
+	 * of waking wait(), e.g. to free a request nobody waits for */
+	void (*done)(KubixSendReq *req);
+};
+
+/* ------------------------------------------------------------------------------
+ * Sender stage: any thread enqueues requests into a lock-free queue, one
+ * sender thread flushes them to the transport with sendmmsg, or with one
+ * io_uring_enter for a chain of linked sends if the uring is on. A batch
+ * is flushed when it holds 'batch' requests or when the first of them has
+ * waited 'flush_us' microseconds, whichever comes first.
+ * */
+class KubixSender{
+public:
+	KubixSender(int depth, int batch, int flush_us);
+	~KubixSender();
+
+	/* @brief  - starts the sender thread on the transport descriptor
+	 * @parm2 uring - flush through io_uring, sendmmsg if it cannot be set up
+	 */
+	void start(int fd, bool uring = false);
+
+	/* @brief  - flushes what is queued and joins the sender thread
+	 */
+	void stop();
+
+	/* @brief  - queues a filled request, its status becomes
+	 *		   KBX_SEND_PENDING
+	 * @return	 - 'false' if the queue is full.
+	 */
+	bool submit(KubixSendReq *req);
+
+	/* @brief  - blocks until the request is sent
+	 * @return	 - 0 on success or -errno of sendmmsg.
+	 */
+	static int wait(KubixSendReq *req);
+
+	unsigned long syscalls() const { return _syscalls.load(std::memory_order_relaxed); }
+	unsigned long sent() const { return _sent.load(std::memory_order_relaxed); }
+	bool uring() const { return _uring.load(std::memory_order_relaxed); }
+
+private:
+	static void *senderThread(void *);
+	void flush(KubixSendReq **reqs, int count);
+	void flushUring(KubixSendReq **reqs, int count);
+	static void complete(KubixSendReq *req, int status);
+
+	MpscQueue<KubixSendReq*> _queue;
+	int _batch;
+	int _flush_us;
+	int _fd;
+	std::atomic<int> _running;
+	pthread_t _tid;
+
+	std::atomic<int> _parked;	/* the sender thread sleeps on _wake_seq */
+	std::atomic<int> _wake_seq;
+
+	std::atomic<unsigned long> _syscalls;
+	std::atomic<unsigned long> _sent;
+
+	struct mmsghdr *_msgs;
+	struct iovec *_iovs;
+	KubixUring *_ring;
+	std::atomic<bool> _uring;	/* flushes go through _ring; off for good
+								 * once it fails, the ring is kept */
+};
+
+#endif
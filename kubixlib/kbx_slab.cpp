@@ -0,0 +1,134 @@
+/*
+ *     kbx_slab.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "kbx_slab.h"
+#include "kbx_log.h"
+
+static pthread_mutex_t slab_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static KubixSlab *slab_registry = nullptr;
+
+/* ------------------------------------------------------------------------------ */
+KubixSlab *KubixSlab::forSize(size_t size)
+{
+    size_t rounded = (size + KBX_SLAB_ALIGN - 1) & ~(size_t)(KBX_SLAB_ALIGN - 1);
+
+    pthread_mutex_lock(&slab_registry_mutex);
+    KubixSlab *slab = slab_registry;
+    while(slab && slab->_size != rounded)
+        slab = slab->_next;
+    if(!slab){
+        slab = new KubixSlab(rounded);
+        slab->_next = slab_registry;
+        slab_registry = slab;
+    }
+    pthread_mutex_unlock(&slab_registry_mutex);
+    return slab;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixSlab::KubixSlab(size_t size)
+    : _free(nullptr)
+    , _chunks(nullptr)
+    , _size(size)
+    , _in_use(0)
+    , _footprint(0)
+    , _next(nullptr)
+{
+    _mutex = PTHREAD_MUTEX_INITIALIZER;
+    /* the first line of a chunk links the chunks */
+    _per_chunk = (KBX_SLAB_CHUNK - KBX_SLAB_ALIGN) / _size;
+    if(_per_chunk < 1)
+        _per_chunk = 1;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixSlab::~KubixSlab()
+{
+    while(_chunks){
+        Chunk *next = _chunks->next;
+        ::free(_chunks);
+        _chunks = next;
+    }
+    pthread_mutex_destroy(&_mutex);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixSlab::grow()
+{
+    size_t bytes = KBX_SLAB_ALIGN + _per_chunk * _size;
+    Chunk *chunk = (Chunk*)aligned_alloc(KBX_SLAB_ALIGN, bytes);
+    if(!chunk){
+        KBX_ERR("no memory for a chunk of %zu bytes", bytes);
+        return;
+    }
+    chunk->next = _chunks;
+    _chunks = chunk;
+    _footprint += bytes;
+
+    /* threaded back to front, the first object is handed out first */
+    char *objs = (char*)chunk + KBX_SLAB_ALIGN;
+    for(size_t i = _per_chunk; i-- > 0;){
+        FreeObj *obj = (FreeObj*)(objs + i * _size);
+        obj->next = _free;
+        _free = obj;
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void *KubixSlab::alloc()
+{
+    pthread_mutex_lock(&_mutex);
+    if(!_free)
+        grow();
+    FreeObj *obj = _free;
+    if(obj){
+        _free = obj->next;
+        _in_use++;
+    }
+    pthread_mutex_unlock(&_mutex);
+    return obj;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixSlab::free(void *p)
+{
+    if(!p)
+        return;
+    FreeObj *obj = (FreeObj*)p;
+    pthread_mutex_lock(&_mutex);
+    obj->next = _free;
+    _free = obj;
+    _in_use--;
+    pthread_mutex_unlock(&_mutex);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+unsigned long KubixSlab::inUse()
+{
+    pthread_mutex_lock(&_mutex);
+    unsigned long n = _in_use;
+    pthread_mutex_unlock(&_mutex);
+    return n;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+unsigned long KubixSlab::footprint()
+{
+    pthread_mutex_lock(&_mutex);
+    unsigned long n = _footprint;
+    pthread_mutex_unlock(&_mutex);
+    return n;
+}
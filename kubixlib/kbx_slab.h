@@ -0,0 +1,80 @@
+/*
+ * 	kbx_slab.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stddef.h>
+#include <pthread.h>
+
+#ifndef KBX_SLAB_H
+#define KBX_SLAB_H
+
+#define KBX_SLAB_CHUNK		(64 * 1024)	/* bytes carved per chunk at least */
+#define KBX_SLAB_ALIGN		64			/* every object starts a cache line */
+
+/* ------------------------------------------------------------------------------
+ * Fixed size object cache: chunks of KBX_SLAB_CHUNK bytes are carved into
+ * cache line aligned objects of one size and recycled through a free list,
+ * never given back. One slab per size class, shared by the process: all
+ * Node objects come from one, the node queue rings of a given depth from
+ * another.
+ * */
+class KubixSlab{
+public:
+	/* @brief  - the slab of the size class, created on first use
+	 * @parm   - object size in bytes
+	 */
+	static KubixSlab *forSize(size_t size);
+
+	/* @brief  - takes an object off the free list, carving a new chunk
+	 *		   if the list is empty
+	 * @return	 - the object, or nullptr without memory.
+	 */
+	void *alloc();
+	void free(void *obj);
+
+	size_t size() const { return _size; }
+	/* objects handed out and not freed yet */
+	unsigned long inUse();
+	/* bytes taken from the system */
+	unsigned long footprint();
+
+private:
+	KubixSlab(size_t size);
+	~KubixSlab();
+	void grow();
+
+	struct FreeObj{
+		FreeObj *next;
+	};
+	struct Chunk{
+		Chunk *next;
+	};
+
+	pthread_mutex_t _mutex;
+	FreeObj *_free;
+	Chunk *_chunks;
+	size_t _size;			/* rounded up to KBX_SLAB_ALIGN */
+	size_t _per_chunk;
+	unsigned long _in_use;
+	unsigned long _footprint;
+	KubixSlab *_next;		/* size class registry */
+};
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * 	kbx_spin.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <atomic>
+#include "kbx_futex.h"
+
+#ifndef KBX_SPIN_H
+#define KBX_SPIN_H
+
+#define KBX_SPIN_MIN_NS		1000	/* the budget never shrinks below */
+#define KBX_SPIN_CHECKS		16		/* condition checks per clock read */
+
+/* ------------------------------------------------------------------------------
+ * Spin-then-block policy of the latency mode. A waiter spins on its
+ * condition for a budget of its own before it sleeps: a spin which finds
+ * work raises the budget to twice the time it took, one which runs dry
+ * halves it, so a channel with bursts keeps spinning and an idle one
+ * quickly goes back to sleeping at once. The budget lives with the waiter
+ * (node, dispatcher, worker), the counters are shared by the bus.
+ * */
+class KubixSpin{
+public:
+	/* @brief  - sets the upper bound of one spin
+	 * @parm   - microseconds
+	 */
+	KubixSpin(int max_us)
+		: _spins(0), _hits(0), _spin_ns(0)
+	{
+		_max_ns = max_us > 0 ? max_us * 1000 : KBX_SPIN_MIN_NS;
+	}
+
+	/* @brief  - spins on the condition within the waiter's budget
+	 * @parm1 budget - the waiter's budget in ns, 0 starts at the maximum
+	 * @parm2 ready  - the condition, called repeatedly
+	 * @return	 - 'true' if the condition came true, 'false' if the
+	 *			   caller should block.
+	 */
+	template<class Ready>
+	bool wait(std::atomic<int> &budget, Ready ready)
+	{
+		int limit = budget.load(std::memory_order_relaxed);
+		if(limit <= 0 || _max_ns < limit)
+			limit = _max_ns;
+		__u64 start = kbx_now_ns();
+		__u64 spent = 0;
+		bool hit = false;
+		while(!hit && spent < (__u64)limit){
+			for(int i = 0; i < KBX_SPIN_CHECKS; i++){
+				if((hit = ready()))
+					break;
+				relax();
+			}
+			spent = kbx_now_ns() - start;
+		}
+		if(hit){
+			if(limit < (int)(2 * spent))
+				limit = 2 * spent < (__u64)_max_ns ? 2 * spent : _max_ns;
+			_hits.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+			limit = limit / 2 < KBX_SPIN_MIN_NS ? KBX_SPIN_MIN_NS : limit / 2;
+		budget.store(limit, std::memory_order_relaxed);
+		_spins.fetch_add(1, std::memory_order_relaxed);
+		_spin_ns.fetch_add(spent, std::memory_order_relaxed);
+		return hit;
+	}
+
+	unsigned long spins() const { return _spins.load(std::memory_order_relaxed); }
+	unsigned long hits() const { return _hits.load(std::memory_order_relaxed); }
+	unsigned long spinNs() const { return _spin_ns.load(std::memory_order_relaxed); }
+	int maxNs() const { return _max_ns; }
+
+private:
+	static void relax()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield" ::: "memory");
+#else
+		asm volatile("" ::: "memory");
+#endif
+	}
+
+	std::atomic<unsigned long> _spins;		/* spins started */
+	std::atomic<unsigned long> _hits;		/* spins which found work */
+	std::atomic<unsigned long> _spin_ns;	/* CPU time burned spinning */
+	int _max_ns;
+};
+
+#endif
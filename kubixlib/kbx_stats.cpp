@@ -0,0 +1,170 @@
+/*
+ *     kbx_stats.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <new>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kbx_stats.h"
+#include "kbx_log.h"
+
+/* ------------------------------------------------------------------------------ */
+KubixStats::KubixStats(int nodes, bool shared)
+    : _hdr(nullptr)
+    , _next(0)
+{
+    static std::atomic<int> buses(0);
+
+    if(nodes < 1)
+        nodes = 1;
+    _size = kbx_stat_size(nodes);
+    _name[0] = 0;
+    void *region = MAP_FAILED;
+    if(shared){
+        snprintf(_name, sizeof(_name), KBX_STAT_NAME, getpid(), buses++);
+        int fd = shm_open(_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if(fd != -1 && !ftruncate(fd, _size))
+            region = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          fd, 0);
+        if(region == MAP_FAILED){
+            KBX_WARN("%s: %s, the stats stay private", _name, strerror(errno));
+            if(fd != -1)
+                shm_unlink(_name);
+            _name[0] = 0;
+        }
+        if(fd != -1)
+            close(fd);
+    }
+    if(region == MAP_FAILED)
+        region = mmap(NULL, _size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(region == MAP_FAILED)
+        throw std::bad_alloc();
+
+    /* zero filled memory is a valid set of atomics; the magic goes last,
+     * a reader takes the region once it is there */
+    _hdr = (kubix_stat_hdr*)region;
+    _hdr->version = KBX_STAT_VERSION;
+    _hdr->size = _size;
+    _hdr->pid = getpid();
+    _hdr->shards = KBX_MAX_SHARDS;
+    _hdr->nodes = nodes;
+    _hdr->started = time(NULL);
+    std::atomic_thread_fence(std::memory_order_release);
+    _hdr->magic = KBX_STAT_MAGIC;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixStats::~KubixStats()
+{
+    if(_name[0])
+        shm_unlink(_name);
+    munmap(_hdr, _size);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+kubix_stat_node *KubixStats::attach(int pid, int uid, int shard)
+{
+    kubix_stat_node *nodes = kbx_stat_nodes(_hdr);
+    int count = _hdr->nodes;
+    int first = (unsigned)_next.fetch_add(1, std::memory_order_relaxed) % count;
+
+    for(int i = 0; i < count; i++){
+        kubix_stat_node *slot = &nodes[(first + i) % count];
+        int used = 0;
+        if(slot->used.load(std::memory_order_relaxed) ||
+           !slot->used.compare_exchange_strong(used, 1))
+            continue;
+        __u32 gen = slot->gen.load(std::memory_order_relaxed);
+        slot->gen.store(gen + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->pid = pid;
+        slot->uid = uid;
+        slot->shard = shard;
+        slot->messages.store(0, std::memory_order_relaxed);
+        slot->bytes.store(0, std::memory_order_relaxed);
+        slot->drops.store(0, std::memory_order_relaxed);
+        slot->depth.store(0, std::memory_order_relaxed);
+        slot->depth_max.store(0, std::memory_order_relaxed);
+        slot->served.store(0, std::memory_order_relaxed);
+        slot->errors.store(0, std::memory_order_relaxed);
+        slot->gen.store(gen + 2, std::memory_order_release);
+        _hdr->channels.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+    }
+    _hdr->unslotted.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixStats::detach(kubix_stat_node *slot)
+{
+    /* first the totals, then the slot: a reader may see a channel twice
+     * for a moment, but never miss it */
+    _hdr->retired_messages.fetch_add(slot->messages, std::memory_order_relaxed);
+    _hdr->retired_bytes.fetch_add(slot->bytes, std::memory_order_relaxed);
+    _hdr->retired_drops.fetch_add(slot->drops, std::memory_order_relaxed);
+    _hdr->retired_served.fetch_add(slot->served, std::memory_order_relaxed);
+    _hdr->retired_errors.fetch_add(slot->errors, std::memory_order_relaxed);
+    _hdr->channels.fetch_sub(1, std::memory_order_relaxed);
+    slot->used.store(0, std::memory_order_release);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+const kubix_stat_hdr *KubixStats::open(const char *name, size_t &size)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd == -1)
+        return nullptr;
+    struct stat st;
+    void *region = MAP_FAILED;
+    if(!fstat(fd, &st) && sizeof(kubix_stat_hdr) <= (size_t)st.st_size)
+        region = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(region == MAP_FAILED)
+        return nullptr;
+
+    const kubix_stat_hdr *hdr = (const kubix_stat_hdr*)region;
+    if(hdr->magic != KBX_STAT_MAGIC || hdr->version != KBX_STAT_VERSION ||
+       hdr->size != (__u64)st.st_size){
+        munmap(region, st.st_size);
+        return nullptr;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    size = st.st_size;
+    return hdr;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool KubixStats::read(const kubix_stat_node *slot, KubixNodeStats &stats)
+{
+    __u32 gen = slot->gen.load(std::memory_order_acquire);
+    if((gen & 1) || !slot->used.load(std::memory_order_acquire))
+        return false;
+    stats.pid = slot->pid;
+    stats.uid = slot->uid;
+    stats.shard = slot->shard;
+    stats.messages = slot->messages.load(std::memory_order_relaxed);
+    stats.bytes = slot->bytes.load(std::memory_order_relaxed);
+    stats.drops = slot->drops.load(std::memory_order_relaxed);
+    stats.depth = slot->depth.load(std::memory_order_relaxed);
+    stats.depth_max = slot->depth_max.load(std::memory_order_relaxed);
+    stats.served = slot->served.load(std::memory_order_relaxed);
+    stats.errors = slot->errors.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->gen.load(std::memory_order_relaxed) == gen;
+}
@@ -0,0 +1,171 @@
+/*
+ * 	kbx_stats.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <atomic>
+#include "kubix.h"
+
+#ifndef KBX_STATS_H
+#define KBX_STATS_H
+
+#define KBX_STAT_NAME		"/kubix.%d.%d"	/* shm_open() name: pid, bus */
+#define KBX_STAT_ENV		"KUBIX_STATS"	/* not 0: the default of stats */
+#define KBX_STAT_MAGIC		0x5358424b		/* "KBXS" */
+#define KBX_STAT_VERSION	1
+
+/* ------------------------------------------------------------------------------
+ * The counters of a connector id shard, its dispatcher is the only writer
+ * */
+struct kubix_stat_shard{
+	alignas(KBX_CACHE_LINE) std::atomic<unsigned long> wakeups;
+	std::atomic<unsigned long> messages;
+	std::atomic<unsigned long> batches[RX_BATCH_BUCKETS];
+	std::atomic<unsigned long> delivered;
+	std::atomic<unsigned long> discarded;
+	std::atomic<unsigned long> gaps;
+	std::atomic<unsigned long> duplicates;
+	std::atomic<unsigned long> overflows;
+	std::atomic<unsigned long> acks;
+	std::atomic<unsigned long> bytes;	/* payload queued to the channels */
+	std::atomic<unsigned long> drops;	/* overflowed channel queues */
+	std::atomic<int> uring;
+	std::atomic<int> rcvbuf;
+};
+
+/* ------------------------------------------------------------------------------
+ * The counters of a channel. The slot changes hands under a sequence
+ * number: odd while pid, uid and shard are rewritten, see KubixStats::read.
+ * */
+struct kubix_stat_node{
+	alignas(KBX_CACHE_LINE) std::atomic<__u32> gen;
+	std::atomic<int> used;
+	__s32 pid;
+	__s32 uid;
+	__s32 shard;
+	/* the dispatcher of the channel shard */
+	std::atomic<unsigned long> messages;
+	std::atomic<unsigned long> bytes;
+	std::atomic<unsigned long> drops;
+	std::atomic<int> depth;
+	std::atomic<int> depth_max;
+	/* the channel consumer */
+	alignas(KBX_CACHE_LINE) std::atomic<unsigned long> served;
+	std::atomic<unsigned long> errors;
+};
+
+/* ------------------------------------------------------------------------------
+ * The head of the region, the shards and the channel slots follow it. The
+ * counters of a freed slot are added to the retired ones, a bus total is
+ * the retired count plus the live slots.
+ * */
+struct kubix_stat_hdr{
+	__u32 magic;
+	__u32 version;
+	__u64 size;			/* of the whole region */
+	__s32 pid;
+	__s32 shards;
+	__s32 nodes;		/* channel slots */
+	__s32 reserved;
+	__u64 started;		/* CLOCK_REALTIME seconds */
+	std::atomic<int> channels;			/* slots in use */
+	std::atomic<unsigned long> unslotted;	/* channels which got no slot */
+	std::atomic<unsigned long> retired_messages;
+	std::atomic<unsigned long> retired_bytes;
+	std::atomic<unsigned long> retired_drops;
+	std::atomic<unsigned long> retired_served;
+	std::atomic<unsigned long> retired_errors;
+};
+
+#define KBX_STAT_HEAD	(KBX_CACHE_LINE * ((sizeof(kubix_stat_hdr) + \
+								KBX_CACHE_LINE - 1) / KBX_CACHE_LINE))
+
+static inline kubix_stat_shard *kbx_stat_shards(const kubix_stat_hdr *hdr)
+{
+	return (kubix_stat_shard*)((char*)hdr + KBX_STAT_HEAD);
+}
+static inline kubix_stat_node *kbx_stat_nodes(const kubix_stat_hdr *hdr)
+{
+	return (kubix_stat_node*)(kbx_stat_shards(hdr) + KBX_MAX_SHARDS);
+}
+static inline size_t kbx_stat_size(int nodes)
+{
+	return KBX_STAT_HEAD + KBX_MAX_SHARDS * sizeof(kubix_stat_shard) +
+		   nodes * sizeof(kubix_stat_node);
+}
+
+/* @brief  - a counter with one writer, read lock free by the stats
+ */
+static inline void kbx_count(std::atomic<unsigned long> &counter,
+							 unsigned long n = 1)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + n,
+				  std::memory_order_relaxed);
+}
+
+/* ------------------------------------------------------------------------------
+ * The metrics region of a bus: a POSIX shared memory file other processes
+ * map read only, e.g. kubix-stat, or private memory if that cannot be had.
+ * The writers never lock, the readers never stop them.
+ * */
+class KubixStats{
+public:
+	/* @brief  - maps the region
+	 * @parm1 nodes  - channel slots, channels over it are not counted
+	 * @parm2 shared - publish it as KBX_STAT_NAME in /dev/shm
+	 */
+	KubixStats(int nodes, bool shared);
+	~KubixStats();
+
+	/* @brief  - the shm_open() name, empty if the region is private
+	 */
+	const char *name() const { return _name; }
+	kubix_stat_hdr *hdr() const { return _hdr; }
+	kubix_stat_shard *shard(int shard) const { return &kbx_stat_shards(_hdr)[shard]; }
+
+	/* @brief  - takes a free channel slot, zeroed
+	 * @return	 - nullptr if all slots are in use.
+	 */
+	kubix_stat_node *attach(int pid, int uid, int shard);
+
+	/* @brief  - retires the counters of the slot and frees it; the
+	 *		   writers of the slot are done with it
+	 */
+	void detach(kubix_stat_node *slot);
+
+	/* @brief  - maps a published region read only
+	 * @parm1 name - its shm_open() name
+	 * @parm2 size - the mapped size, for munmap()
+	 * @return	 - nullptr if there is no such region or it is not one.
+	 */
+	static const kubix_stat_hdr *open(const char *name, size_t &size);
+
+	/* @brief  - a consistent copy of a slot in use
+	 * @return	 - 'false' if the slot is free or changed hands meanwhile.
+	 */
+	static bool read(const kubix_stat_node *slot, KubixNodeStats &stats);
+
+private:
+	kubix_stat_hdr *_hdr;
+	size_t _size;
+	std::atomic<int> _next;		/* where attach() looks first */
+	char _name[32];
+};
+
+#endif
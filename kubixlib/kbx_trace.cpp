@@ -0,0 +1,150 @@
+/*
+ *     kbx_trace.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "kbx_trace.h"
+
+/* ------------------------------------------------------------------------------ */
+KubixTrace::KubixTrace(int sample, int ring)
+    : _sample(sample < 1 ? 1 : sample)
+    , _size(1)
+{
+    static std::atomic<__u64> tracers(0);
+
+    while(_size < ring)
+        _size <<= 1;
+    _id = ++tracers;
+    _mutex = PTHREAD_MUTEX_INITIALIZER;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixTrace::~KubixTrace()
+{
+    for(Ring *ring : _rings){
+        delete[] ring->spans;
+        delete ring;
+    }
+    pthread_mutex_destroy(&_mutex);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+const char *KubixTrace::stageName(int stage)
+{
+    static const char *names[KBX_TRACE_STAGES] = {
+        "socket", "route", "queue", "callback", "send",
+    };
+    return 0 <= stage && stage < KBX_TRACE_STAGES ? names[stage] : "?";
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixTrace::Ring *KubixTrace::ring()
+{
+    /* the ring of the last tracer the thread wrote to; the rings live as
+     * long as their tracer, a thread which quits leaves its spans there */
+    static thread_local __u64 cached_id = 0;
+    static thread_local Ring *cached = nullptr;
+
+    if(cached_id == _id)
+        return cached;
+    Ring *ring = nullptr;
+    int tid = syscall(SYS_gettid);
+    pthread_mutex_lock(&_mutex);
+    for(Ring *r : _rings)
+        if(r->tid == tid)
+            ring = r;
+    if(!ring){
+        ring = new Ring;
+        ring->tid = tid;
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->spans = new KubixTraceSpan[_size];
+        for(int i = 0; i < _size; i++)
+            ring->spans[i].seq.store(0, std::memory_order_relaxed);
+        _rings.push_back(ring);
+    }
+    pthread_mutex_unlock(&_mutex);
+    cached_id = _id;
+    cached = ring;
+    return ring;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixTrace::span(int stage, int pid, int uid, __u64 start, __u64 end)
+{
+    Ring *ring = this->ring();
+    __u64 head = ring->head.load(std::memory_order_relaxed);
+    KubixTraceSpan *slot = &ring->spans[head & (_size - 1)];
+
+    slot->seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->start = start;
+    slot->end = end;
+    slot->pid = pid;
+    slot->uid = uid;
+    slot->stage = stage;
+    slot->seq.store(head + 1, std::memory_order_release);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int KubixTrace::exportJson(FILE *out)
+{
+    int pid = getpid();
+    int count = 0;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"kubix %d\"}}", pid, pid);
+    pthread_mutex_lock(&_mutex);
+    std::vector<Ring*> rings = _rings;
+    pthread_mutex_unlock(&_mutex);
+
+    for(Ring *ring : rings){
+        fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":\"kubix %d\"}}", pid,
+                ring->tid, ring->tid);
+        __u64 head = ring->head.load(std::memory_order_acquire);
+        __u64 first = head < (__u64)_size ? 0 : head - _size;
+        for(__u64 i = first; i < head; i++){
+            KubixTraceSpan *slot = &ring->spans[i & (_size - 1)];
+            /* the writer may be over it already, then it is skipped */
+            if(slot->seq.load(std::memory_order_acquire) != i + 1)
+                continue;
+            KubixTraceSpan span;
+            span.start = slot->start;
+            span.end = slot->end;
+            span.pid = slot->pid;
+            span.uid = slot->uid;
+            span.stage = slot->stage;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(slot->seq.load(std::memory_order_relaxed) != i + 1)
+                continue;
+            __u64 dur = span.start < span.end ? span.end - span.start : 0;
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"kubix\",\"ph\":\"X\","
+                    "\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":%d,"
+                    "\"tid\":%d,\"args\":{\"channel\":\"%d.%d\"}}",
+                    stageName(span.stage),
+                    (unsigned long long)span.start / 1000,
+                    (unsigned long long)span.start % 1000,
+                    (unsigned long long)dur / 1000,
+                    (unsigned long long)dur % 1000, pid, ring->tid,
+                    span.pid, span.uid);
+            count++;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return count;
+}
@@ -0,0 +1,114 @@
+/*
+ * 	kbx_trace.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <atomic>
+#include <vector>
+#include <stdio.h>
+#include <pthread.h>
+#include <linux/types.h>
+
+#ifndef KBX_TRACE_H
+#define KBX_TRACE_H
+
+#define KBX_TRACE_RING		4096	/* spans kept per thread, power of two */
+
+/* ------------------------------------------------------------------------------
+ * The stages of a sampled kernel message through the bus
+ * */
+enum KBX_TRACE_STAGES{
+	KBX_TRACE_SOCKET,		/* the kernel sent it, the dispatcher got it;
+							 * stamped messages only, see struct kubix_ts */
+	KBX_TRACE_ROUTE,		/* the dispatcher looks up and checks the channel */
+	KBX_TRACE_QUEUE,		/* queued until the consumer takes it, its
+							 * wakeup or worker scheduling included */
+	KBX_TRACE_CALLBACK,		/* the user callback */
+	KBX_TRACE_SEND,			/* send2kernel of the answer */
+	KBX_TRACE_STAGES
+};
+
+/* ------------------------------------------------------------------------------
+ * A span in a thread ring. The slot changes under its number: 0 while it is
+ * rewritten, the ring index + 1 once it is whole, see KubixTrace::exportJson.
+ * */
+struct KubixTraceSpan{
+	std::atomic<__u64> seq;
+	__u64 start;			/* CLOCK_MONOTONIC ns */
+	__u64 end;
+	__s32 pid;				/* the channel */
+	__s32 uid;
+	int stage;
+};
+
+/* ------------------------------------------------------------------------------
+ * Sampling tracer of a bus: the dispatchers pick one kernel message in
+ * 'sample', every thread which handles a picked message records its stages
+ * in a ring of its own, the oldest spans make room for the new ones. No
+ * lock but the one taken by the first span of a thread; a bus without a
+ * tracer pays a null check per stage.
+ * */
+class KubixTrace{
+public:
+	/* @brief  - a tracer without spans
+	 * @parm1 sample - one message in that many is traced, 1 is every one
+	 * @parm2 ring - spans kept per thread, rounded up to a power of two
+	 */
+	KubixTrace(int sample, int ring);
+	~KubixTrace();
+
+	/* @brief  - a dispatcher picks the messages to trace
+	 * @parm   - its own message counter
+	 */
+	bool sample(unsigned &count) const
+	{
+		if(++count < _sample)
+			return false;
+		count = 0;
+		return true;
+	}
+
+	/* @brief  - records a span in the ring of the calling thread
+	 */
+	void span(int stage, int pid, int uid, __u64 start, __u64 end);
+
+	/* @brief  - writes the spans of every ring as Chrome trace event JSON,
+	 *		   Perfetto and chrome://tracing load it; the tracer goes on
+	 * @return	 - the number of spans written.
+	 */
+	int exportJson(FILE *out);
+
+	static const char *stageName(int stage);
+
+private:
+	struct Ring{
+		int tid;
+		std::atomic<__u64> head;	/* spans ever recorded */
+		KubixTraceSpan *spans;
+	};
+	Ring *ring();
+
+	unsigned _sample;
+	int _size;
+	__u64 _id;						/* tells a thread's cached ring apart */
+	pthread_mutex_t _mutex;			/* _rings */
+	std::vector<Ring*> _rings;
+};
+
+#endif
@@ -0,0 +1,263 @@
+/*
+ *     kbx_transport.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include "kbx_transport.h"
+#include "kbx_log.h"
+
+/* ------------------------------------------------------------------------------ */
+int kubix_frame_fill(struct kubix_frame *frame, int pid, int uid, int op,
+                     int ret, __u32 seq, const void *payload, int len,
+                     int shard)
+{
+    if(len < 0 || PAYLOAD_MAX_SIZE < len)
+        return -1;
+
+    int cn_msg_data_len = sizeof(struct kubix_hdr) + len;
+    int nlmsg_data_len  = NLMSG_LENGTH(sizeof(struct cn_msg) + cn_msg_data_len);
+
+    memset(frame, 0, offsetof(struct kubix_frame, buf));
+    frame->nl_hdr.nlmsg_len = nlmsg_data_len;       /* Netlink */
+    frame->nl_hdr.nlmsg_pid = getpid();
+    frame->nl_hdr.nlmsg_type = NLMSG_DONE;
+    frame->cn_msg.id.idx = CN_SS_IDX + shard;       /* Connector */
+    frame->cn_msg.id.val = CN_SS_VAL;
+    frame->cn_msg.seq = seq;
+    frame->cn_msg.ack = 0;
+    frame->cn_msg.len = cn_msg_data_len;
+    frame->kbx_msg.pid = pid;                       /* Kubix */
+    frame->kbx_msg.uid = uid;
+    frame->kbx_msg.opt = op;
+    frame->kbx_msg.ret = ret;
+    frame->kbx_msg.data_len = len;
+    if(len)
+        memcpy(frame->buf, payload, len);           /* App payload */
+
+    return nlmsg_data_len;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool kubix_frame_get_ts(const struct kubix_frame *frame, int len,
+                        struct kubix_ts &ts)
+{
+    int data_len = frame->kbx_msg.data_len;
+    if(data_len < 0 || PAYLOAD_MAX_SIZE < data_len ||
+       frame->cn_msg.len < sizeof(struct kubix_hdr) + data_len + sizeof(ts) ||
+       len < (int)(offsetof(struct kubix_frame, buf) + data_len + sizeof(ts)))
+        return false;
+    memcpy(&ts, frame->buf + data_len, sizeof(ts));
+    return ts.magic == KBX_TS_MAGIC;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void kubix_frame_put_ts(struct kubix_frame *frame, const struct kubix_ts &ts)
+{
+    memcpy(frame->buf + frame->kbx_msg.data_len, &ts, sizeof(ts));
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int kubix_frame_add_ts(struct kubix_frame *frame, const struct kubix_ts &ts)
+{
+    kubix_frame_put_ts(frame, ts);
+    frame->cn_msg.len += sizeof(ts);
+    frame->nl_hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) +
+                                           frame->cn_msg.len);
+    return frame->nl_hdr.nlmsg_len;
+}
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
+KubixTransport::KubixTransport(int shard)
+    : _fd(-1)
+    , _shard(shard)
+{
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixTransport::~KubixTransport()
+{
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixTransport::close()
+{
+    if(_fd != -1){
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int KubixTransport::attachFilter(unsigned ops)
+{
+    enum{
+        IDX = offsetof(struct kubix_frame, cn_msg) + offsetof(struct cn_msg, id.idx),
+        VAL = offsetof(struct kubix_frame, cn_msg) + offsetof(struct cn_msg, id.val),
+        OPT = offsetof(struct kubix_frame, kbx_msg) + offsetof(struct kubix_hdr, opt),
+    };
+    /* absolute word loads are big endian, the frame is in host order;
+     * a load past a short datagram drops it */
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, IDX),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(CN_SS_IDX + _shard), 0, 10),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, VAL),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(CN_SS_VAL), 0, 8),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, OPT),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 32, 6, 0),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_IMM, 1),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, ops),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),		/* the whole datagram */
+        BPF_STMT(BPF_RET | BPF_K, 0),				/* dropped */
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+
+    return setsockopt(_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
+int NetlinkTransport::shards() const
+{
+    int shards = 0;
+    FILE *f = fopen("/sys/module/kubix/parameters/shards", "r");
+    if(!f)
+        return 0;
+    if(fscanf(f, "%d", &shards) != 1)
+        shards = 0;
+    fclose(f);
+    return shards;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int NetlinkTransport::open()
+{
+    struct sockaddr_nl l_local;
+
+    _fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR);
+    if(_fd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&l_local, 0, sizeof(l_local));
+    l_local.nl_family = AF_NETLINK;
+    l_local.nl_groups = 0;
+    l_local.nl_pid = 0;
+
+    if(bind(_fd, (struct sockaddr *)&l_local, sizeof(struct sockaddr_nl)) < 0 ){
+        perror("bind");
+        close();
+        return -1;
+    }
+
+    /* the kernel bus multicasts a shard to the group of its idx, each
+     * dispatcher socket joins only that one, no other connector users */
+    int group = CN_SS_IDX + _shard;
+    KBX_INFO("subscribing to %u.%u", group, CN_SS_VAL);
+    if(setsockopt(_fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+                  &group, sizeof(group)) < 0){
+        perror("NETLINK_ADD_MEMBERSHIP");
+        close();
+        return -1;
+    }
+    return _fd;
+}
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
+LoopbackTransport::LoopbackTransport(int shard)
+    : KubixTransport(shard)
+    , _peer_fd(-1)
+    , _peer_ack(0)
+    , _peer_acks(0)
+{
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+LoopbackTransport::~LoopbackTransport()
+{
+    close();
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int LoopbackTransport::open()
+{
+    int sv[2];
+
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1){
+        perror("socketpair");
+        return -1;
+    }
+    _fd = sv[0];
+    _peer_fd = sv[1];
+
+    KBX_INFO("loopback bus fd %d, kernel peer fd %d", _fd, _peer_fd);
+    return _fd;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void LoopbackTransport::close()
+{
+    KubixTransport::close();
+    peerClose();
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void LoopbackTransport::peerClose()
+{
+    if(_peer_fd != -1){
+        ::close(_peer_fd);
+        _peer_fd = -1;
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int LoopbackTransport::peerSend(int pid, int uid, int op, int ret, __u32 seq,
+                                const void *payload, int len, __u32 ack,
+                                __u64 sent)
+{
+    struct kubix_frame frame;
+    int frame_len = kubix_frame_fill(&frame, pid, uid, op, ret, seq,
+                                     payload, len, _shard);
+    if(frame_len < 0)
+        return -1;
+    if(sent){
+        struct kubix_ts ts = { KBX_TS_MAGIC, 0, sent, 0, 0, 0 };
+        frame_len = kubix_frame_add_ts(&frame, ts);
+    }
+    frame.cn_msg.ack = ack;
+    /* the kernel bus sends on behalf of the kernel, not of this process */
+    frame.nl_hdr.nlmsg_pid = 0;
+    if(send(_peer_fd, &frame, frame_len, MSG_NOSIGNAL) != frame_len){
+        perror("send");
+        return -1;
+    }
+    return 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int LoopbackTransport::peerRecv(struct kubix_frame *frame, int timeout_ms)
+{
+    struct pollfd pfd = { _peer_fd, POLLIN, 0 };
+
+    for(;;){
+        switch(poll(&pfd, 1, timeout_ms)){
+            case 0:
+                return 0;
+            case -1:
+                return -1;
+        }
+        int len = recv(_peer_fd, frame, sizeof(*frame), 0);
+        if(len < (int)offsetof(struct kubix_frame, buf) ||
+           frame->kbx_msg.opt != USER_ACK)
+            return len;
+        _peer_ack = frame->cn_msg.ack;
+        _peer_acks++;
+    }
+}
@@ -0,0 +1,193 @@
+/*
+ * 	kbx_transport.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include "kubix.h"
+
+#ifndef KBX_TRANSPORT_H
+#define KBX_TRANSPORT_H
+
+/* ------------------------------------------------------------------------------
+ * One datagram of the bus: netlink header, connector header, kubix header
+ * and the payload. Every transport carries exactly this framing.
+ * */
+struct __attribute__((aligned(NLMSG_ALIGNTO))) kubix_frame{
+	struct nlmsghdr nl_hdr;
+	struct __attribute__((__packed__)) {
+		struct cn_msg cn_msg;
+		struct kubix_hdr kbx_msg;
+		char buf[PAYLOAD_MAX_SIZE + sizeof(struct kubix_ts)];	/* and
+										 * the timestamp trailer */
+	};
+};
+
+/* @brief  - fills a frame the way the kernel bus and the user bus do
+ * @parm1 frame - the frame to fill, the header part is overwritten
+ * @parm2 pid  - the id of the kernelspace process/thread
+ * @parm3 uid  - the unique value in the kernelspace process/thread
+ * @parm4 op   - kubix operation type from OPERATION_TYPES enum
+ * @parm5 ret  - kubix return code
+ * @parm6 seq  - connector message sequence number
+ * @parm7 payload - the pointer to the payload, may be null if len is 0
+ * @parm8 len  - the length of the payload, up to PAYLOAD_MAX_SIZE
+ * @parm9 shard - the connector id is CN_SS_IDX + shard, CN_SS_VAL
+ * @return	 - the number of bytes to send, or -1 if len is out of range.
+ */
+int kubix_frame_fill(struct kubix_frame *frame, int pid, int uid, int op,
+					 int ret, __u32 seq, const void *payload, int len,
+					 int shard = 0);
+
+/* @brief  - the timestamp trailer of a received frame
+ * @parm2 len  - the datagram length
+ * @return	 - 'false' if the frame carries none.
+ */
+bool kubix_frame_get_ts(const struct kubix_frame *frame, int len,
+						struct kubix_ts &ts);
+
+/* @brief  - rewrites the trailer of a frame which carries one
+ */
+void kubix_frame_put_ts(struct kubix_frame *frame, const struct kubix_ts &ts);
+
+/* @brief  - appends a trailer to a filled frame
+ * @return	 - the number of bytes to send.
+ */
+int kubix_frame_add_ts(struct kubix_frame *frame, const struct kubix_ts &ts);
+
+/* ------------------------------------------------------------------------------
+ * Physical channel between the user bus and the kernel bus. A transport
+ * opens a datagram file descriptor; Kubix polls it and reads/writes
+ * kubix_frame datagrams on it. A transport carries the channels of one
+ * connector id shard, see kubix_shard_of().
+ * */
+class KubixTransport{
+public:
+	KubixTransport(int shard = 0);
+	virtual ~KubixTransport();
+
+	/* @brief  - opens the user bus end of the transport
+	 * @return	 - the file descriptor to poll, or -1 on error.
+	 */
+	virtual int open() = 0;
+
+	/* @brief  - closes the user bus end of the transport
+	 */
+	virtual void close();
+
+	/* @brief  - the name of the transport for logs
+	 */
+	virtual const char *name() const = 0;
+
+	/* @brief  - a new transport of the same kind for another shard, owned
+	 *		   by the caller
+	 * @return	 - nullptr if the transport cannot be sharded.
+	 */
+	virtual KubixTransport *newShard(int shard) const { return nullptr; }
+
+	/* @brief  - the connector ids the kernel bus spreads the channels over
+	 * @return	 - 0 if the transport cannot tell.
+	 */
+	virtual int shards() const { return 0; }
+
+	/* @brief  - attaches a classic BPF socket filter which keeps only the
+	 *		   frames of the shard connector id with an op in 'ops'
+	 * @parm   - KBX_OP_BIT mask of the accepted ops
+	 * @return	 - 0, or -1 with errno if the socket takes no filter.
+	 */
+	int attachFilter(unsigned ops);
+
+	int fd() const { return _fd; }
+	int shard() const { return _shard; }
+
+protected:
+	int _fd;
+	int _shard;
+};
+
+/* ------------------------------------------------------------------------------
+ * NETLINK_CONNECTOR socket to the kubix kernel module, subscribed to the
+ * multicast group of its connector id.
+ * */
+class NetlinkTransport : public KubixTransport{
+public:
+	NetlinkTransport(int shard = 0) : KubixTransport(shard) {}
+
+	int open();
+	const char *name() const { return "netlink"; }
+	KubixTransport *newShard(int shard) const { return new NetlinkTransport(shard); }
+
+	/* @brief  - the 'shards' parameter of the loaded kubix module
+	 */
+	int shards() const;
+};
+
+/* ------------------------------------------------------------------------------
+ * In-process AF_UNIX SOCK_SEQPACKET pair. The bus owns one end, the other
+ * end plays the kernel bus, so kubixlib can run without the kubix module.
+ * */
+class LoopbackTransport : public KubixTransport{
+public:
+	LoopbackTransport(int shard = 0);
+	~LoopbackTransport();
+
+	int open();
+	void close();
+	const char *name() const { return "loopback"; }
+	KubixTransport *newShard(int shard) const { return new LoopbackTransport(shard); }
+
+	/* @brief  - the kernel side end of the pair
+	 */
+	int peerFd() const { return _peer_fd; }
+
+	/* @brief  - sends a message to the bus as the kernel would do
+	 * @parm7 ack  - the sequence number of the user request answered
+	 * @parm8 sent - if not 0, the message carries a timestamp trailer
+	 *			   sent then, as with the module 'timestamps' parameter
+	 * @return	 - 0 if succeeded to send.
+	 */
+	int peerSend(int pid, int uid, int op, int ret, __u32 seq,
+				 const void *payload, int len, __u32 ack = 0,
+				 __u64 sent = 0);
+
+	/* @brief  - reads a message the bus sent to the kernel; USER_ACKs are
+	 *		   taken in as the kernel would do and not returned
+	 * @parm1 frame - the frame to read into
+	 * @parm2 timeout_ms - poll timeout, -1 to block
+	 * @return	 - the datagram length, 0 on timeout or -1 on error.
+	 */
+	int peerRecv(struct kubix_frame *frame, int timeout_ms);
+
+	/* @brief  - the cn_msg.ack of the last USER_ACK read and their number
+	 */
+	__u32 peerAck() const { return _peer_ack; }
+	int peerAcks() const { return _peer_acks; }
+
+	/* @brief  - closes the kernel side end; the bus dispatcher sees EOF
+	 */
+	void peerClose();
+
+private:
+	int _peer_fd;
+	__u32 _peer_ack;
+	int _peer_acks;
+};
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ *     kbx_uring.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "kbx_uring.h"
+
+/* the kernel shares the ring indices with us */
+#define uring_load(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define uring_store(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* ------------------------------------------------------------------------------ */
+KubixUring::KubixUring()
+    : _fd(-1)
+    , _sq_entries(0)
+    , _sq_tail(0)
+    , _sq_submitted(0)
+    , _sqes(nullptr)
+    , _sq_ring(MAP_FAILED)
+    , _cq_ring(MAP_FAILED)
+    , _sq_ring_size(0)
+    , _cq_ring_size(0)
+    , _sqes_size(0)
+    , _buf_ring(nullptr)
+    , _buf_ring_size(0)
+    , _buf_mask(0)
+    , _bgid(0)
+{
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixUring::~KubixUring()
+{
+    if(_buf_ring){
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = _bgid;
+        syscall(__NR_io_uring_register, _fd, IORING_UNREGISTER_PBUF_RING,
+                &reg, 1);
+        munmap(_buf_ring, _buf_ring_size);
+    }
+    if(_sqes)
+        munmap(_sqes, _sqes_size);
+    if(_cq_ring != MAP_FAILED && _cq_ring != _sq_ring)
+        munmap(_cq_ring, _cq_ring_size);
+    if(_sq_ring != MAP_FAILED)
+        munmap(_sq_ring, _sq_ring_size);
+    if(_fd != -1)
+        close(_fd);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int KubixUring::open(unsigned entries, unsigned cq_entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if(cq_entries){
+        p.flags |= IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_entries;
+    }
+    _fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(_fd < 0){
+        _fd = -1;
+        return -errno;
+    }
+    /* before Linux 5.4 the rings are two maps, SINGLE_MMAP came later */
+    _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(_cq_ring_size > _sq_ring_size)
+            _sq_ring_size = _cq_ring_size;
+        _cq_ring_size = _sq_ring_size;
+    }
+    _sq_ring = mmap(0, _sq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if(_sq_ring == MAP_FAILED)
+        return -errno;
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+        _cq_ring = _sq_ring;
+    else{
+        _cq_ring = mmap(0, _cq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        if(_cq_ring == MAP_FAILED)
+            return -errno;
+    }
+    _sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(0, _sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED)
+        return -errno;
+    _sqes = (struct io_uring_sqe*)sqes;
+
+    char *sq = (char*)_sq_ring;
+    char *cq = (char*)_cq_ring;
+    _sq_entries = p.sq_entries;
+    _sq_khead = (unsigned*)(sq + p.sq_off.head);
+    _sq_ktail = (unsigned*)(sq + p.sq_off.tail);
+    _sq_kmask = (unsigned*)(sq + p.sq_off.ring_mask);
+    _sq_array = (unsigned*)(sq + p.sq_off.array);
+    _cq_khead = (unsigned*)(cq + p.cq_off.head);
+    _cq_ktail = (unsigned*)(cq + p.cq_off.tail);
+    _cq_kmask = (unsigned*)(cq + p.cq_off.ring_mask);
+    _cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    _sq_tail = _sq_submitted = *_sq_ktail;
+    return 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+struct io_uring_sqe *KubixUring::getSqe()
+{
+    if(_sq_tail - uring_load(_sq_khead) >= _sq_entries)
+        return nullptr;
+    unsigned idx = _sq_tail++ & *_sq_kmask;
+    struct io_uring_sqe *sqe = &_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    _sq_array[idx] = idx;
+    return sqe;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int KubixUring::submit(unsigned wait_nr)
+{
+    if(_sq_tail != _sq_submitted)
+        uring_store(_sq_ktail, _sq_tail);
+    _sq_submitted = _sq_tail;
+    for(;;){
+        /* what an earlier enter left in the ring goes too */
+        unsigned count = _sq_tail - uring_load(_sq_khead);
+        if(!count && !wait_nr)
+            return 0;
+        int ret = syscall(__NR_io_uring_enter, _fd, count, wait_nr,
+                          wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if(ret >= 0)
+            return ret;
+        if(errno != EINTR)
+            return -errno;
+        /* interrupted before the submission, or while waiting */
+        if(peekCqe())
+            return 0;
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+struct io_uring_cqe *KubixUring::peekCqe()
+{
+    unsigned head = *_cq_khead;
+    if(head == uring_load(_cq_ktail))
+        return nullptr;
+    return &_cqes[head & *_cq_kmask];
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixUring::cqAdvance(unsigned count)
+{
+    uring_store(_cq_khead, *_cq_khead + count);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int KubixUring::registerBufRing(unsigned short bgid, unsigned entries)
+{
+    _buf_ring_size = entries * sizeof(struct io_uring_buf);
+    void *ring = mmap(0, _buf_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring == MAP_FAILED)
+        return -errno;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if(syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PBUF_RING,
+               &reg, 1) < 0){
+        int err = errno;
+        munmap(ring, _buf_ring_size);
+        return -err;
+    }
+    _buf_ring = (struct io_uring_buf_ring*)ring;
+    _buf_mask = entries - 1;
+    _bgid = bgid;
+    return 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixUring::bufRingAdd(void *addr, unsigned len, unsigned short bid,
+                            int offset)
+{
+    /* not _buf_ring->bufs: the flexible array macro of the uapi header
+     * puts an empty struct before it, which takes a byte in C++ */
+    struct io_uring_buf *buf = (struct io_uring_buf*)_buf_ring +
+                               ((_buf_ring->tail + offset) & _buf_mask);
+    buf->addr = (unsigned long)addr;
+    buf->len = len;
+    buf->bid = bid;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixUring::bufRingAdvance(int count)
+{
+    uring_store(&_buf_ring->tail, (unsigned short)(_buf_ring->tail + count));
+}
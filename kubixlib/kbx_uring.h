@@ -0,0 +1,108 @@
+/*
+ * 	kbx_uring.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#ifndef KBX_URING_H
+#define KBX_URING_H
+
+/* ------------------------------------------------------------------------------
+ * Minimal io_uring over the raw syscalls, no liburing: the submission and
+ * completion rings, and one provided buffer ring. Each ring has a single
+ * owner thread, the dispatcher or the sender, which is the only one to
+ * get SQEs and reap CQEs.
+ * */
+class KubixUring{
+public:
+	KubixUring();
+	~KubixUring();
+
+	/* @brief  - sets the rings up
+	 * @parm1 entries - submission queue entries
+	 * @parm2 cq_entries - completion queue entries, 0 for twice entries
+	 * @return	 - 0, or -errno if the kernel has no io_uring or it is
+	 *			   disabled, e.g. by kernel.io_uring_disabled.
+	 */
+	int open(unsigned entries, unsigned cq_entries = 0);
+	int fd() const { return _fd; }
+
+	/* @brief  - the next free SQE, zeroed
+	 * @return	 - nullptr if the submission queue is full.
+	 */
+	struct io_uring_sqe *getSqe();
+
+	/* @brief  - submits the SQEs taken since the last call, and the ones
+	 *		   the kernel left of earlier calls, and waits
+	 * @parm   - completions to wait for, 0 returns at once
+	 * @return	 - the number of SQEs submitted or -errno; on -errno the
+	 *			   SQEs stay published, the next call submits them.
+	 */
+	int submit(unsigned wait_nr);
+
+	/* @brief  - the oldest unreaped CQE, without a syscall
+	 * @return	 - nullptr if the completion queue is empty.
+	 */
+	struct io_uring_cqe *peekCqe();
+	void cqAdvance(unsigned count);
+
+	/* @brief  - registers a provided buffer ring of the group
+	 * @parm1 bgid - buffer group id the SQEs select from
+	 * @parm2 entries - ring size, a power of two
+	 * @return	 - 0 or -errno, -EINVAL before Linux 5.19.
+	 */
+	int registerBufRing(unsigned short bgid, unsigned entries);
+
+	/* @brief  - queues a buffer to the ring, published by bufRingAdvance
+	 * @parm4 offset - the number of buffers queued before since the last
+	 *			   bufRingAdvance
+	 */
+	void bufRingAdd(void *addr, unsigned len, unsigned short bid, int offset);
+	void bufRingAdvance(int count);
+
+private:
+	int _fd;
+	unsigned _sq_entries;
+	unsigned _sq_tail;				/* local, published by submit() */
+	unsigned _sq_submitted;
+	unsigned *_sq_khead;
+	unsigned *_sq_ktail;
+	unsigned *_sq_kmask;
+	unsigned *_sq_array;
+	struct io_uring_sqe *_sqes;
+	unsigned *_cq_khead;
+	unsigned *_cq_ktail;
+	unsigned *_cq_kmask;
+	struct io_uring_cqe *_cqes;
+
+	void *_sq_ring;
+	void *_cq_ring;
+	size_t _sq_ring_size;
+	size_t _cq_ring_size;
+	size_t _sqes_size;
+
+	struct io_uring_buf_ring *_buf_ring;
+	size_t _buf_ring_size;
+	unsigned _buf_mask;
+	unsigned short _bgid;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ *     kbx_workers.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include "kbx_workers.h"
+#include "kbx_spin.h"
+#include "kbx_log.h"
+
+/* ------------------------------------------------------------------------------ */
+KubixWorkers::KubixWorkers(int count, KubixSpin *spin)
+    : _pending(0)
+    , _spin(spin)
+    , _count(count)
+    , _running(1)
+{
+    if(_count <= 0)
+        _count = sysconf(_SC_NPROCESSORS_ONLN);
+    if(_count <= 0)
+        _count = 1;
+    _mutex = PTHREAD_MUTEX_INITIALIZER;
+    _cond = PTHREAD_COND_INITIALIZER;
+    _tids = new pthread_t[_count];
+    for(int i = 0; i < _count; i++)
+        pthread_create(&_tids[i], NULL, &KubixWorkers::workerThread, this);
+
+    KBX_INFO("started %d workers", _count);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixWorkers::~KubixWorkers()
+{
+    stop();
+    delete[] _tids;
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_mutex);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixWorkers::post(void (*run)(void *arg), void *arg)
+{
+    KubixTask task = { run, arg };
+
+    pthread_mutex_lock(&_mutex);
+    _tasks.push_back(task);
+    _pending.fetch_add(1, std::memory_order_release);
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_mutex);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void KubixWorkers::stop()
+{
+    pthread_mutex_lock(&_mutex);
+    if(!_running){
+        pthread_mutex_unlock(&_mutex);
+        return;
+    }
+    _running = 0;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+
+    for(int i = 0; i < _count; i++)
+        pthread_join(_tids[i], NULL);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void *KubixWorkers::workerThread(void *c)
+{
+    KubixWorkers *pool = (KubixWorkers*)c;
+    std::atomic<int> budget(0);	/* of this worker's spins */
+    bool spun = false;
+
+    pthread_mutex_lock(&pool->_mutex);
+    while(pool->_running){
+        if(pool->_tasks.empty()){
+            if(pool->_spin && !spun){
+                /* once per idle period, then sleep until posted */
+                pthread_mutex_unlock(&pool->_mutex);
+                pool->_spin->wait(budget, [pool]{
+                    return pool->_pending.load(std::memory_order_acquire) != 0; });
+                spun = true;
+                pthread_mutex_lock(&pool->_mutex);
+                continue;
+            }
+            pthread_cond_wait(&pool->_cond, &pool->_mutex);
+            spun = false;
+            continue;
+        }
+        KubixTask task = pool->_tasks.front();
+        pool->_tasks.pop_front();
+        pool->_pending.fetch_sub(1, std::memory_order_relaxed);
+        pthread_mutex_unlock(&pool->_mutex);
+
+        task.run(task.arg);
+        spun = false;
+
+        pthread_mutex_lock(&pool->_mutex);
+    }
+    pthread_mutex_unlock(&pool->_mutex);
+    return (void*)0;
+}
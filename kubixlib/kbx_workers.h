@@ -0,0 +1,81 @@
+/*
+ * 	kbx_workers.h
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <deque>
+#include <atomic>
+#include <pthread.h>
+
+#ifndef KBX_WORKERS_H
+#define KBX_WORKERS_H
+
+class KubixSpin;
+/* ------------------------------------------------------------------------------
+ * A unit of work for the pool
+ * */
+struct KubixTask{
+	void (*run)(void *arg);
+	void *arg;
+};
+
+/* ------------------------------------------------------------------------------
+ * Fixed-size pool of worker threads serving one FIFO run queue. The pool
+ * knows nothing about channels: Kubix posts a channel node at most once at
+ * a time, which keeps the messages of one channel in order on one worker
+ * while different channels run in parallel.
+ * */
+class KubixWorkers{
+public:
+	/* @brief  - starts the worker threads
+	 * @parm1 count - number of threads; 0 takes the number of online CPUs
+	 * @parm2 spin  - latency mode: an idle worker spins on the run queue
+	 *			   before it sleeps; null sleeps at once
+	 */
+	KubixWorkers(int count, KubixSpin *spin = nullptr);
+
+	/* @brief  - stops the pool, see stop()
+	 */
+	~KubixWorkers();
+
+	/* @brief  - queues a task to the first free worker
+	 */
+	void post(void (*run)(void *arg), void *arg);
+
+	/* @brief  - lets the workers finish the current tasks and joins them;
+	 *		   queued tasks which have not started are dropped
+	 */
+	void stop();
+
+	int count() const { return _count; }
+
+private:
+	static void *workerThread(void *);
+
+	pthread_mutex_t _mutex;
+	pthread_cond_t _cond;
+	std::deque<KubixTask> _tasks;
+	std::atomic<int> _pending;	/* _tasks.size() for spinning workers */
+	KubixSpin *_spin;
+	pthread_t *_tids;
+	int _count;
+	int _running;
+};
+
+#endif
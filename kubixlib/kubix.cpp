@@ -19,10 +19,28 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <new>
 #include <iostream>
+#include <stdlib.h>
 #include <errno.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
 #include <linux/netlink.h>
 #include "kubix.h"
+#include "kbx_transport.h"
+#include "kbx_sender.h"
+#include "kbx_workers.h"
+#include "kbx_ebr.h"
+#include "kbx_buf.h"
+#include "kbx_spin.h"
+#include "kbx_future.h"
+#include "kbx_uring.h"
+#include "kbx_log.h"
+#include "kbx_stats.h"
+#include "kbx_hist.h"
+#include "kbx_trace.h"
+#include "kbx_probe.h"
+#include "kbx_futex.h"
 
 /* ------------------------------------------------------------------------------ */
 const char *strNodeState(int state)
@@ -45,158 +63,284 @@ const char *str_opertype(int t )
     case USER_RELEASE: return "USER_RELEASE"; break;
     case KERNEL_REPORT: return "KERNEL_REPORT"; break;
     case NO_ACTION: return "NO_ACTION"; break;
+    case KERNEL_REPLY: return "KERNEL_REPLY"; break;
+    case USER_ACK: return "USER_ACK"; break;
     default: return "undefined"; }
 }
 
-/* ------------------------------------------------------------------------------ */
-struct UserChannelThreadCtx{
-    Kubix *_bus;
-    int    pid;
-    int    uid;
-    int    running;
-};
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
-Node::setSignalLock::setSignalLock(pthread_mutex_t *mp, pthread_cond_t *ep)
-    : _mutex_ptr(mp)
-    , _cond_ptr(ep)
+Node::Node(int pid, int uid, int depth, int policy)
+    : _queue(depth, policy)
 {
-    pthread_mutex_lock(_mutex_ptr);
+    _bus = nullptr;
+    _callback = false;
+    _scheduled = 0;
+    _state = NLC_NETLINK;
+    _pid = pid;
+    _unique = uid;
+    _opt = KUBIX_CHANNEL;
+    _ret = 0;
+    _taken = 0;
+    _refs = 1;
+    _spin_ns = 0;
+    _coro = nullptr;
+    _rx_seq = 0;
+    _rx_acked = 0;
+    _rx_held = 0;
+    _rx_resend = false;
+    _stat = nullptr;
+}
+Node::~Node()
+{
+    if(_stat)
+        _bus->stats()->detach(_stat);
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
-Node::setSignalLock::~setSignalLock()
+void *Node::operator new(size_t size)
 {
-    pthread_cond_signal(_cond_ptr);
-    pthread_mutex_unlock(_mutex_ptr);
+    void *node = nodeSlab()->alloc();
+    if(!node)
+        throw std::bad_alloc();
+    return node;
 }
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
-Node::setWaitLock::setWaitLock(pthread_mutex_t *mp, pthread_cond_t *ep)
-    : _mutex_ptr(mp)
-    , _cond_ptr(ep)
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Node::operator delete(void *node)
 {
-    pthread_mutex_lock(_mutex_ptr);
-    clock_gettime(CLOCK_REALTIME, &_ts);
+    nodeSlab()->free(node);
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
-Node::setWaitLock::~setWaitLock()
+KubixSlab *Node::nodeSlab()
 {
-    pthread_mutex_unlock(_mutex_ptr);
+    static KubixSlab *slab = KubixSlab::forSize(sizeof(Node));
+    return slab;
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
-void Node::setWaitLock::waitMsg()
+void Node::put()
 {
-    _ts.tv_sec += 1;
-    pthread_cond_timedwait(_cond_ptr, _mutex_ptr, &_ts);
+    if(_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete this;
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
-Node::Node(int pid, int uid)
+void Node::served(int err)
 {
-    _mutex = PTHREAD_MUTEX_INITIALIZER;
-    _cond = PTHREAD_COND_INITIALIZER; // default attributes
-    _thread_context = nullptr;
-    _state = NLC_NETLINK;
-    _pid = pid;
-    _unique = uid;
-    _opt = KUBIX_CHANNEL;
-    _ret = 0;
-    memset(_recv_buffer, 0x00, PAYLOAD_MAX_SIZE);
-    _recv_len = 0;
+    if(!_stat)
+        return;
+    if(err){
+        kbx_count(_stat->errors);
+        return;
+    }
+    kbx_count(_stat->served);
+    _stat->depth.store(_queue.size(), std::memory_order_relaxed);
 }
-Node::~Node()
+/* ------------------------------------------------------------------------------
+ * the counters go to /dev/shm if the application or the environment asks
+ * */
+static int statsWanted()
 {
-    pthread_cond_destroy(&_cond);
-    pthread_mutex_destroy(&_mutex);
+    const char *env = getenv(KBX_STAT_ENV);
+    return env && atoi(env) != 0;
 }
 /* ------------------------------------------------------------------------------ */
-#define get_composite_key(v1, v2) (int64_t)((((uint64_t)v2) << 32) | (uint64_t)v1)
+KubixConfig::KubixConfig()
+    : queue_depth(NODE_QUEUE_DEPTH)
+    , overflow_policy(OVERFLOW_DROP_NEWEST)
+    , rx_batch(RX_BATCH_SIZE)
+    , tx_batch(0)
+    , tx_flush_us(TX_FLUSH_US)
+    , tx_queue_depth(TX_QUEUE_DEPTH)
+    , workers(0)
+    , table_shards(NODE_TABLE_SHARDS)
+    , rx_buf_cache(RX_BUF_CACHE)
+    , latency_mode(0)
+    , spin_us(SPIN_MAX_US)
+    , socket_filter(1)
+    , accept_ops(KBX_KERNEL_OPS)
+    , dispatchers(1)
+    , io_uring(1)
+    , reliable(1)
+    , rcvbuf(0)
+    , stats(statsWanted())
+    , stat_nodes(KBX_STAT_NODES)
+    , trace_sample(0)
+    , trace_ring(KBX_TRACE_RING)
+{
+}
 /* ------------------------------------------------------------------------------ */
-Kubix::Kubix()
-    : _nodes(1 << BUS_HT_BITS)
+Kubix::DistributorContext::DistributorContext()
+    : _bus(nullptr)
+    , running(0)
+    , shard(0)
+    , tid(0)
+    , wake_fd(-1)
+    , transport(nullptr)
+    , own_transport(false)
+    , sender(nullptr)
+    , pool(nullptr)
+    , trace_count(0)
+    , stat(nullptr)
 {
+    pfd.fd = -1;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+Kubix::Kubix(KubixTransport *transport, const KubixConfig &config)
+    : _config(config)
+    , _workers(nullptr)
+    , _spin(config.latency_mode ? new KubixSpin(config.spin_us) : nullptr)
+    , _stats(new KubixStats(config.stat_nodes, config.stats))
+    , _latency(new KubixHistogram[KBX_LAT_OPS * KBX_LAT_STAGES])
+    , _trace(config.trace_sample > 0 ?
+             new KubixTrace(config.trace_sample, config.trace_ring) : nullptr)
+    , _nodes(config.table_shards, 1 << BUS_HT_BITS)
+    , _request_seq(1)
+{
+    KubixTransport *first = transport ? transport : new NetlinkTransport;
+    /* a channel is only seen on the shard the kernel bus hashes it to */
+    int shards = first->shards();
+    if(shards > 0 && shards != _config.dispatchers){
+        KBX_WARN("%s transport: the kernel bus has %d shards, not %d "
+                 "dispatchers, taking %d", first->name(), shards,
+                 _config.dispatchers, shards);
+        _config.dispatchers = shards;
+    }
+    if(_config.rx_batch < 1)
+        _config.rx_batch = 1;
+    if(_config.dispatchers < 1)
+        _config.dispatchers = 1;
+    if(_config.dispatchers > KBX_MAX_SHARDS)
+        _config.dispatchers = KBX_MAX_SHARDS;
+    _user_app_callback = nullptr;
+    _user_view_callback = nullptr;
+    _requests_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    _dispatchers = new DistributorContext[_config.dispatchers];
+    _ndispatchers = _config.dispatchers;
+    for(int i = 0; i < _ndispatchers; i++){
+        DistributorContext *pctx = &_dispatchers[i];
+        pctx->_bus = this;
+        pctx->shard = i;
+        pctx->stat = _stats->shard(i);
+        pctx->pool = new KubixBufPool(_config.rx_buf_cache);
+        if(!i){
+            pctx->transport = first;
+            pctx->own_transport = transport == nullptr;
+        }
+        else{
+            pctx->transport = _dispatchers[0].transport->newShard(i);
+            pctx->own_transport = true;
+        }
+        if(!pctx->transport){
+            KBX_WARN("%s transport has no shards, %d dispatcher(s)",
+                     _dispatchers[0].transport->name(), i);
+            delete pctx->pool;
+            pctx->pool = nullptr;
+            _ndispatchers = i;
+            break;
+        }
+    }
     setCnFd();
-    _bus_mutex = PTHREAD_MUTEX_INITIALIZER;
+    for(int i = 0; i < _ndispatchers; i++){
+        DistributorContext *pctx = &_dispatchers[i];
+        if(pctx->pfd.fd == -1)
+            continue;
+        pctx->wake_fd = eventfd(0, EFD_CLOEXEC);
+        if(pctx->wake_fd == -1)
+            KBX_WARN("eventfd of shard %d: %s", i, strerror(errno));
+        if(_spin){
+            /* a hint for device backed sockets, the dispatcher spins anyway;
+             * raising it over net.core.busy_read takes CAP_NET_ADMIN */
+            int busy_us = _spin->maxNs() / 1000;
+            if(setsockopt(pctx->pfd.fd, SOL_SOCKET, SO_BUSY_POLL, &busy_us,
+                          sizeof(busy_us)))
+                KBX_WARN("SO_BUSY_POLL %d us on %s: %s", busy_us,
+                         pctx->transport->name(), strerror(errno));
+        }
+        if(0 < _config.tx_batch){
+            pctx->sender = new KubixSender(_config.tx_queue_depth,
+                                           _config.tx_batch,
+                                           _config.tx_flush_us);
+            pctx->sender->start(pctx->pfd.fd, _config.io_uring);
+        }
+    }
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
 Kubix::~Kubix()
 {
+    stopBus();
+    delete _workers;
     purify();
-    pthread_mutex_destroy(&_bus_mutex);
+    KubixEbr::synchronize();
+    /* the nodes are gone with their queued buffers */
+    delete _spin;
+    for(int i = 0; i < _config.dispatchers; i++){
+        DistributorContext *pctx = &_dispatchers[i];
+        delete pctx->pool;
+        delete pctx->sender;
+        if(pctx->wake_fd != -1)
+            close(pctx->wake_fd);
+        if(pctx->own_transport && pctx->transport){
+            pctx->transport->close();
+            delete pctx->transport;
+        }
+    }
+    delete[] _dispatchers;
+    delete _stats;
+    delete[] _latency;
+    delete _trace;
+    pthread_mutex_destroy(&_requests_mutex);
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
 bool Kubix::createNode(int pid, int uid, Node *(&node))
 {
-    Node *node_ptr = nullptr;
-    if(findNode(pid, uid, node_ptr)){
-        if(node_ptr->NLC_DESTROY)
-            delete node_ptr;
-        else{
-            fprintf(stderr, "%d, %s: Node for uid = %d still in use\n",
-                    __LINE__, __func__, uid);
-            return false;
-        }
-    }
-    setLock lock(&_bus_mutex);
-    node_ptr = new Node(pid, uid);
     int64_t key = get_composite_key(pid, uid);
-    _nodes[key] = node_ptr;
-    fprintf(stderr, "%d, %s: key-key = %ld added Node[Ox%lu]: hash Value [%u],"\
-            " bucket [%u]\n",
-            __LINE__, __func__, key, node_ptr,
-            (_nodes.hash_function)()(key),
-            _nodes.bucket(key));
+    Node *node_ptr = new Node(pid, uid, _config.queue_depth,
+                              _config.overflow_policy);
+    node_ptr->_bus = this;
+    node_ptr->_stat = _stats->attach(pid, uid,
+                                     kubix_shard_of(pid, uid, _ndispatchers));
+    /* lookup and insert under one shard lock: a concurrent create of the
+     * same channel cannot slip in between */
+    if(!_nodes.insert(key, node_ptr)){
+        KBX_WARN("Node for uid = %d still in use", uid);
+        delete node_ptr;
+        return false;
+    }
+    KBX_DEBUG("key-key = %ld added Node[%p]: shard [%d]", key, node_ptr,
+              _nodes.shardOf(key));
+    KBX_PROBE(node_create, pid, uid, 0, 0, 0);
     node = node_ptr;
     return true;
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
 bool Kubix::findNode(int pid, int uid, Node *(&node))
 {
-    int64_t key = get_composite_key(pid, uid);
-    node = nullptr;
-    setLock lock(&_bus_mutex);
-    auto it = _nodes.find(key);
-    if(it == end(_nodes))
-        return false;
-    node =(*it).second;
-    return true;
+    KubixEpoch epoch;
+    node = _nodes.find(get_composite_key(pid, uid));
+    return node != nullptr;
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
 bool Kubix::eraseNode(int pid, int uid, Node *(&node))
 {
-    int64_t key = get_composite_key(pid, uid);
-    node = nullptr;
-    if(findNode(pid, uid, node)){
-        _nodes.erase(key);
-        return true;
-    }
-    return false;
+    node = _nodes.erase(get_composite_key(pid, uid));
+    if(!node)
+        return false;
+    KBX_PROBE(node_erase, pid, uid, 0, 0, 0);
+    /* a conversation parked on the channel is resumed without a message,
+     * out of the table lock */
+    void *coro = node->_coro.exchange(nullptr);
+    if(coro)
+        kbx_coro_resume(coro);
+    return true;
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
 void Kubix::dump()
 {
-    setLock lock(&_bus_mutex);
-    char arr[32];
-    std::cerr << "_nodes's buckets contain:\n";
-    for ( unsigned i = 0; i < _nodes.bucket_count(); ++i) {
-        if(0 < _nodes.bucket_size(i)){
-            std::cerr << "bucket #" << i << " contains:";
-            for ( auto local_it  = _nodes.begin(i);
-                       local_it!= _nodes.end(i);
-                     ++local_it )
-                std::cerr << " " << local_it->first << ": "
-                    << "Node[" << local_it->second->_pid << ","
-                    << local_it->second->_unique
-                    << "], " << strNodeState(local_it->second->_state);
-            std::cerr << std::endl;
-        }
-    }
-
+    std::cerr << "_nodes's " << _nodes.shards() << " shards contain:\n";
+    _nodes.dump();
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
 void Kubix::purify()
 {
-    setLock lock(&_bus_mutex);
-    for(auto it = _nodes.begin();it != _nodes.end();it++){
-        delete it->second;
-    }
+    _nodes.purify();
 }
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
 Kubix::setLock::setLock(pthread_mutex_t *mp)
@@ -212,294 +356,1181 @@ Kubix::setLock::~setLock()
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  */
 void * Kubix::dispatch(void* context)
 {
-    struct __attribute__((aligned(NLMSG_ALIGNTO))) {
-        struct nlmsghdr nl_hdr;
-        struct __attribute__((__packed__)) {
-            struct cn_msg cn_msg;
-            struct kubix_hdr kbx_msg;
-            char buf[1024];
-        };
-    } rmsg;
-    int len;
-    time_t tm;
     struct DistributorContext *pctx = (struct DistributorContext*)context;
     Kubix *bus = pctx->_bus;
 
-    pthread_detach(pthread_self());
+    if(bus->_config.io_uring){
+        int ret = bus->dispatchUring(pctx);
+        if(!ret)
+            return (void*)0;
+        KBX_WARN("io_uring on %s transport '%s' [%d], poll instead",
+                 pctx->transport->name(), strerror(-ret), -ret);
+    }
+    bus->dispatchPoll(pctx);
+    return (void*)0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int Kubix::dispatchUring(DistributorContext *pctx)
+{
+    enum { RECV_TAG = 1, WAKE_TAG = 2, BGID = 1 };
+    int nbufs = RX_URING_BUFS;
+    while(nbufs < 2 * _config.rx_batch)
+        nbufs <<= 1;
 
-    fprintf(stderr,"%d:%s:: going to Bus on CN connector fd %d\n",
-            __LINE__, __func__, bus->_pfd.fd);
+    /* the multishot recv posts one CQE per datagram, the CQ ring takes
+     * a full set of provided buffers without an overflow */
+    KubixUring ring;
+    int ret = ring.open(4, 2 * nbufs);
+    if(!ret)
+        ret = ring.registerBufRing(BGID, nbufs);
+    if(ret)
+        return ret;
 
-    while(pctx->running){
+    /* provided buffers are pool buffers indexed by the buffer id; the
+     * kernel picks one per datagram, a taken one is replaced */
+    KubixBuf **slots = new KubixBuf*[nbufs];
+    for(int i = 0; i < nbufs; i++){
+        if(!(slots[i] = pctx->pool->take())){
+            while(i--)
+                kbx_buf_release(slots[i]);
+            delete[] slots;
+            return -ENOMEM;
+        }
+        ring.bufRingAdd(&slots[i]->frame, sizeof(slots[i]->frame), i, i);
+    }
+    ring.bufRingAdvance(nbufs);
+    pctx->resume.reserve(nbufs);
+    pctx->answers.reserve(nbufs);
 
-        switch( poll(&bus->_pfd, 1, -1)) {
-            case 0:
-                usleep(100);
-                continue;
-            /*    need_exit break; */
-            case -1:
-                if (errno != EINTR) {
-                    fprintf(stderr,"%d:%s:: case -1, errno [%s] %d\n",
-                            __LINE__, __func__, strerror(errno), errno);
+    KBX_INFO("going to Bus on %s transport fd %d, io_uring with %d buffers",
+             pctx->transport->name(), pctx->pfd.fd, nbufs);
+
+    if(pctx->wake_fd != -1){
+        struct io_uring_sqe *sqe = ring.getSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = pctx->wake_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = WAKE_TAG;
+    }
+    std::atomic<int> budget(0);	/* of the latency mode busy poll */
+    bool armed = false;
+    bool received = false;
+    ret = 0;
+    while(pctx->running && !ret){
+        if(!armed){
+            struct io_uring_sqe *sqe = ring.getSqe();
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = pctx->pfd.fd;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = BGID;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->user_data = RECV_TAG;
+            armed = true;
+        }
+        /* one io_uring_enter arms and waits, none if a spin finds CQEs */
+        bool ready = _spin && _spin->wait(budget, [&]{
+            return ring.peekCqe() != nullptr; });
+        int err = ring.submit(ready ? 0 : 1);
+        if(err < 0 && err != -EINTR){
+            KBX_ERR("io_uring_enter errno '%s' [%d]", strerror(-err), -err);
+            pctx->running = 0;
+            break;
+        }
+
+        int count = 0;
+        int provided = 0;
+        int missing = 0;
+        {
+            /* the nodes looked up by the batch outlive a concurrent erase */
+            KubixEpoch epoch;
+            struct io_uring_cqe *cqe;
+            while((cqe = ring.peekCqe())){
+                int res = cqe->res;
+                unsigned flags = cqe->flags;
+                bool wake = cqe->user_data == WAKE_TAG;
+                ring.cqAdvance(1);
+                /* stopBus() has taken 'running' down */
+                if(wake)
+                    continue;
+                if(!(flags & IORING_CQE_F_MORE))
+                    armed = false;
+                if(res > 0 && (flags & IORING_CQE_F_BUFFER)){
+                    int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+                    KubixBuf *buf = slots[bid];
+                    buf->len = res;
+                    received = true;
+                    count++;
+                    /* the buffer id stays out of the ring while the pool
+                     * is dry, the rest of the batch is routed */
+                    if(routeMessage(pctx, buf) &&
+                       !(slots[bid] = pctx->pool->take())){
+                        missing++;
+                        continue;
+                    }
+                    ring.bufRingAdd(&slots[bid]->frame,
+                                    sizeof(slots[bid]->frame), bid, provided++);
+                    continue;
+                }
+                if(!res){
+                    KBX_INFO("%s transport closed by the kernel side",
+                             pctx->transport->name());
                     pctx->running = 0;
+                    break;
+                }
+                /* ENOBUFS: every buffer is in flight, rearm after the
+                 * batch gives them back; with buffers left it is the
+                 * socket which dropped datagrams */
+                if(res == -ENOBUFS){
+                    if(count < nbufs)
+                        overflow(pctx);
+                    continue;
+                }
+                if(!received && (res == -EINVAL || res == -EOPNOTSUPP)){
+                    /* no multishot recv or provided buffers in this kernel */
+                    ret = res;
+                    break;
                 }
+                KBX_ERR("recv errno '%s' [%d]", strerror(-res), -res);
+                pctx->transport->close();
+                pctx->running = 0;
+                break;
+            }
+        }
+        if(provided)
+            ring.bufRingAdvance(provided);
+        if(count)
+            pctx->stat->uring.store(1, std::memory_order_relaxed);
+        endRxBatch(pctx, count);
+        /* out of memory: the consumers give buffers back, wait for them */
+        for(int bid = 0, us = RX_REFILL_US; missing && pctx->running; ){
+            if(slots[bid]){
+                bid++;
+                continue;
+            }
+            if((slots[bid] = pctx->pool->take())){
+                ring.bufRingAdd(&slots[bid]->frame, sizeof(slots[bid]->frame),
+                                bid, 0);
+                ring.bufRingAdvance(1);
+                missing--;
+                us = RX_REFILL_US;
                 continue;
+            }
+            KBX_WARN("no memory for receive buffers, retry in %d us", us);
+            usleep(us);
+            if(us < RX_REFILL_MAX_US)
+                us <<= 1;
         }
+    }
+    /* with ret the poll loop takes over */
+    if(!ret)
+        KBX_INFO("quit Bus Loop");
 
-        memset(&rmsg, 0, sizeof(rmsg));
-        len = recv(bus->_pfd.fd, &rmsg, sizeof(rmsg), 0);
-        if(len == -1){
-            fprintf(stderr,"%d:%s:: after 'recv' call errno '%s' [%d]\n",
-                    __LINE__, __func__, strerror(errno), errno);
-            close(bus->_pfd.fd);
+    /* closing the ring cancels the recv, the buffers are ours again */
+    for(int i = 0; i < nbufs; i++)
+        if(slots[i])
+            kbx_buf_release(slots[i]);
+    delete[] slots;
+    return ret;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::dispatchPoll(DistributorContext *pctx)
+{
+    int batch = _config.rx_batch;
+
+    /* the receive vector is set up once, datagrams land in pool buffers
+     * which travel on to the consumers; a taken buffer is replaced */
+    KubixBuf **bufs = new KubixBuf*[batch];
+    struct mmsghdr *msgs = new struct mmsghdr[batch];
+    struct iovec *iovs = new struct iovec[batch];
+    memset(msgs, 0, sizeof(*msgs) * batch);
+    pctx->resume.reserve(batch);
+    pctx->answers.reserve(batch);
+    for(int i = 0; i < batch; i++){
+        bufs[i] = pctx->pool->take();
+        if(!bufs[i]){
+            KBX_ERR("no memory for receive buffers");
+            pctx->running = 0;
+            batch = i;
+            break;
+        }
+        iovs[i].iov_base = &bufs[i]->frame;
+        iovs[i].iov_len = sizeof(bufs[i]->frame);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    KBX_INFO("going to Bus on %s transport fd %d, batch of %d",
+             pctx->transport->name(), pctx->pfd.fd, batch);
+
+    /* the transport, and the eventfd stopBus() wakes the loop with */
+    struct pollfd pfds[2] = { pctx->pfd, { pctx->wake_fd, POLLIN, 0 } };
+    std::atomic<int> budget(0);	/* of the latency mode busy poll */
+    while(pctx->running){
+
+        int count = -1;
+        errno = EAGAIN;
+        if(_spin)
+            _spin->wait(budget, [&]{
+                count = recvmmsg(pctx->pfd.fd, msgs, batch, MSG_DONTWAIT, NULL);
+                return count != -1 || errno != EAGAIN; });
+        if(count == -1 && errno == EAGAIN){
+            switch( poll(pfds, 2, -1)) {
+                case 0:
+                    usleep(100);
+                    continue;
+                /*    need_exit break; */
+                case -1:
+                    if (errno != EINTR) {
+                        KBX_ERR("case -1, errno [%s] %d", strerror(errno),
+                                errno);
+                        pctx->running = 0;
+                    }
+                    continue;
+            }
+            count = recvmmsg(pctx->pfd.fd, msgs, batch, MSG_DONTWAIT, NULL);
+        }
+        if(count == -1){
+            if(errno == EAGAIN || errno == EINTR)
+                continue;
+            if(errno == ENOBUFS){
+                overflow(pctx);
+                continue;
+            }
+            KBX_ERR("after 'recvmmsg' call errno '%s' [%d]", strerror(errno),
+                    errno);
+            pctx->transport->close();
             pctx->running = 0;
             continue;
         }
-        switch (rmsg.nl_hdr.nlmsg_type) {
-        case NLMSG_ERROR:
-            fprintf(stderr, "%d:%s:: Error message received 'NLMSG_ERROR'.\n",
-                    __LINE__, __func__);
-            break;
-        case NLMSG_DONE:
-            // if rmsg.cn_msg.id = 11,1 continue on spurious
-            time(&tm);
-            fprintf(stderr, "%d:%s:: %.24s: id[%x.%x] [seq:%u.ack:%u], "
-                    "payload[len:%d,0x%u]\n",
-                    __LINE__, __func__,
-                ctime(&tm), rmsg.cn_msg.id.idx, rmsg.cn_msg.id.val,
-                rmsg.cn_msg.seq, rmsg.cn_msg.ack, rmsg.cn_msg.len,
-                rmsg.cn_msg.data);
-            {
-                fprintf(stderr, "%d:%s:: payload: node[%d.%d], "
-                        "Kubix msg[len:%d,0x%u], type %d\n",
-                        __LINE__, __func__,
-                        rmsg.kbx_msg.pid, rmsg.kbx_msg.uid,
-                        rmsg.kbx_msg.data_len, rmsg.kbx_msg.data,
-                        rmsg.kbx_msg.opt);
+        int i;
+        int missing = 0;
+        {
+            /* the nodes looked up by the batch outlive a concurrent erase */
+            KubixEpoch epoch;
+            for(i = 0; i < count && msgs[i].msg_len; i++){
+                bufs[i]->len = msgs[i].msg_len;
+                if(!routeMessage(pctx, bufs[i]))
+                    continue;
+                /* the rest of the batch is routed even if the pool is dry */
+                if(!(bufs[i] = pctx->pool->take())){
+                    missing++;
+                    continue;
+                }
+                iovs[i].iov_base = &bufs[i]->frame;
+            }
+        }
+        endRxBatch(pctx, i);
+        if(i < count || !count){
+            KBX_INFO("%s transport closed by the kernel side",
+                     pctx->transport->name());
+            pctx->running = 0;
+        }
+        /* out of memory: the consumers give buffers back, wait for them */
+        for(int j = 0, us = RX_REFILL_US; missing && pctx->running; ){
+            if(bufs[j]){
+                j++;
+                continue;
+            }
+            if((bufs[j] = pctx->pool->take())){
+                iovs[j].iov_base = &bufs[j]->frame;
+                missing--;
+                us = RX_REFILL_US;
+                continue;
+            }
+            KBX_WARN("no memory for receive buffers, retry in %d us", us);
+            usleep(us);
+            if(us < RX_REFILL_MAX_US)
+                us <<= 1;
+        }
+    }
+    KBX_INFO("quit Bus Loop errno '%s' [%d]", strerror(errno), errno);
+
+    for(int i = 0; i < batch; i++)
+        kbx_buf_release(bufs[i]);
+    delete[] iovs;
+    delete[] msgs;
+    delete[] bufs;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::endRxBatch(DistributorContext *pctx, int count)
+{
+    /* outside the epoch: a conversation may run for a while */
+    for(void *coro : pctx->resume)
+        kbx_coro_resume(coro);
+    pctx->resume.clear();
+    for(void *coro : pctx->answers)
+        kbx_coro_answer(coro);
+    pctx->answers.clear();
+    if(count)
+        countRxBatch(pctx, count);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool Kubix::routeMessage(DistributorContext *pctx, KubixBuf *buf)
+{
+    struct kubix_frame *rmsg = &buf->frame;
+    int len = buf->len;
+
+    if(len < (int)offsetof(struct kubix_frame, buf)){
+        if(len < (int)sizeof(struct nlmsghdr) ||
+           rmsg->nl_hdr.nlmsg_type != NLMSG_ERROR){
+            KBX_WARN("short datagram of %d bytes", len);
+            return false;
+        }
+    }
+    switch (rmsg->nl_hdr.nlmsg_type) {
+    case NLMSG_ERROR:
+        KBX_WARN("Error message received 'NLMSG_ERROR'.");
+        break;
+    case NLMSG_DONE:
+        /* what the socket filter lets through, see attachFilter() */
+        if(rmsg->cn_msg.id.idx != (__u32)(CN_SS_IDX + pctx->shard) ||
+           rmsg->cn_msg.id.val != CN_SS_VAL ||
+           !(_config.accept_ops & KBX_OP_BIT(rmsg->kbx_msg.opt))){
+            kbx_count(pctx->stat->discarded);
+            return false;
+        }
+        kbx_count(pctx->stat->delivered);
+        KBX_DEBUG("id[%x.%x] [seq:%u.ack:%u], payload[len:%d,%p]",
+                  rmsg->cn_msg.id.idx, rmsg->cn_msg.id.val, rmsg->cn_msg.seq,
+                  rmsg->cn_msg.ack, rmsg->cn_msg.len, rmsg->cn_msg.data);
+        {
+            __u64 traced = _trace && _trace->sample(pctx->trace_count) ?
+                           kbx_now_ns() : 0;
+            KBX_DEBUG("payload: node[%d.%d], Kubix msg[len:%d,%p], type %d",
+                      rmsg->kbx_msg.pid, rmsg->kbx_msg.uid,
+                      rmsg->kbx_msg.data_len, rmsg->kbx_msg.data,
+                      rmsg->kbx_msg.opt);
+            int data_len = rmsg->kbx_msg.data_len;
+            KBX_PROBE(receive, rmsg->kbx_msg.pid, rmsg->kbx_msg.uid,
+                      rmsg->kbx_msg.opt, data_len, rmsg->cn_msg.seq);
+            if(data_len < 0 || PAYLOAD_MAX_SIZE < data_len ||
+               len < (int)offsetof(struct kubix_frame, buf) + data_len){
+                KBX_WARN("node[%d.%d] invalid payload length %d",
+                         rmsg->kbx_msg.pid, rmsg->kbx_msg.uid, data_len);
+                return false;
+            }
+            Node *node;
+            /* an answer goes to its request, not to the channel queue;
+             * it takes a seq of the channel all the same */
+            if(rmsg->kbx_msg.opt == KERNEL_REPLY){
+                if(findNode(rmsg->kbx_msg.pid, rmsg->kbx_msg.uid, node)){
+                    if(!inSequence(pctx, node, rmsg))
+                        return false;
+                    takeSeq(pctx, node, rmsg->cn_msg.seq);
+                }
+                return completeRequest(pctx, buf);
+            }
+            if(!findNode(rmsg->kbx_msg.pid, rmsg->kbx_msg.uid, node)){
+                KBX_DEBUG("a new channel node[%d.%d] is not served yet!",
+                          rmsg->kbx_msg.pid, rmsg->kbx_msg.uid);
+
+                if(rmsg->kbx_msg.opt != KUBIX_CHANNEL){
+                    KBX_WARN("invalid operatiom type %s",
+                             str_opertype(rmsg->kbx_msg.opt));
+                    return false;
+                }
+                if(!createNode(rmsg->kbx_msg.pid, rmsg->kbx_msg.uid, node)){
+                    KBX_ERR("failed to create a new bus node.");
+                    return false;
+                }
+                /* channels opened by the kernel go to the application logic,
+                 * the ones created by the application are read by it */
+                node->_callback = _workers != nullptr;
+            }
+            if(!inSequence(pctx, node, rmsg))
+                return false;
+            stampRouted(rmsg, len);
+            buf->trace = traced ? traceRoute(rmsg, len, traced) : 0;
+            /* the consumer owns the buffer once it is in */
+            int op = rmsg->kbx_msg.opt;
+            __u32 seq = rmsg->cn_msg.seq;
+            bool queued;
+            /* keeps a node the epoch no longer does to the end of the turn */
+            struct NodeRef{
                 Node *node;
-                if(!bus->findNode(rmsg.kbx_msg.pid, rmsg.kbx_msg.uid, node)){
-                    fprintf(stderr, "%d:%s:: a new channel node[%d.%d] "
-                            "is not served yet!\n",
-                            __LINE__, __func__,
-                            rmsg.kbx_msg.pid, rmsg.kbx_msg.uid);
-
-                    if(rmsg.kbx_msg.opt != KUBIX_CHANNEL){
-                        fprintf(stderr, "%d:%s:: invalid operatiom type %s\n",
-                                __LINE__, __func__,
-                                str_opertype(rmsg.kbx_msg.opt));
-                        continue;
-                    }
-                    if(!bus->createNode(rmsg.kbx_msg.pid, rmsg.kbx_msg.uid, node)){
-                        fprintf(stderr, "%d:%s:: failed to create a new "
-                                "bus node.\n",
-                                __LINE__, __func__);
-                        continue;
-                    }
-                    pthread_t tid;
-                    UserChannelThreadCtx *context = new UserChannelThreadCtx;
-                    context->_bus = bus;
-                    context->pid = rmsg.kbx_msg.pid;
-                    context->uid = rmsg.kbx_msg.uid;
-                    context->running = 1;
-                    pthread_create(&tid, NULL, &Kubix::userAppThread,
-                                   context);
-                    node->_thread_context = context;
+                ~NodeRef() { if(node) node->put(); }
+            } held = { nullptr };
+            if(node->_queue.policy() == OVERFLOW_BLOCK &&
+               node->_queue.size() >= node->_queue.depth()){
+                /* a full queue parks the dispatcher under OVERFLOW_BLOCK,
+                 * out of the epoch of the batch: an erase or a reclaim is
+                 * not to wait for it. The conversations it is to resume go
+                 * first, one may be the reader */
+                node->get();
+                held.node = node;
+                KubixEbr::exit();
+                endRxBatch(pctx, 0);
+                queued = node->_queue.push(buf, &pctx->running);
+                KubixEbr::enter();
+            }
+            else
+                /* the buffer goes in lock free, a syscall only if someone
+                 * waits */
+                queued = node->_queue.push(buf);
+            countRx(pctx, node, queued ? data_len : -1);
+            /* only what a queue took is acked, a dropped message is a gap
+             * the kernel fills */
+            if(queued)
+                takeSeq(pctx, node, seq);
+            else if(_config.reliable && seq)
+                askResend(pctx, node,
+                          node->_rx_seq.load(std::memory_order_relaxed));
+            if(!queued){
+                KBX_PROBE(drop, node->_pid, node->_unique, op, data_len, seq);
+                KBX_WARN("node[%d.%d] queue is full, dropped %lu",
+                         rmsg->kbx_msg.pid, rmsg->kbx_msg.uid,
+                         node->_queue.dropped());
+                return false;
+            }
+            KBX_PROBE(enqueue, node->_pid, node->_unique, op, data_len, seq);
+            if(node->_callback){
+                /* one turn on the pool at a time keeps the channel in order */
+                if(!node->_scheduled.exchange(1)){
+                    node->get();	/* dropped when the turn ends */
+                    KBX_PROBE(wake, node->_pid, node->_unique, op, data_len,
+                              seq);
+                    _workers->post(&Kubix::serveChannel, node);
                 }
-                Node::setSignalLock lock(&node->_mutex, &node->_cond);
-                if(0 < node->_recv_len)
-                    fprintf(stderr, "%d:%s:: previous data loss %d\n",
-                            __LINE__, __func__,
-                            node->_recv_len);
-                if(rmsg.kbx_msg.data_len){
-                    memset(node->_recv_buffer, 0x00, PAYLOAD_MAX_SIZE);
-                    memcpy(node->_recv_buffer, rmsg.kbx_msg.data,
-                           rmsg.kbx_msg.data_len);
-                    node->_recv_len = rmsg.kbx_msg.data_len;
+            }
+            else{
+                KBX_PROBE(wake, node->_pid, node->_unique, op, data_len, seq);
+                node->_event.signal();
+                /* pairs with the fence in KubixReceive::park */
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if(node->_coro.load(std::memory_order_relaxed)){
+                    void *coro = node->_coro.exchange(nullptr);
+                    if(coro)
+                        pctx->resume.push_back(coro);
                 }
-                node->_pid = rmsg.kbx_msg.pid;
-                node->_unique = rmsg.kbx_msg.uid;
-                node->_opt = rmsg.kbx_msg.opt;
-                node->_ret = rmsg.kbx_msg.ret;
             }
-            break;
-        default:
-            break;
         }
+        return true;
+    default:
+        break;
     }
-    fprintf(stderr,"%d:%s:: quit Bus Loop errno '%s' [%d]\n",
-            __LINE__, __func__, strerror(errno), errno);
-
-    return (void*)0;
+    return false;
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
-pthread_t Kubix::runBus()
+void Kubix::countRxBatch(DistributorContext *pctx, int count)
 {
-    pthread_t tid;
-    _context._bus = this;
-    _context.running = 1;
-    pthread_create(&tid, NULL, &Kubix::dispatch, &_context);
+    int bucket = 0;
+    while(bucket < RX_BATCH_BUCKETS - 1 && (2 << bucket) <= count)
+        bucket++;
+    /* the dispatcher is the only writer */
+    kbx_count(pctx->stat->wakeups);
+    kbx_count(pctx->stat->messages, count);
+    kbx_count(pctx->stat->batches[bucket]);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::countRx(DistributorContext *pctx, Node *node, int len)
+{
+    kubix_stat_node *stat = node->_stat;
+    unsigned long dropped = node->_queue.dropped();
+    if(!stat){
+        if(len < 0)
+            kbx_count(pctx->stat->drops);
+        return;
+    }
+    /* under OVERFLOW_DROP_OLDEST a queued message may push another out */
+    kbx_count(pctx->stat->drops,
+              dropped - stat->drops.load(std::memory_order_relaxed));
+    stat->drops.store(dropped, std::memory_order_relaxed);
+    if(len < 0)
+        return;
+    kbx_count(pctx->stat->bytes, len);
+    kbx_count(stat->messages);
+    kbx_count(stat->bytes, len);
+    int depth = node->_queue.size();
+    stat->depth.store(depth, std::memory_order_relaxed);
+    if(stat->depth_max.load(std::memory_order_relaxed) < depth)
+        stat->depth_max.store(depth, std::memory_order_relaxed);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool Kubix::inSequence(DistributorContext *pctx, Node *node,
+                       struct kubix_frame *rmsg)
+{
+    __u32 seq = rmsg->cn_msg.seq;
+    if(!_config.reliable || !seq)
+        return true;
 
-    return tid;
+    /* the first seq of a node anchors it, then go back N: only the next
+     * one is taken, the kernel resends everything after the last acked */
+    __u32 last = node->_rx_seq.load(std::memory_order_relaxed);
+    if(!last || seq == last + 1)
+        return true;
+    if((__s32)(seq - last) <= 0){
+        kbx_count(pctx->stat->duplicates);
+        return false;
+    }
+    kbx_count(pctx->stat->gaps);
+    KBX_WARN("node[%d.%d] seq %u after %u, resend asked", node->_pid,
+             node->_unique, seq, last);
+    askResend(pctx, node, last);
+    return false;
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
-int Kubix::setCnFd()
+void Kubix::takeSeq(DistributorContext *pctx, Node *node, __u32 seq)
+{
+    /* acked without 'reliable' too: the kernel refuses to send more than
+     * its window of unacked messages */
+    if(!seq || (__s32)(seq - node->_rx_seq.load(std::memory_order_relaxed)) <= 0)
+        return;
+    node->_rx_seq.store(seq, std::memory_order_relaxed);
+    node->_rx_resend = false;
+    if(seq - node->_rx_acked >= KBX_ACK_EVERY){
+        sendAck(pctx, node->_pid, node->_unique, seq);
+        node->_rx_acked = seq;
+        node->_rx_held = 0;
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::askResend(DistributorContext *pctx, Node *node, __u32 last)
+{
+    /* once per gap, again if the resend got lost too */
+    if(!node->_rx_resend || ++node->_rx_held == KBX_ACK_EVERY){
+        sendAck(pctx, node->_pid, node->_unique, last);
+        node->_rx_acked = last;
+        node->_rx_held = 0;
+        node->_rx_resend = true;
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::sendAck(DistributorContext *pctx, int pid, int uid, __u32 ack)
+{
+    struct kubix_frame smsg;
+    int smsg_len = kubix_frame_fill(&smsg, pid, uid, USER_ACK, 0, 0, nullptr, 0,
+                                    pctx->shard);
+    smsg.cn_msg.ack = ack;
+    /* straight from the dispatcher, the sender stage may be full */
+    if(send(pctx->pfd.fd, &smsg, smsg_len, MSG_NOSIGNAL) != smsg_len){
+        KBX_ERR("node[%d.%d] ack %u errno '%s' [%d]", pid, uid, ack,
+                strerror(errno), errno);
+        return;
+    }
+    kbx_count(pctx->stat->acks);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+__u32 Kubix::rxAck(int pid, int uid)
+{
+    KubixEpoch epoch;
+    Node *node = _nodes.find(get_composite_key(pid, uid));
+    return node ? node->_taken.load(std::memory_order_relaxed) : 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::overflow(DistributorContext *pctx)
 {
-    struct sockaddr_nl l_local;
+    kbx_count(pctx->stat->overflows);
+    int size = pctx->stat->rcvbuf.load(std::memory_order_relaxed);
+    KBX_WARN("%s shard %d dropped datagrams, receive buffer %d",
+             pctx->transport->name(), pctx->shard, size);
+    /* the kernel reports the doubled size, asking for it doubles again */
+    if(!_config.rcvbuf && size < KBX_RCVBUF_MAX)
+        setRcvbuf(pctx, size < KBX_RCVBUF_MIN ? KBX_RCVBUF_MIN :
+                        size < KBX_RCVBUF_MAX / 2 ? size : KBX_RCVBUF_MAX / 2);
+    /* any channel of the shard may have lost something */
+    if(_config.reliable)
+        sendAck(pctx, KBX_MAIN_PID, KBX_MAIN_UID, 0);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::setRcvbuf(DistributorContext *pctx, int size)
+{
+    int fd = pctx->pfd.fd;
+    socklen_t len = sizeof(size);
 
-    _pfd.fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR);
-    if(_pfd.fd == -1) {
-        perror("socket");
+    /* over net.core.rmem_max takes CAP_NET_ADMIN */
+    if(setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) &&
+       setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)))
+        KBX_WARN("SO_RCVBUF %d on %s: %s", size, pctx->transport->name(),
+                 strerror(errno));
+    if(!getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, &len))
+        pctx->stat->rcvbuf.store(size, std::memory_order_relaxed);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::rxStats(KubixRxStats &stats) const
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.uring = 1;
+    for(int i = 0; i < _ndispatchers; i++){
+        kubix_stat_shard *stat = _dispatchers[i].stat;
+        stats.wakeups += stat->wakeups.load(std::memory_order_relaxed);
+        stats.messages += stat->messages.load(std::memory_order_relaxed);
+        for(int j = 0; j < RX_BATCH_BUCKETS; j++)
+            stats.batches[j] += stat->batches[j].load(std::memory_order_relaxed);
+        stats.uring &= stat->uring.load(std::memory_order_relaxed);
+        stats.delivered += stat->delivered.load(std::memory_order_relaxed);
+        stats.discarded += stat->discarded.load(std::memory_order_relaxed);
+        stats.gaps += stat->gaps.load(std::memory_order_relaxed);
+        stats.duplicates += stat->duplicates.load(std::memory_order_relaxed);
+        stats.overflows += stat->overflows.load(std::memory_order_relaxed);
+        stats.acks += stat->acks.load(std::memory_order_relaxed);
+        stats.bytes += stat->bytes.load(std::memory_order_relaxed);
+        stats.drops += stat->drops.load(std::memory_order_relaxed);
+        int rcvbuf = stat->rcvbuf.load(std::memory_order_relaxed);
+        if(!i || rcvbuf < stats.rcvbuf)
+            stats.rcvbuf = rcvbuf;
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool Kubix::nodeStats(int pid, int uid, KubixNodeStats &stats)
+{
+    KubixEpoch epoch;
+    Node *node = _nodes.find(get_composite_key(pid, uid));
+    if(!node || !node->_stat)
+        return false;
+    /* the slot is the node's as long as the node is there */
+    return KubixStats::read(node->_stat, stats);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::txStats(KubixTxStats &stats) const
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.uring = 1;
+    for(int i = 0; i < _ndispatchers; i++){
+        KubixSender *sender = _dispatchers[i].sender;
+        stats.syscalls += sender ? sender->syscalls() : 0;
+        stats.messages += sender ? sender->sent() : 0;
+        stats.uring &= sender && sender->uring();
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::spinStats(KubixSpinStats &stats) const
+{
+    stats.spins = _spin ? _spin->spins() : 0;
+    stats.hits = _spin ? _spin->hits() : 0;
+    stats.spin_ns = _spin ? _spin->spinNs() : 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+KubixHistogram *Kubix::latencyOf(int op, int stage) const
+{
+    int idx;
+    switch(op){
+    case KUBIX_CHANNEL:  idx = 0; break;
+    case KERNEL_REQUEST: idx = 1; break;
+    case KERNEL_RELEASE: idx = 2; break;
+    case KERNEL_REPORT:  idx = 3; break;
+    default:
+        return nullptr;
+    }
+    if(stage < 0 || KBX_LAT_STAGES <= stage)
+        return nullptr;
+    return &_latency[idx * KBX_LAT_STAGES + stage];
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool Kubix::latency(int op, int stage, KubixLatency &lat) const
+{
+    KubixHistogram *hist = latencyOf(op, stage);
+    if(!hist)
+        return false;
+    lat.count = hist->count();
+    lat.p50 = hist->percentile(500);
+    lat.p99 = hist->percentile(990);
+    lat.p999 = hist->percentile(999);
+    lat.max = hist->max();
+    return true;
+}
+/* ------------------------------------------------------------------------------
+ * The stamps of the message a thread took last: its answer on the channel
+ * echoes them to the kernel
+ * */
+static thread_local struct{
+    Kubix *bus;
+    int pid;
+    int uid;
+    int op;
+    struct kubix_ts ts;
+} taken_ts;
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static __u64 kbx_ts_delta(__u64 from, __u64 to)
+{
+    return from < to ? to - from : 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::stampRouted(struct kubix_frame *rmsg, int len)
+{
+    struct kubix_ts ts;
+    KubixHistogram *hist = latencyOf(rmsg->kbx_msg.opt, KBX_LAT_DELIVER);
+    if(!hist || !kubix_frame_get_ts(rmsg, len, ts))
+        return;
+    ts.received = kbx_now_ns();
+    kubix_frame_put_ts(rmsg, ts);
+    hist->record(kbx_ts_delta(ts.sent, ts.received));
+}
+/* ------------------------------------------------------------------------------
+ * The channel of the traced message a thread took last: its answer there
+ * is traced too
+ * */
+static thread_local struct{
+    Kubix *bus;
+    int pid;
+    int uid;
+} traced_send;
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+__u64 Kubix::traceRoute(struct kubix_frame *rmsg, int len, __u64 start)
+{
+    struct kubix_ts ts;
+    int pid = rmsg->kbx_msg.pid;
+    int uid = rmsg->kbx_msg.uid;
+    if(kubix_frame_get_ts(rmsg, len, ts))
+        _trace->span(KBX_TRACE_SOCKET, pid, uid, ts.sent,
+                     ts.received ? ts.received : start);
+    __u64 now = kbx_now_ns();
+    _trace->span(KBX_TRACE_ROUTE, pid, uid, start, now);
+    return now;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+__u64 Kubix::traceSend(int pid, int uid, __u32 seq)
+{
+    if(traced_send.bus != this || traced_send.pid != pid ||
+       traced_send.uid != uid || seq)
+        return 0;
+    traced_send.bus = nullptr;
+    return kbx_now_ns();
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int Kubix::traceExport(const char *path)
+{
+    if(!_trace)
+        return -1;
+    FILE *out = fopen(path, "w");
+    if(!out){
+        KBX_ERR("%s: %s", path, strerror(errno));
         return -1;
     }
+    int count = _trace->exportJson(out);
+    if(fclose(out)){
+        KBX_ERR("%s: %s", path, strerror(errno));
+        return -1;
+    }
+    return count;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::stampTaken(KubixBuf *buf)
+{
+    struct kubix_ts ts;
+    struct kubix_frame *rmsg = &buf->frame;
+    if(buf->trace){
+        _trace->span(KBX_TRACE_QUEUE, rmsg->kbx_msg.pid, rmsg->kbx_msg.uid,
+                     buf->trace, kbx_now_ns());
+        traced_send.bus = this;
+        traced_send.pid = rmsg->kbx_msg.pid;
+        traced_send.uid = rmsg->kbx_msg.uid;
+    }
+    KubixHistogram *hist = latencyOf(rmsg->kbx_msg.opt, KBX_LAT_QUEUE);
+    if(!hist || !kubix_frame_get_ts(rmsg, buf->len, ts))
+        return;
+    ts.taken = kbx_now_ns();
+    hist->record(kbx_ts_delta(ts.received, ts.taken));
+    taken_ts.bus = this;
+    taken_ts.pid = rmsg->kbx_msg.pid;
+    taken_ts.uid = rmsg->kbx_msg.uid;
+    taken_ts.op = rmsg->kbx_msg.opt;
+    taken_ts.ts = ts;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int Kubix::stampReply(struct kubix_frame *smsg, int len)
+{
+    /* a sendRequest is not an answer */
+    if(taken_ts.bus != this || taken_ts.pid != smsg->kbx_msg.pid ||
+       taken_ts.uid != smsg->kbx_msg.uid || smsg->cn_msg.seq)
+        return len;
+    taken_ts.bus = nullptr;
+    taken_ts.ts.replied = kbx_now_ns();
+    latencyOf(taken_ts.op, KBX_LAT_SERVE)->record(
+        kbx_ts_delta(taken_ts.ts.taken, taken_ts.ts.replied));
+    return kubix_frame_add_ts(smsg, taken_ts.ts);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int Kubix::runBus()
+{
+    int failed = 0;
+    if((_user_app_callback || _user_view_callback) && !_workers)
+        _workers = new KubixWorkers(_config.workers, _spin);
+    for(int i = 0; i < _ndispatchers; i++){
+        DistributorContext *pctx = &_dispatchers[i];
+        pctx->running = 1;
+        int err = pthread_create(&pctx->tid, NULL, &Kubix::dispatch, pctx);
+        if(err){
+            KBX_ERR("dispatcher of shard %d: %s", i, strerror(err));
+            pctx->running = 0;
+            pctx->tid = 0;
+            failed = 1;
+        }
+    }
+    return failed ? -1 : 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::joinBus()
+{
+    for(int i = 0; i < _ndispatchers; i++){
+        DistributorContext *pctx = &_dispatchers[i];
+        if(pctx->tid){
+            pthread_join(pctx->tid, NULL);
+            pctx->tid = 0;
+        }
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::stopBus()
+{
+    __u64 one = 1;
+    for(int i = 0; i < _ndispatchers; i++){
+        DistributorContext *pctx = &_dispatchers[i];
+        pctx->running = 0;
+        if(pctx->tid && pctx->wake_fd != -1 &&
+           write(pctx->wake_fd, &one, sizeof(one)) != sizeof(one))
+            KBX_WARN("no wakeup of shard %d: %s", i, strerror(errno));
+    }
+    /* a dispatcher may be parked on a full OVERFLOW_BLOCK queue */
+    _nodes.forEach([](Node *node){ node->_queue.interrupt(); });
+    joinBus();
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int Kubix::setCnFd()
+{
+    int failed = 0;
+    for(int i = 0; i < _ndispatchers; i++){
+        DistributorContext *pctx = &_dispatchers[i];
+        pctx->pfd.fd = pctx->transport->open();
+        pctx->pfd.events = POLLIN;
+        pctx->pfd.revents = 0;
+        failed |= pctx->pfd.fd == -1;
+        if(pctx->pfd.fd != -1)
+            setRcvbuf(pctx, _config.rcvbuf ? _config.rcvbuf : KBX_RCVBUF_MIN);
+        /* the dispatcher checks again, the filter only saves the copies */
+        if(pctx->pfd.fd != -1 && _config.socket_filter &&
+           pctx->transport->attachFilter(_config.accept_ops))
+            KBX_WARN("no socket filter on %s shard %d: %s",
+                     pctx->transport->name(), i, strerror(errno));
+    }
+    return failed ? -1 : _dispatchers[0].pfd.fd;
+}
+/* ------------------------------------------------------------------------------
+ * A traced send2kernel records its span on the way out
+ * */
+struct SendSpan{
+    KubixTrace *trace;
+    int pid;
+    int uid;
+    __u64 start;
 
-    l_local.nl_family = AF_NETLINK;
-    l_local.nl_groups = -1; //CN_SS_IDX; /* bitmask of requested groups */
-    l_local.nl_pid = 0;
-
-    fprintf(stderr, "%d:%s:: subscribing to %u.%u\n",
-            __LINE__, __func__,
-            CN_SS_IDX, CN_SS_VAL);
+    ~SendSpan()
+    {
+        if(start)
+            trace->span(KBX_TRACE_SEND, pid, uid, start, kbx_now_ns());
+    }
+};
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int Kubix::send2kernel(int pid, int uid, int op, int ret, void *payload, int len,
+                       __u32 seq)
+{
+    SendSpan span = { _trace, pid, uid, _trace ? traceSend(pid, uid, seq) : 0 };
+    KBX_PROBE(send, pid, uid, op, len, seq);
+    DistributorContext *pctx = shardOf(pid, uid);
+    int fd = pctx->pfd.fd;
+    struct kubix_frame smsg;
 
-    if(bind(_pfd.fd, (struct sockaddr *)&l_local, sizeof(struct sockaddr_nl)) < 0 ){
-        perror("bind");
-        close(_pfd.fd);
+    KBX_DEBUG("[pid:%d, uid:%d] message length %d", pid, uid, len);
+    if(pctx->sender){
+        KubixSendReq req;
+        if(!send2kernelAsync(&req, pid, uid, op, ret, payload, len, seq))
+            return KubixSender::wait(&req) ? -1 : 0;
+        if(req.frame_len < 0)
+            return -1;
+        /* the sender stage is full, go around it */
+        if(send(fd, &req.frame, req.frame_len, MSG_NOSIGNAL) != req.frame_len){
+            KBX_ERR("[pid:%d, uid:%d] send errno '%s' [%d]", pid, uid,
+                    strerror(errno), errno);
+            return -1;
+        }
+        return 0;
+    }
+    int smsg_len = kubix_frame_fill(&smsg, pid, uid, op, ret, seq, payload, len,
+                                    pctx->shard);
+    if(smsg_len < 0){
+        KBX_ERR("[pid:%d, uid:%d] invalid message length %d", pid, uid, len);
+        return -1;
+    }
+    smsg.cn_msg.ack = rxAck(pid, uid);
+    smsg_len = stampReply(&smsg, smsg_len);
+    if(send(fd, &smsg, smsg_len, MSG_NOSIGNAL) != smsg_len){
+        KBX_ERR("[pid:%d, uid:%d] send errno '%s' [%d]", pid, uid,
+                strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int Kubix::send2kernelAsync(KubixSendReq *req, int pid, int uid, int op,
+                            int ret, void *payload, int len, __u32 seq)
+{
+    DistributorContext *pctx = shardOf(pid, uid);
+    req->frame_len = kubix_frame_fill(&req->frame, pid, uid, op, ret, seq,
+                                      payload, len, pctx->shard);
+    if(req->frame_len < 0){
+        KBX_ERR("[pid:%d, uid:%d] invalid message length %d", pid, uid, len);
         return -1;
     }
+    req->frame.cn_msg.ack = rxAck(pid, uid);
+    req->frame_len = stampReply(&req->frame, req->frame_len);
+    if(!pctx->sender || !pctx->sender->submit(req))
+        return -1;
+    return 0;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int Kubix::sendRequest(int pid, int uid, void *payload, int len,
+                       KubixFuture &future)
+{
+    int state = future._state.load(std::memory_order_acquire);
+    if(state == KBX_FUTURE_PENDING || state == KBX_FUTURE_WAITING){
+        KBX_ERR("[pid:%d, uid:%d] the future is in use, seq %u", pid, uid,
+                future._seq);
+        return -1;
+    }
+    if(future._reply){
+        kbx_buf_release(future._reply);
+        future._reply = nullptr;
+    }
+    /* 0 is a message without a request */
+    __u32 seq;
+    do{
+        seq = _request_seq.fetch_add(1, std::memory_order_relaxed);
+    }while(!seq);
+    future._bus = this;
+    future._pid = pid;
+    future._uid = uid;
+    future._seq = seq;
+    future._state.store(KBX_FUTURE_PENDING, std::memory_order_relaxed);
 
-    _pfd.events = POLLIN;
-    _pfd.revents = 0;
-
-    return _pfd.fd;
-}
-/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
-int Kubix::send2kernel(int pid, int uid, int op, int ret, void *payload, int len)
-{
-    int fd = _pfd.fd;
-    struct __attribute__((aligned(NLMSG_ALIGNTO))) {
-        struct nlmsghdr nl_hdr;
-        struct __attribute__((__packed__)) {
-            struct cn_msg cn_msg;
-            struct kubix_hdr kbx_msg;
-            char buf[1024];
-        };
-    } smsg;
-    int cn_msg_data_len = sizeof(struct kubix_hdr) + len;
-    int nlmsg_data_len  = NLMSG_LENGTH(sizeof(struct cn_msg) + cn_msg_data_len);
-    int smsg_len        = sizeof(struct nlmsghdr) + nlmsg_data_len;
-
-    fprintf(stderr, "%d:%s: [pid:%d, uid:%d] message length %d\n",
-           __LINE__, __func__, pid, uid, len);
-    memset(&smsg, 0, sizeof(smsg));
-    smsg.nl_hdr.nlmsg_len = nlmsg_data_len;         /* Netlink */
-    smsg.nl_hdr.nlmsg_pid = getpid();
-    smsg.nl_hdr.nlmsg_type = NLMSG_DONE;
-    smsg.cn_msg.id.idx = CN_SS_IDX;                 /* Connector */
-    smsg.cn_msg.id.val = CN_SS_VAL;
-    smsg.cn_msg.ack = 0;
-    smsg.cn_msg.len = 0;
-    smsg.cn_msg.len = cn_msg_data_len;
-    smsg.kbx_msg.pid = pid;                         /* Kubix */
-    smsg.kbx_msg.uid = uid;
-    smsg.kbx_msg.opt = op;
-    smsg.kbx_msg.ret = ret;
-    smsg.kbx_msg.data_len = len;
-    memcpy(&smsg.buf, payload, len);                /* App payload */
-    if(send(fd, &smsg, smsg_len, 0) != smsg_len){
-        perror("send");
+    /* registered first: the reply may beat send2kernel back */
+    pthread_mutex_lock(&_requests_mutex);
+    _requests.put(seq, &future);
+    pthread_mutex_unlock(&_requests_mutex);
+    if(send2kernel(pid, uid, USER_MESSAGE, 0, payload, len, seq) &&
+       forgetRequest(&future)){
+        future._state.store(KBX_FUTURE_IDLE, std::memory_order_relaxed);
         return -1;
     }
     return 0;
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool Kubix::forgetRequest(KubixFuture *future)
+{
+    KubixEpoch epoch;
+    bool found = false;
+
+    pthread_mutex_lock(&_requests_mutex);
+    if(_requests.find(future->_seq) == future){
+        _requests.remove(future->_seq);
+        found = true;
+    }
+    pthread_mutex_unlock(&_requests_mutex);
+    return found;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool Kubix::completeRequest(DistributorContext *pctx, KubixBuf *buf)
+{
+    struct kubix_frame *rmsg = &buf->frame;
+    __u32 ack = rmsg->cn_msg.ack;
+    KubixFuture *future = nullptr;
+
+    pthread_mutex_lock(&_requests_mutex);
+    if(ack && (future = _requests.find(ack)) &&
+       future->_pid == rmsg->kbx_msg.pid && future->_uid == rmsg->kbx_msg.uid)
+        _requests.remove(ack);
+    else
+        future = nullptr;
+    pthread_mutex_unlock(&_requests_mutex);
+
+    if(!future){
+        /* timed out, cancelled, or not ours */
+        KBX_DEBUG("node[%d.%d] no request seq %u for the reply",
+                  rmsg->kbx_msg.pid, rmsg->kbx_msg.uid, ack);
+        return false;
+    }
+    void *coro = future->complete(buf);
+    if(coro)
+        pctx->answers.push_back(coro);
+    return true;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
 bool Kubix::getMessage(int pid, int uid, int &op, int &ret,
                        char (*buffer)[PAYLOAD_MAX_SIZE], int &len)
 {
-    Node *node;
-    if(!findNode(pid, uid, node)){
-        fprintf(stderr, "%d:%s: no related node[%d.%d] object in Kubix\n",
-               __LINE__, __func__, pid, uid);
+    KubixView view;
+    if(!getMessageView(pid, uid, view))
         return false;
-    }
-    Node::setWaitLock lock(&node->_mutex, &node->_cond);
 
-    while(!node->_recv_len)
-        lock.waitMsg();
+    memcpy(*buffer, view.data, view.len);
+    len = view.len;
+    op  = view.hdr->opt;
+    ret = view.hdr->ret;
+    view.release();
 
-    fprintf(stderr, "%d:%s: got message for node[%d.%d]\n",
-           __LINE__, __func__, pid, uid);
-
-    char *msg = *buffer;
-    memset(msg, 0x00, sizeof(buffer));
+    return true;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+bool Kubix::getMessageView(int pid, int uid, KubixView &view)
+{
+    Node *node;
+    {
+        KubixEpoch epoch;
+        node = _nodes.find(get_composite_key(pid, uid));
+        if(!node){
+            KBX_WARN("no related node[%d.%d] object in Kubix", pid, uid);
+            return false;
+        }
+        /* the wait below may outlast an eraseNode */
+        node->get();
+    }
+    KubixBuf *buf;
+    for(;;){
+        int seq = node->_event.prepare();
+        if(node->_queue.pop(buf)){
+            node->served();
+            stampTaken(buf);
+            break;
+        }
+        if(node->_queue.closed()){
+            KBX_DEBUG("node[%d.%d] is erased", pid, uid);
+            node->put();
+            return false;
+        }
+        if(_spin && _spin->wait(node->_spin_ns,
+                                [node]{ return !node->_queue.empty(); }))
+            continue;
+        node->_event.wait(seq);
+    }
 
-    memcpy(msg, node->_recv_buffer, node->_recv_len);
-    len = node->_recv_len;
-    op  = node->_opt;
-    ret = node->_ret;
+    KBX_DEBUG("got message for node[%d.%d]", pid, uid);
 
-    memset(node->_recv_buffer, 0x00, sizeof(node->_recv_buffer));
-    node->_recv_len = 0;
+    setView(view, buf);
+    node->_opt = view.hdr->opt;
+    node->_ret = view.hdr->ret;
+    if(view.seq)
+        node->_taken.store(view.seq, std::memory_order_relaxed);
+    node->put();
 
     return true;
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
-void *Kubix::userAppThread(void *c)
+void Kubix::setView(KubixView &view, KubixBuf *buf)
 {
-    UserChannelThreadCtx *pctx = (UserChannelThreadCtx*)c;
-    int pid = pctx->pid;
-    int uid = pctx->uid;
-    Kubix *bus = pctx->_bus;
+    /* the header sits 4-byte aligned right before the payload */
+    view.hdr = (const kubix_hdr*)(buf->frame.buf - sizeof(kubix_hdr));
+    view.data = buf->frame.buf;
+    view.len = buf->frame.kbx_msg.data_len;
+    view.seq = buf->frame.cn_msg.seq;
+    view.buf = buf;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::serveChannel(void *arg)
+{
+    Node *node = (Node*)arg;
+    Kubix *bus = node->_bus;
+    KubixBuf *buf;
 
-    char buffer[PAYLOAD_MAX_SIZE];
-    int len, op, ret, err;
-    fprintf(stderr, "%d:%s: starting thread [%d.%d] ...\n",
-           __LINE__, __func__, pid, uid);
+    for(;;){
+        int served = 0;
+        while(served < CHANNEL_SERVE_QUOTA && node->_queue.pop(buf)){
+            node->served();
+            bus->stampTaken(buf);
+            bus->callUserApp(node, buf);
+            served++;
+        }
+        if(served == CHANNEL_SERVE_QUOTA && !node->_queue.empty()){
+            /* still scheduled, give the worker to other channels */
+            bus->_workers->post(&Kubix::serveChannel, node);
+            return;
+        }
+        node->_scheduled.store(0);
+        /* a message pushed before the store above was not posted */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(node->_queue.empty() || node->_scheduled.exchange(1)){
+            node->put();
+            return;
+        }
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+void Kubix::callUserApp(Node *node, KubixBuf *buf)
+{
+    int err;
+    KubixView view;
 
-    while(pctx->running){
-        // wait for kernel message
-        if(!bus->getMessage(pid, uid, op, ret, &buffer, len))
-            continue;
-        // call user app processing logic
-        fprintf(stderr, "%d:%s: thread [%d.%d] got message of length %d, "
-                "operation type %d\n",
-               __LINE__, __func__, pid, uid, len, op);
-        UserCallbackCtx ucc;
-        ucc.pid = pid;
-        ucc.uid = uid;
-        ucc.op  = op;
-        ucc.ret = ret;
-        memcpy(ucc.msg, buffer, len);
-        ucc.len = len;
-        err = bus->_user_app_callback(&ucc);
+    setView(view, buf);
+    KBX_DEBUG("channel [%d.%d] got message of length %d, operation type %d",
+              node->_pid, node->_unique, view.len, view.hdr->opt);
+    node->_opt = view.hdr->opt;
+    node->_ret = view.hdr->ret;
+    if(view.seq)
+        node->_taken.store(view.seq, std::memory_order_relaxed);
+    __u64 traced = buf->trace ? kbx_now_ns() : 0;
+    int op = view.hdr->opt;
+    int len = view.len;
+    __u32 seq = view.seq;
+    KBX_PROBE(callback_begin, node->_pid, node->_unique, op, len, seq);
+
+    if(_user_view_callback){
+        err = _user_view_callback(this, &view);
+        KBX_PROBE(callback_end, node->_pid, node->_unique, op, len, seq);
+        if(traced)
+            _trace->span(KBX_TRACE_CALLBACK, node->_pid, node->_unique, traced,
+                         kbx_now_ns());
         if(err){
-            fprintf(stderr, "%d:%s: thread [%d.%d] - user callback returned "
-                    "eror code %d\n",
-                   __LINE__, __func__, pid, uid, err);
-            continue;
+            node->served(err);
+            KBX_WARN("channel [%d.%d] - user callback returned eror code %d",
+                     node->_pid, node->_unique, err);
         }
-        // send response back to kernal with user app payload instead.
-        err = bus->send2kernel(pid, uid, op, ret, &buffer, len);
+        view.release();
+        return;
     }
-    fprintf(stderr, "%d:%s: ... stopping thread [%d.%d]\n",
-           __LINE__, __func__, pid, uid);
-    return (void*)0;
+
+    /* the context doubles as the reply buffer, the payload is copied once */
+    UserCallbackCtx ucc;
+    ucc.pid = node->_pid;
+    ucc.uid = node->_unique;
+    ucc.op  = view.hdr->opt;
+    ucc.ret = view.hdr->ret;
+    memcpy(ucc.msg, view.data, view.len);
+    ucc.len = view.len;
+    view.release();
+    err = _user_app_callback(&ucc);
+    KBX_PROBE(callback_end, node->_pid, node->_unique, op, len, seq);
+    if(traced)
+        _trace->span(KBX_TRACE_CALLBACK, node->_pid, node->_unique, traced,
+                     kbx_now_ns());
+    if(err){
+        node->served(err);
+        KBX_WARN("channel [%d.%d] - user callback returned eror code %d",
+                 node->_pid, node->_unique, err);
+        return;
+    }
+    // send response back to kernal with user app payload instead.
+    send2kernel(ucc.pid, ucc.uid, ucc.op, ucc.ret, ucc.msg, ucc.len);
 }
 #ifdef UNIT_TEST
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
-void Kubix::putMsg(int pid, int uid, char *msg, int len, bool wake_up)
+void Kubix::putMsg(int pid, int uid, char *msg, int len, bool wake_up, int op)
 {
+    KubixEpoch epoch;
     Node *node;
     if(!findNode(pid, uid, node)){
-        fprintf(stderr, "%d:%s: not related node[%d.%d] object in Kubix\n",
-               __LINE__, __func__, pid, uid);
+        KBX_WARN("not related node[%d.%d] object in Kubix", pid, uid);
+        return;
+    }
+    KubixBuf *buf = _dispatchers[0].pool->alloc();
+    if(!buf)
+        return;
+    buf->len = kubix_frame_fill(&buf->frame, pid, uid, op, 0, 0, msg, len);
+    if(buf->len < 0 || !node->_queue.push(buf)){
+        KBX_WARN("node[%d.%d] queue is full", pid, uid);
+        kbx_buf_release(buf);
         return;
     }
-    memset(node->_recv_buffer, 0x00, sizeof(node->_recv_buffer));
-    memcpy(node->_recv_buffer, msg, len);
-    node->_recv_len = len;
-    fprintf(stderr, "%d:%s: message [%s] length %d in the Kubix, key[%d.%d]\n",
-            __LINE__, __func__, msg, len, pid, uid);
+    KBX_DEBUG("message [%s] length %d in the Kubix, key[%d.%d]", msg, len, pid,
+              uid);
     if(wake_up)
-        pthread_cond_signal(&node->_cond);
+        node->_event.signal();
     return;
 }
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
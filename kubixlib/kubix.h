@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <unordered_map>
+#include <vector>
 #include <connector.h>
 #include <pthread.h>
 #include <time.h>
@@ -32,6 +33,8 @@
 #define KUBIX_H
 
 #define PAYLOAD_MAX_SIZE	1024
+#include "kbx_queue.h"
+#include "kbx_nodes.h"
 /* ------------------------------------------------------------------------------
  * */
 struct kubix_hdr{
@@ -45,6 +48,23 @@ struct kubix_hdr{
 					 */
 };
 
+/* ------------------------------------------------------------------------------
+ * Timestamp trailer: with the kubix module 'timestamps' parameter on, a
+ * kernel message follows its payload with it, cn_msg.len covers it. The bus
+ * stamps it on the way and echoes it after the payload of the answer the
+ * consumer sends. Times are CLOCK_MONOTONIC ns, the kernel ktime_get_ns();
+ * unaligned, see kubix_frame_get_ts().
+ * */
+#define KBX_TS_MAGIC	0x5354424b	/* "KBTS" */
+struct kubix_ts{
+	__u32 magic;
+	__u32 reserved;
+	__u64 sent;			/* kernel: the message is sent */
+	__u64 received;		/* bus: the dispatcher routed it */
+	__u64 taken;		/* bus: the consumer took it off the queue */
+	__u64 replied;		/* bus: the answer is sent */
+};
+
 /* ------------------------------------------------------------------------------
  * */
 enum OPERATION_TYPES{
@@ -55,7 +75,13 @@ enum OPERATION_TYPES{
 	USER_RELEASE,	 /*	 notify kernel on user close	   */
 	KERNEL_REPORT,	 /*	 report to kubix user side		 */
 	NO_ACTION,		 /*	 remove this from code			 */
+	KERNEL_REPLY,	 /*	 answer on a sequenced USER_MESSAGE */
+	USER_ACK,		 /*	 ack up to cn_msg.ack, resend the rest */
 };
+#define KBX_OP_BIT(op)	((unsigned)(op) < 32 ? 1u << (op) : 0u)
+#define KBX_KERNEL_OPS	(KBX_OP_BIT(KUBIX_CHANNEL) | KBX_OP_BIT(KERNEL_REQUEST) | \
+						 KBX_OP_BIT(KERNEL_RELEASE) | KBX_OP_BIT(KERNEL_REPORT) | \
+						 KBX_OP_BIT(KERNEL_REPLY))
 /* ------------------------------------------------------------------------------
  * */
 const char *strNodeState(int state);
@@ -64,52 +90,237 @@ const char *strNodeState(int state);
 const char *str_opertype(int t );
 
 /* ------------------------------------------------------------------------------ */
-class UserChannelThreadCtx;
+class Kubix;
 /* ------------------------------------------------------------------------------
  * */
 class Node{
 public:
-	Node(int pid, int uid);
+	/* @brief  - the userspace end of a channel
+	 * @parm1 pid  - the id of the kernelspace process/thread
+	 * @parm2 uid  - the unique value in the kernelspace process/thread
+	 * @parm3 depth  - the number of messages the node queue holds
+	 * @parm4 policy - OVERFLOW_POLICY of the node queue
+	 */
+	Node(int pid, int uid, int depth, int policy);
 	~Node();
 
-	class setSignalLock{
-		public:
-			setSignalLock(pthread_mutex_t*, pthread_cond_t*);
-			~setSignalLock();
-		private:
-			pthread_mutex_t *_mutex_ptr;
-			pthread_cond_t *_cond_ptr;
-	};
-	class setWaitLock{
-		public:
-			setWaitLock(pthread_mutex_t*, pthread_cond_t*);
-			~setWaitLock();
-			void waitMsg();
-		private:
-			pthread_mutex_t *_mutex_ptr;
-			pthread_cond_t *_cond_ptr;
-			struct timespec _ts;
-	};
+	/* @brief  - takes and drops a reference, the last put deletes the
+	 *		   node; the node table holds one while the node is in it
+	 */
+	void get() { _refs.fetch_add(1, std::memory_order_relaxed); }
+	void put();
 
-	pthread_mutex_t _mutex;
-	pthread_cond_t _cond;
+	/* @brief  - nodes come from a slab, see kbx_slab.h
+	 */
+	static void *operator new(size_t size);
+	static void operator delete(void *node);
+	static KubixSlab *nodeSlab();
 
-    UserChannelThreadCtx *_thread_context;
+	/* hot: looked at by the dispatcher and the consumer per message */
+	alignas(KBX_CACHE_LINE) std::atomic<int> _scheduled;	/* posted to the worker pool */
+	std::atomic<int> _refs;
 	enum {
 		NLC_NETLINK,
 		NLC_DESTROY,
 	} _state;
-
 	int  _pid;
 	int  _unique;
-	__u8 _opt;
+	__u8 _opt;		/* the last consumed message */
 	__u8 _ret;
-	int  _recv_len;
-	char _recv_buffer[PAYLOAD_MAX_SIZE];
+	std::atomic<__u32> _taken;	/* its kernel seq, acked by the answer */
+	bool _callback;					/* served by _user_app_callback */
+	Kubix *_bus;
+	KubixEvent _event;	/* wakes up a getMessage parked on the queue */
+	std::atomic<int> _spin_ns;	/* latency mode: the consumer spin budget */
+	std::atomic<void*> _coro;	/* the KubixReceive parked in receive() */
+
+	/* the published counters of the channel, may be null; see kbx_stats.h */
+	struct kubix_stat_node *_stat;
+
+	/* @brief  - counts in _stat a message the consumer took off the
+	 *		   queue, or with 'err' a user callback which failed on it
+	 */
+	void served(int err = 0);
+
+	/* reliable delivery: the dispatcher of the channel shard writes them */
+	std::atomic<__u32> _rx_seq;	/* the last kernel seq taken, in order with
+								 * KubixConfig::reliable */
+	__u32 _rx_acked;			/* the last seq sent in a USER_ACK */
+	int   _rx_held;				/* dropped out of order since that USER_ACK */
+	bool  _rx_resend;			/* that USER_ACK asked for a resend */
+
+	NodeQueue _queue;	/* kernel messages: dispatcher -> channel consumer */
 };
 
 /* ------------------------------------------------------------------------------ */
 #define BUS_HT_BITS			12
+#define NODE_QUEUE_DEPTH	16
+#define RX_BATCH_SIZE		32	/* datagrams drained per dispatcher wakeup */
+#define RX_BATCH_BUCKETS	8	/* batch sizes 1, 2-3, 4-7, ..., 128+ */
+#define TX_QUEUE_DEPTH		4096	/* replies queued to the sender stage */
+#define TX_FLUSH_US			50	/* the oldest queued reply waits at most */
+#define CHANNEL_SERVE_QUOTA	16	/* messages a worker serves per channel turn */
+#define NODE_TABLE_SHARDS	16	/* independently locked parts of the node table */
+#define RX_BUF_CACHE		1024	/* released receive buffers kept for reuse */
+#define RX_REFILL_US		100		/* out of receive buffers: first retry, */
+#define RX_REFILL_MAX_US	10000	/* doubled up to that */
+#define SPIN_MAX_US			50		/* latency mode: longest spin before sleeping */
+#define RX_URING_BUFS		256		/* io_uring: least buffers provided to the kernel */
+#define KBX_MAX_SHARDS		8		/* connector ids, one dispatcher each */
+#define KBX_RTX_WINDOW		32		/* unacked messages the kernel keeps per
+									 * channel, as of the kubix module */
+#define KBX_ACK_EVERY		(KBX_RTX_WINDOW / 2)	/* in order messages per USER_ACK */
+#define KBX_RCVBUF_MIN		(1 << 20)	/* socket receive buffer, auto sized */
+#define KBX_RCVBUF_MAX		(16 << 20)
+#define KBX_MAIN_PID		0		/* the channel of the kernel bus and */
+#define KBX_MAIN_UID		-10		/* the user bus themselves */
+#define KBX_STAT_NODES		1024	/* channels with published counters */
+
+/* @brief  - the connector id shard of a channel, the kernel bus places its
+ *		   channel nodes the same way (kbx_storage.c), so a channel keeps
+ *		   one socket and one dispatcher for its whole life
+ * @return	 - the shard in [0, shards), id CN_SS_IDX + shard, CN_SS_VAL.
+ */
+static inline int kubix_shard_of(int pid, int uid, int shards)
+{
+	__u64 key = ((__u64)(__u32)uid << 32) | (__u32)pid;
+	return (int)(((key * 0x9E3779B97F4A7C15ULL) >> 32) % (__u32)shards);
+}
+/* ------------------------------------------------------------------------------
+ * Bus tunables, the defaults are used if the bus is created without config
+ * */
+struct KubixConfig{
+	KubixConfig();
+
+	int queue_depth;		/* messages queued per node, power of two */
+	int overflow_policy;	/* OVERFLOW_POLICY when a node queue is full;
+							 * OVERFLOW_DROP_NEWEST by default, with
+							 * 'reliable' the kernel resends what it
+							 * drops. OVERFLOW_DROP_OLDEST loses acked
+							 * messages. OVERFLOW_BLOCK loses none but a
+							 * channel nobody reads stalls its whole
+							 * shard until it is erased */
+	int rx_batch;			/* datagrams received by one recvmmsg call */
+	int tx_batch;			/* replies sent by one sendmmsg call; 0 sends
+							 * directly from the calling thread */
+	int tx_flush_us;		/* flush a partial batch after that long */
+	int tx_queue_depth;		/* replies queued to the sender stage */
+	int workers;			/* threads running _user_app_callback; 0 takes
+							 * the number of online CPUs */
+	int table_shards;		/* node table shards, power of two; 1 is a
+							 * single lock over all channels */
+	int rx_buf_cache;		/* receive buffers recycled without the slab */
+	int latency_mode;		/* the dispatcher busy polls the transport and
+							 * consumers spin before they sleep, trading
+							 * CPU for wakeup latency; see KubixSpin */
+	int spin_us;			/* the longest spin, also SO_BUSY_POLL */
+	int socket_filter;		/* a classic BPF filter on every transport
+							 * socket drops foreign connector ids and
+							 * unwanted ops in the kernel, before the copy
+							 * to the bus; the dispatcher drops them anyway */
+	unsigned accept_ops;	/* KBX_OP_BIT of the ops the bus takes from the
+							 * kernel, KBX_KERNEL_OPS by default */
+	int dispatchers;		/* connector id shards, each with a socket, a
+							 * dispatcher thread and a sender stage of its
+							 * own, up to KBX_MAX_SHARDS; the kubix module
+							 * 'shards' parameter wins when the transport
+							 * can read it */
+	int io_uring;			/* receive with a multishot io_uring recv and
+							 * send the sender stage batches as linked
+							 * SQEs; poll and sendmmsg if the kernel
+							 * has no io_uring or lacks a feature */
+	int reliable;			/* track the kernel seq of every channel: drop
+							 * duplicates and what comes after a gap, ask
+							 * the kernel to resend with USER_ACK. The
+							 * seqs taken are acked either way, in
+							 * cn_msg.ack of the messages sent: the kernel
+							 * refuses to send past KBX_RTX_WINDOW unacked */
+	int rcvbuf;				/* socket receive buffer bytes; 0 starts with
+							 * KBX_RCVBUF_MIN and doubles it on every
+							 * overflow up to KBX_RCVBUF_MAX */
+	int stats;				/* publish the bus and channel counters in
+							 * /dev/shm for kubix-stat; 0, the default
+							 * unless KUBIX_STATS=1 is in the environment,
+							 * keeps them in private memory */
+	int stat_nodes;			/* channel slots of the counters */
+	int trace_sample;		/* trace the stages of one kernel message in
+							 * that many, see kbx_trace.h; 0 is off */
+	int trace_ring;			/* trace spans kept per thread */
+};
+/* ------------------------------------------------------------------------------
+ * Dispatcher receive counters; batches[i] counts wakeups which drained
+ * [2^i, 2^(i+1)) datagrams, the last bucket is open ended.
+ * */
+struct KubixRxStats{
+	unsigned long wakeups;
+	unsigned long messages;
+	unsigned long batches[RX_BATCH_BUCKETS];
+	int uring;				/* every dispatcher runs on io_uring */
+	unsigned long delivered;	/* Kubix datagrams routed to the channels */
+	unsigned long discarded;	/* foreign ids or ops not in accept_ops which
+								 * got past the socket filter, or came with
+								 * the filter off */
+	unsigned long gaps;			/* dropped after a missing seq, resent later */
+	unsigned long duplicates;	/* seqs taken already, e.g. resent ones */
+	unsigned long overflows;	/* ENOBUFS: the socket dropped datagrams */
+	unsigned long acks;			/* USER_ACKs sent */
+	int rcvbuf;					/* the smallest shard socket receive buffer */
+	unsigned long bytes;		/* payload queued to the channels */
+	unsigned long drops;		/* messages lost to full channel queues */
+};
+/* ------------------------------------------------------------------------------
+ * The counters of a channel: the dispatcher counts what it queues, the
+ * consumer what it takes; depth is the queue length seen by the last one.
+ * */
+struct KubixNodeStats{
+	int pid;
+	int uid;
+	int shard;
+	unsigned long messages;
+	unsigned long bytes;
+	unsigned long drops;
+	int depth;
+	int depth_max;
+	unsigned long served;
+	unsigned long errors;		/* user callbacks which returned an error */
+};
+/* ------------------------------------------------------------------------------
+ * Latency percentiles of the stamped kernel messages in ns, by stage:
+ * the kernel to the dispatcher, the channel queue, the consumer until its
+ * answer; see struct kubix_ts
+ * */
+enum KBX_LATENCY_STAGES{
+	KBX_LAT_DELIVER,		/* sent to routed */
+	KBX_LAT_QUEUE,			/* routed to taken */
+	KBX_LAT_SERVE,			/* taken to replied */
+	KBX_LAT_STAGES
+};
+#define KBX_LAT_OPS		4	/* KUBIX_CHANNEL, KERNEL_REQUEST, KERNEL_RELEASE,
+							 * KERNEL_REPORT */
+struct KubixLatency{
+	unsigned long count;
+	__u64 p50;
+	__u64 p99;
+	__u64 p999;
+	__u64 max;
+};
+/* ------------------------------------------------------------------------------
+ * Latency mode counters, zero if the mode is off; a spin which did not
+ * find work ended in a sleep
+ * */
+struct KubixSpinStats{
+	unsigned long spins;	/* spins started by all waiters */
+	unsigned long hits;		/* spins which found work */
+	unsigned long spin_ns;	/* CPU time burned spinning */
+};
+/* ------------------------------------------------------------------------------
+ * Sender stage counters, zero if the stage is off
+ * */
+struct KubixTxStats{
+	unsigned long syscalls;
+	unsigned long messages;
+	int uring;				/* every sender flushes through io_uring */
+};
 struct UserCallbackCtx{
 	int  pid;
 	int  uid;
@@ -119,9 +330,59 @@ struct UserCallbackCtx{
 	int  len;
 };
 typedef int  (*USER_APP_CALLBACK)(UserCallbackCtx*);
+/* ------------------------------------------------------------------------------
+ * A received kernel message in place: the header and payload point into the
+ * datagram buffer the dispatcher received it in. The buffer is the view's
+ * until release(); hold() keeps it for one more release, e.g. to hand the
+ * message to another thread.
+ * */
+struct KubixBuf;
+struct KubixView{
+	const struct kubix_hdr *hdr;	/* pid, uid, opt, ret, data_len */
+	const char *data;				/* the payload */
+	int len;						/* the payload length */
+	__u32 seq;						/* connector sequence number */
+	KubixBuf *buf;
+
+	void hold();
+	void release();
+};
+typedef int  (*USER_VIEW_CALLBACK)(Kubix *bus, KubixView *view);
+/* @brief  - resumes the coroutine of a KubixReceive parked in
+ *		   Kubix::receive() with the message, kbx_coro.cpp
+ */
+void kbx_coro_resume(void *parked);
+
+/* @brief  - resumes a coroutine parked in Kubix::request() once the
+ *		   dispatcher completed its future, kbx_coro.cpp
+ * @parm   - the coroutine handle address
+ */
+void kbx_coro_answer(void *coro);
+class KubixTransport;
+class KubixSender;
+class KubixWorkers;
+class KubixBufPool;
+class KubixSpin;
+class KubixFuture;
+class KubixStats;
+class KubixHistogram;
+class KubixTrace;
+struct KubixSendReq;
+struct KubixReceive;
+struct KubixReply;
+struct KubixRequest;
+struct kubix_frame;
 class Kubix{
 public:
-	Kubix();
+	/* @brief  - opens the bus on the given transport
+	 * @parm1 transport - the physical channel to the kernel bus, owned by
+	 *			   the caller; if null the bus opens its own netlink
+	 *			   connector socket. It serves shard 0, the bus gets the
+	 *			   other shards from its newShard() and owns them
+	 * @parm2 config - bus tunables
+	 */
+	Kubix(KubixTransport *transport = nullptr,
+		  const KubixConfig &config = KubixConfig());
 	~Kubix();
 
 	//---------------------------------------------------------------------------
@@ -138,7 +399,9 @@ public:
 	 *		   of kernelspace process/thread
 	 * @parm1 pid  - the id of the kernelspace process/thread
 	 * @parm2 uid  - the unique value in the kernelspace process/thread
-	 * @parm3 node - the reference to the pointer of the found Node object
+	 * @parm3 node - the reference to the pointer of the found Node object;
+	 *			   it stays valid while the node is in the table, or as
+	 *			   long as the caller stays in a KubixEpoch guard
 	 * @return	 - 'true' if succeeded, otherwise 'false'.
 	 */
 	bool findNode(int pid, int uid, Node *(&node));
@@ -146,7 +409,11 @@ public:
 	/* @brief  - removes a Node object from  the kubix hashtable by pid and uid
 	 * @parm1 pid  - the id of the kernelspace process/thread
 	 * @parm2 uid  - the unique value in the kernelspace process/thread
-	 * @parm3 node - the reference to the pointer of the removed Node object
+	 * @parm3 node - the reference to the pointer of the removed Node object,
+	 *			   marked NLC_DESTROY; the caller owns a reference and
+	 *			   releases it with node->put(). Whoever waits on the
+	 *			   channel returns without a message, a parked receive()
+	 *			   is resumed from the calling thread
 	 * @return	 - 'true' if succeeded, otherwise 'false'.
 	 */
 	bool eraseNode(int pid, int uid, Node *(&node));
@@ -168,10 +435,27 @@ public:
 			pthread_mutex_t *_mutex_ptr;
 	};
 	//---------------------------------------------------------------------------
-	pthread_t runBus();
+	/* @brief  - starts a dispatcher thread on every shard transport; the
+	 *		   bus owns the threads, see joinBus() and stopBus()
+	 * @return	 - 0, or -1 if a dispatcher could not be started.
+	 */
+	int runBus();
+
+	/* @brief  - waits for every dispatcher to quit; a dispatcher quits
+	 *		   when its transport is closed
+	 */
+	void joinBus();
+
+	/* @brief  - has every dispatcher quit and joins it; ~Kubix calls it
+	 *		   before it tears down what the dispatchers use
+	 */
+	void stopBus();
+	int dispatchers() const { return _ndispatchers; }
+	KubixTransport *transport(int shard) const { return _dispatchers[shard].transport; }
 
 	//---------------------------------------------------------------------------
-	/* @brief  - consider to move logic into C-tor and delete
+	/* @brief  - opens the shard transports and sets the polled descriptors
+	 * @return	 - the shard 0 file descriptor, or -1 on any error.
 	 */
 	int setCnFd();
 
@@ -186,9 +470,35 @@ public:
 	 *			   return code: 0-success, -(n)-error of 'n' code
 	 * @parm5 payload - the pointer to the buffer with user message
 	 * @parm6 len  - the length of the message in the buffer
+	 * @parm7 seq  - connector sequence number, 0 for none
 	 * @return	 - 0 if succeeded to send.
 	 */
-	int send2kernel(int pid, int uid, int op, int ret, void *payload, int len);
+	int send2kernel(int pid, int uid, int op, int ret, void *payload, int len,
+					__u32 seq = 0);
+
+	/* @brief  - queues a message to the sender stage and returns at once
+	 * @parm1 req  - the request, owned by the caller until its status
+	 *			   leaves KBX_SEND_PENDING; KubixSender::wait(req) blocks
+	 *			   for it and returns 0 or -errno of the send
+	 * @parm2-8    - as of send2kernel
+	 * @return	 - 0 if queued, -1 if the sender stage is off or full.
+	 */
+	int send2kernelAsync(KubixSendReq *req, int pid, int uid, int op, int ret,
+						 void *payload, int len, __u32 seq = 0);
+
+	/* @brief  - sends a USER_MESSAGE under a sequence number of its own;
+	 *		   the kernel answers it with KERNEL_REPLY acking the number
+	 *		   and the dispatcher completes the future, so a channel
+	 *		   may carry any number of requests at a time
+	 * @parm1-2    - the channel as of send2kernel
+	 * @parm3 payload - the request
+	 * @parm4 len  - its length
+	 * @parm5 future - owned by the caller, idle or done, until it is done
+	 *			   or cancelled; see kbx_future.h
+	 * @return	 - 0 if sent, -1 otherwise with the future left idle.
+	 */
+	int sendRequest(int pid, int uid, void *payload, int len,
+					KubixFuture &future);
 
 	/* @brief  - the blocking method for reading messages sent from kernelspace
 	 * @parm1 pid  - the id of the kernelspace process/thread
@@ -206,18 +516,108 @@ public:
 	bool getMessage(int pid, int uid, int &op, int &ret,
 					char (*msg)[PAYLOAD_MAX_SIZE], int &len);
 
-	static void *userAppThread(void*);
+	/* @brief  - getMessage without the copy: blocks for the next message of
+	 *		   the channel and returns it in its receive buffer
+	 * @parm3 view - the message, the caller releases it
+	 * @return	 - 'false' if there is no such channel, or it is erased
+	 *			   while the call waits.
+	 */
+	bool getMessageView(int pid, int uid, KubixView &view);
+
+
+	/* @brief  - reads the dispatcher receive counters summed over the
+	 *		   shards, lock free
+	 */
+	void rxStats(KubixRxStats &stats) const;
+	void txStats(KubixTxStats &stats) const;
+	void spinStats(KubixSpinStats &stats) const;
+
+	/* @brief  - reads the counters of a channel, lock free
+	 * @return	 - 'false' if there is no such channel or it has no slot.
+	 */
+	bool nodeStats(int pid, int uid, KubixNodeStats &stats);
+
+	/* @brief  - the counters region, its name() is what kubix-stat takes
+	 */
+	KubixStats *stats() const { return _stats; }
+
+	/* @brief  - the latency of a stage of the kernel messages of an op,
+	 *		   lock free; only messages stamped by the kubix module
+	 *		   'timestamps' parameter are counted
+	 * @parm1 op    - KUBIX_CHANNEL, KERNEL_REQUEST, KERNEL_RELEASE or
+	 *			   KERNEL_REPORT
+	 * @parm2 stage - KBX_LATENCY_STAGES
+	 * @return	 - 'false' if the op or the stage has no histogram.
+	 */
+	bool latency(int op, int stage, KubixLatency &lat) const;
+
+	/* @brief  - writes the traced stages as Chrome trace event JSON, for
+	 *		   Perfetto or chrome://tracing; tracing goes on
+	 * @parm   - the file to write
+	 * @return	 - the number of spans written, -1 if tracing is off or
+	 *			   the file cannot be written.
+	 */
+	int traceExport(const char *path);
+
+	//---------------------------------------------------------------------------
+	/* @brief  - awaitable channel I/O for C++20 coroutines, see kbx_coro.h;
+	 *		   the parameters are as of getMessageView, sendRequest and
+	 *		   send2kernel
+	 */
+	KubixReceive receive(int pid, int uid);
+	KubixRequest request(int pid, int uid, void *payload, int len);
+	KubixReply reply(int pid, int uid, int op, int ret, void *payload,
+					 int len);
 
+	/* @brief  - the user application logic; if set before runBus() the
+	 *		   bus runs it on a worker pool for every kernel message and
+	 *		   sends the callback context back to the kernel, otherwise
+	 *		   the application reads channels with getMessage
+	 */
 	USER_APP_CALLBACK _user_app_callback;
 
+	/* @brief  - the zero copy application logic, takes precedence over
+	 *		   _user_app_callback: it gets each kernel message as a view
+	 *		   of the receive buffer, replies with send2kernel itself and
+	 *		   must hold() the view to use it after returning
+	 */
+	USER_VIEW_CALLBACK _user_view_callback;
+
 protected:
 	//---------------------------------------------------------------------------
-	/* @brief  - consider to move in .cpp
+	/* @brief  - a connector id shard: its transport, the dispatcher
+	 *		   thread reading it and what that thread owns alone
 	 */
 	struct DistributorContext{
+		DistributorContext();
+
 		Kubix *_bus;
-		int running;
-	} _context;
+		std::atomic<int> running;
+		int shard;
+		pthread_t tid;			/* 0: not running or joined */
+		int wake_fd;			/* eventfd, stopBus() wakes the dispatcher */
+		KubixTransport *transport;
+		bool own_transport;
+		struct pollfd pfd;
+		KubixSender *sender;	/* replies of the shard channels */
+		KubixBufPool *pool;		/* take() by this dispatcher only */
+		std::vector<void*> resume;	/* coroutines woken by a batch */
+		std::vector<void*> answers;	/* coroutines whose request it answered */
+		unsigned trace_count;	/* messages since the last one traced */
+
+		/* receive counters in the stats region, the dispatcher is the
+		 * only writer */
+		struct kubix_stat_shard *stat;
+	};
+	DistributorContext *_dispatchers;
+	int _ndispatchers;
+
+	/* @brief  - the shard carrying the channel
+	 */
+	DistributorContext *shardOf(int pid, int uid) const
+	{
+		return &_dispatchers[kubix_shard_of(pid, uid, _ndispatchers)];
+	}
 	//---------------------------------------------------------------------------
 	/* @brief  - the message polling thread function for pthread_create(...)
 	 * @parm   - a ponter to the thransmitted thread context
@@ -225,14 +625,106 @@ protected:
 	 */
 	static void *dispatch(void* context);
 
+	/* @brief  - the dispatcher loops, on a multishot io_uring recv from
+	 *		   provided pool buffers or on poll and recvmmsg
+	 * @return	 - dispatchUring: 0 once the bus is done, -errno if
+	 *		   io_uring cannot run it and nothing was received yet.
+	 */
+	int dispatchUring(DistributorContext *pctx);
+	void dispatchPoll(DistributorContext *pctx);
+	void endRxBatch(DistributorContext *pctx, int count);
+
+	/* @brief  - reliable delivery: checks the kernel seq of a message
+	 *		   routed to a node, asks for a resend on a gap
+	 * @return	 - 'false' if the message is to be dropped.
+	 */
+	bool inSequence(DistributorContext *pctx, Node *node,
+					struct kubix_frame *rmsg);
+
+	/* @brief  - the message of seq is in the node queue: it is received
+	 *		   and acked, not before, see askResend
+	 */
+	void takeSeq(DistributorContext *pctx, Node *node, __u32 seq);
+
+	/* @brief  - acks last, the kernel resends what follows it; a message
+	 *		   the node queue dropped is a gap as well
+	 */
+	void askResend(DistributorContext *pctx, Node *node, __u32 last);
+	void sendAck(DistributorContext *pctx, int pid, int uid, __u32 ack);
+
+	/* @brief  - the cn_msg.ack of a message the channel sends: the seq of
+	 *		   the kernel message consumed last, the kernel takes an answer
+	 *		   for the message it waits on only if it acks that one
+	 */
+	__u32 rxAck(int pid, int uid);
+
+	/* @brief  - the socket dropped datagrams: grows the receive buffer
+	 *		   and has the kernel resend the unacked ones of the shard
+	 */
+	void overflow(DistributorContext *pctx);
+	void setRcvbuf(DistributorContext *pctx, int size);
+
+	/* @brief  - delivers one received datagram to its channel node
+	 * @parm1 pctx - the receiving dispatcher
+	 * @parm2 buf - the datagram
+	 * @return	 - 'true' if a node queue took the buffer over.
+	 */
+	bool routeMessage(DistributorContext *pctx, KubixBuf *buf);
+	void countRxBatch(DistributorContext *pctx, int count);
+	void countRx(DistributorContext *pctx, Node *node, int len);
+
+	/* @brief  - completes the request future acked by a KERNEL_REPLY; a
+	 *		   coroutine awaiting it is resumed at the end of the batch
+	 * @return	 - 'true' if the future took the buffer over.
+	 */
+	bool completeRequest(DistributorContext *pctx, KubixBuf *buf);
+
+	/* @brief  - unlinks a request the caller gives up on
+	 * @return	 - 'false' if the dispatcher is completing it already.
+	 */
+	bool forgetRequest(KubixFuture *future);
+
+	/* @brief  - worker pool task: serves the queued messages of a node
+	 *		   posted by the dispatcher, in order
+	 * @parm   - the Node
+	 */
+	static void serveChannel(void *node);
+	void callUserApp(Node *node, KubixBuf *buf);
+	static void setView(KubixView &view, KubixBuf *buf);
+
+	/* @brief  - the timestamp trailer on the way: the dispatcher stamps a
+	 *		   routed message, the consumer the one it takes and the
+	 *		   answer the same thread sends on its channel next
+	 * @return	 - stampReply: the datagram length with the trailer.
+	 */
+	void stampRouted(struct kubix_frame *rmsg, int len);
+	void stampTaken(KubixBuf *buf);
+	int stampReply(struct kubix_frame *smsg, int len);
+	KubixHistogram *latencyOf(int op, int stage) const;
+	__u64 traceRoute(struct kubix_frame *rmsg, int len, __u64 start);
+	__u64 traceSend(int pid, int uid, __u32 seq);
+
 private:
-	struct pollfd _pfd;
-	pthread_mutex_t _bus_mutex;
-	std::unordered_map<int64_t, Node*> _nodes;
+	KubixConfig _config;
+	KubixWorkers *_workers;
+	KubixSpin *_spin;		/* latency mode only */
+	KubixStats *_stats;
+	KubixHistogram *_latency;	/* [KBX_LAT_OPS][KBX_LAT_STAGES] */
+	KubixTrace *_trace;		/* null unless trace_sample */
+	NodeTable _nodes;
+
+	/* outstanding sendRequest futures by sequence number */
+	pthread_mutex_t _requests_mutex;
+	KubixFlatMap<KubixFuture*> _requests;
+	std::atomic<__u32> _request_seq;
+
+	friend struct KubixReceive;
+	friend class KubixFuture;
 
 #ifdef UNIT_TEST
 public:
-	void putMsg(int pid, int uid, char *msg, int len, bool wakeup = true);
+	void putMsg(int pid, int uid, char *msg, int len, bool wakeup = true,
+				int op = KERNEL_REPORT);
 #endif // UNIT_TEST
 };
 
@@ -19,6 +19,7 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <stdio.h>
 #define UNIT_TEST
 #include "../kubix.h"
 
@@ -45,12 +46,13 @@ int main()
             fprintf(stderr, "failed to delete node for key(0, %d)\n", i);
             continue;
         }
-        fprintf(stderr, "deleted node[%d.%d], id[%d,%d], state '%s', "
-                "buff[0x%u], len %d, type %d, result %d\n",
+        fprintf(stderr, "deleted node[%d.%d], state '%s', "
+                "queued %d, dropped %lu, type %d, result %d\n",
                 node->_pid,
                 node->_unique,
-                strNodeState(node->_state), node->_recv_buffer,
-                node->_recv_len, node->_opt , node->_ret);
+                strNodeState(node->_state), node->_queue.size(),
+                node->_queue.dropped(), node->_opt , node->_ret);
+        node->put();
     }
     bus.dump();
     bus._user_app_callback = &userTestLogic;
@@ -72,7 +74,7 @@ int main()
     fprintf(stderr, "** missing node\n");
     bus.getMessage(0, -8, op, ret, &buffer, len);
 
-    pthread_t tid = bus.runBus();
+    bus.runBus();
 
     while(1){
         // wait for kernel message
@@ -82,7 +84,7 @@ int main()
         err = bus.send2kernel( 0, -10, 0, 0, hello_03, sizeof(hello_03));
     }
 
-    pthread_join(tid, NULL);
+    bus.joinBus();
 
     return 0;
 }
@@ -0,0 +1,945 @@
+/*
+ *     loopback_test.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* The user bus against an in-process kernel peer: no kubix module needed.
+ */
+#include <stdio.h>
+#include <sys/mman.h>
+#include <map>
+#include <string>
+#include "../kbx_transport.h"
+#include "../kbx_ebr.h"
+#include "../kbx_buf.h"
+#include "../kbx_coro.h"
+#include "../kbx_future.h"
+#include "../kbx_log.h"
+#include "../kbx_stats.h"
+#include "../kbx_hist.h"
+#include "../kbx_futex.h"
+#include "../kbx_trace.h"
+
+#define TEST_CHANNELS    8
+
+int userEchoLogic(UserCallbackCtx *ctx)
+{
+    ctx->ret = 0;
+    return 0;
+}
+
+int userViewEcho(Kubix *bus, KubixView *view)
+{
+    return bus->send2kernel(view->hdr->pid, view->hdr->uid, view->hdr->opt, 0,
+                            (void*)view->data, view->len);
+}
+
+static int failures = 0;
+#define CHECK(cond) do{ if(!(cond)){ \
+        fprintf(stderr, "%d %s: FAILED '%s'\n", __LINE__, __func__, #cond); \
+        failures++; } }while(0)
+
+/* ------------------------------------------------------------------------------
+ * kernel peer sends op on [pid.uid] and expects the user bus to echo it back
+ * */
+static void exchange(LoopbackTransport &lt, int pid, int uid, int op,
+                     __u32 seq, const char *msg)
+{
+    struct kubix_frame frame;
+    int len = strlen(msg) + 1;
+
+    CHECK(lt.peerSend(pid, uid, op, 0, seq, msg, len) == 0);
+    CHECK(0 < lt.peerRecv(&frame, 5000));
+    CHECK(frame.cn_msg.id.idx == CN_SS_IDX + lt.shard() &&
+          frame.cn_msg.id.val == CN_SS_VAL);
+    CHECK(frame.kbx_msg.pid == pid && frame.kbx_msg.uid == uid);
+    CHECK(frame.kbx_msg.opt == op);
+    CHECK(frame.kbx_msg.data_len == len);
+    CHECK(memcmp(frame.buf, msg, len) == 0);
+}
+
+/* ------------------------------------------------------------------------------
+ * a burst on one channel is queued, not overwritten; the seqs go on from
+ * the channel exchanges
+ * */
+static void burst(LoopbackTransport &lt, int pid, int uid, int count)
+{
+    struct kubix_frame frame;
+    char msg[32];
+
+    for(int i = 0; i < count; i++){
+        int len = snprintf(msg, sizeof(msg), "report %d", i) + 1;
+        CHECK(lt.peerSend(pid, uid, KERNEL_REPORT, 0, 3 + i, msg, len) == 0);
+    }
+    for(int i = 0; i < count; i++){
+        snprintf(msg, sizeof(msg), "report %d", i);
+        CHECK(0 < lt.peerRecv(&frame, 5000));
+        CHECK(strcmp(frame.buf, msg) == 0);
+    }
+}
+/* ------------------------------------------------------------------------------
+ * overflow policies of a full node queue
+ * */
+static void overflow(int policy, int depth, int count)
+{
+    KubixSlab *ring = KubixSlab::forSize(depth * sizeof(KubixBuf*));
+    unsigned long rings = ring->inUse();
+    KubixBufPool pool(0);
+    {
+        NodeQueue queue(depth, policy);
+        KubixBuf *buf;
+
+        /* ring memory comes with the first message */
+        CHECK(!queue.pop(buf) && ring->inUse() == rings);
+        for(int i = 0; i < count; i++){
+            buf = pool.alloc();
+            buf->len = kubix_frame_fill(&buf->frame, 0, 0, KERNEL_REPORT, 0, i,
+                                        &i, sizeof(i));
+            if(!queue.push(buf))
+                kbx_buf_release(buf);
+        }
+        CHECK(queue.size() == depth);
+        CHECK(queue.dropped() == (unsigned long)(count - depth));
+        CHECK(pool.outstanding() == depth);
+        /* drop-oldest keeps the tail of the stream, drop-newest its head */
+        int first = policy == OVERFLOW_DROP_OLDEST ? count - depth : 0;
+        for(int i = first; i < first + depth - 1; i++){
+            CHECK(queue.pop(buf));
+            CHECK(buf->frame.cn_msg.seq == (__u32)i);
+            CHECK(buf->frame.kbx_msg.data_len == sizeof(i));
+            kbx_buf_release(buf);
+        }
+        CHECK(ring->inUse() == rings + 1);
+    }
+    /* the queue releases what it still holds */
+    CHECK(ring->inUse() == rings && pool.outstanding() == 0);
+}
+/* ------------------------------------------------------------------------------
+ * a blocking producer and a parked consumer hand off through KubixEvent
+ * */
+struct Handoff{
+    NodeQueue   *queue;
+    KubixBufPool *pool;
+    KubixEvent  ready;
+    int         count;
+};
+
+static void *handoffProducer(void *arg)
+{
+    Handoff *h = (Handoff*)arg;
+    for(int i = 0; i < h->count; i++){
+        KubixBuf *buf = h->pool->alloc();
+        buf->len = kubix_frame_fill(&buf->frame, 0, 0, KERNEL_REPORT, 0, i,
+                                    &i, sizeof(i));
+        h->queue->push(buf);	/* OVERFLOW_BLOCK parks on a full ring */
+        h->ready.signal();
+    }
+    return (void*)0;
+}
+
+static void handoff(int count)
+{
+    KubixBufPool pool(0);
+    NodeQueue queue(2, OVERFLOW_BLOCK);
+    Handoff h;
+    h.queue = &queue;
+    h.pool = &pool;
+    h.count = count;
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, &handoffProducer, &h);
+    int next = 0;
+    while(next < count){
+        KubixBuf *buf;
+        int seq = h.ready.prepare();
+        if(!queue.pop(buf)){
+            h.ready.wait(seq);
+            continue;
+        }
+        CHECK(buf->frame.cn_msg.seq == (__u32)next);
+        next++;
+        kbx_buf_release(buf);
+    }
+    pthread_join(tid, NULL);
+    CHECK(queue.dropped() == 0 && queue.empty());
+    CHECK(pool.outstanding() == 0);
+}
+/* ------------------------------------------------------------------------------
+ * flat channel map against std::map through several incremental resizes
+ * */
+static void flatmap(int count)
+{
+    KubixFlatMap<Node*> map;
+    std::map<int64_t, Node*> ref;
+    unsigned long x = 88172645463325252ULL;
+    int mismatches = 0;
+
+    KubixEpoch epoch;
+    for(int i = 0; i < count; i++){
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        /* sequential uids, a few pids, like sockets of a few processes */
+        int64_t key = get_composite_key(x % 4, (x >> 8) % (count / 2));
+        Node *value = (Node*)(uintptr_t)((i << 4) | 8);
+        switch((x >> 40) % 3){
+        case 0:
+        case 1:
+            mismatches += map.put(key, value) != (ref.count(key) ? ref[key] : nullptr);
+            ref[key] = value;
+            break;
+        case 2:
+            mismatches += map.remove(key) != (ref.count(key) ? ref[key] : nullptr);
+            ref.erase(key);
+            break;
+        }
+    }
+    CHECK(map.size() == ref.size());
+    for(auto &kv : ref)
+        mismatches += map.find(kv.first) != kv.second;
+    unsigned long walked = 0;
+    map.forEach([&](int64_t key, Node *value){
+            walked++;
+            mismatches += ref[key] != value;
+        });
+    CHECK(walked == ref.size());
+    CHECK(mismatches == 0);
+}
+/* ------------------------------------------------------------------------------
+ * log records formatted by the drainer, stderr captured by a pipe
+ * */
+static void logger()
+{
+    char big[512];
+    char out[4096];
+    int pfd[2];
+
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = 0;
+    kbx_log_flush();
+    int saved = dup(STDERR_FILENO);
+    CHECK(pipe(pfd) == 0);
+    dup2(pfd[1], STDERR_FILENO);
+    unsigned long lost = kbx_log_lost();
+    KBX_ERR("int %d, string '%s', long %ld", 42, "forty two", -42L);
+    KBX_ERR("cut %s|%d", big, 7);
+    kbx_log_flush();
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    close(pfd[1]);
+    int len = read(pfd[0], out, sizeof(out) - 1);
+    close(pfd[0]);
+    out[len < 0 ? 0 : len] = 0;
+
+    CHECK(strstr(out, " E ") && strstr(out, ":logger: int 42, string "
+                                              "'forty two', long -42\n"));
+    /* the string is cut short to fit, the scalar after it is kept */
+    const char *cut = strstr(out, "cut x");
+    CHECK(cut && strstr(cut, "x|7\n") && strlen(cut) < sizeof(big));
+    CHECK(kbx_log_lost() == lost);
+}
+
+/* ------------------------------------------------------------------------------
+ * channels of one bus, opened and exercised from the kernel peer
+ * */
+static void run_bus(const KubixConfig &config, bool zero_copy = false)
+{
+    LoopbackTransport lt;
+    Kubix bus(&lt, config);
+    if(zero_copy)
+        bus._user_view_callback = &userViewEcho;
+    else
+        bus._user_app_callback = &userEchoLogic;
+
+    CHECK(bus.runBus() == 0);
+
+    for(int uid = 1; uid <= TEST_CHANNELS; uid++)
+        exchange(lt, 100, uid, KUBIX_CHANNEL, 1, "open channel");
+    for(int uid = 1; uid <= TEST_CHANNELS; uid++)
+        exchange(lt, 100, uid, KERNEL_REQUEST, 2, "kernel request");
+
+    burst(lt, 100, 1, NODE_QUEUE_DEPTH);
+
+    Node *node;
+    CHECK(bus.findNode(100, TEST_CHANNELS, node));
+    CHECK(!bus.findNode(100, TEST_CHANNELS + 1, node));
+
+    /* an erased node stays readable through the caller's reference,
+     * the table retires its own one */
+    Node *erased;
+    CHECK(bus.eraseNode(100, TEST_CHANNELS, erased));
+    CHECK(!bus.findNode(100, TEST_CHANNELS, node));
+    CHECK(bus.createNode(100, TEST_CHANNELS, node));
+    KubixEbr::synchronize();
+    CHECK(erased->_state == Node::NLC_DESTROY);
+    CHECK(erased->_refs == 1 && erased->_unique == TEST_CHANNELS);
+    erased->put();
+
+    /* EOF on the kernel side end stops the dispatcher */
+    lt.peerClose();
+    bus.joinBus();
+
+    KubixRxStats stats;
+    bus.rxStats(stats);
+    CHECK(stats.messages == 2 * TEST_CHANNELS + NODE_QUEUE_DEPTH);
+    CHECK(0 < stats.wakeups && stats.wakeups <= stats.messages);
+
+    /* the channel counters add up to the shard ones, the erased channel
+     * is in the retired part */
+    KubixNodeStats node_stats;
+    CHECK(bus.nodeStats(100, 1, node_stats));
+    CHECK(node_stats.messages == 2 + NODE_QUEUE_DEPTH);
+    CHECK(node_stats.served == node_stats.messages);
+    CHECK(node_stats.drops == 0 && node_stats.errors == 0);
+    CHECK(0 < node_stats.depth_max && node_stats.depth_max <= NODE_QUEUE_DEPTH);
+    const kubix_stat_hdr *hdr = bus.stats()->hdr();
+    unsigned long messages = hdr->retired_messages;
+    for(int i = 0; i < hdr->nodes; i++)
+        if(KubixStats::read(&kbx_stat_nodes(hdr)[i], node_stats))
+            messages += node_stats.messages;
+    CHECK(messages == stats.delivered && stats.drops == 0);
+    CHECK(hdr->retired_messages == 2 && hdr->channels == TEST_CHANNELS);
+    /* what kubix-stat maps */
+    size_t size;
+    if(config.stats && bus.stats()->name()[0]){
+        const kubix_stat_hdr *shared = KubixStats::open(bus.stats()->name(),
+                                                        size);
+        CHECK(shared && shared->pid == getpid());
+        CHECK(shared && kbx_stat_shards(shared)->delivered == stats.delivered);
+        if(shared)
+            munmap((void*)shared, size);
+    }
+
+    /* the sender counts a batch after the peer may have read it */
+    KubixTxStats tx_stats;
+    bus.txStats(tx_stats);
+    for(int i = 0; config.tx_batch && i < 1000; i++){
+        if(tx_stats.messages == stats.messages)
+            break;
+        usleep(1000);
+        bus.txStats(tx_stats);
+    }
+    if(config.tx_batch){
+        CHECK(tx_stats.messages == stats.messages);
+        CHECK(tx_stats.syscalls <= tx_stats.messages);
+    }
+    else
+        CHECK(tx_stats.messages == 0);
+    /* io_uring is a best effort, the poll loop stands in on old kernels */
+    if(!config.io_uring)
+        CHECK(!stats.uring && !tx_stats.uring);
+
+    /* the dispatcher spins before every sleep in the latency mode */
+    KubixSpinStats spin;
+    bus.spinStats(spin);
+    if(config.latency_mode)
+        CHECK(0 < spin.spins && spin.hits <= spin.spins);
+    else
+        CHECK(spin.spins == 0 && spin.spin_ns == 0);
+}
+
+/* ------------------------------------------------------------------------------
+ * channel conversations as coroutines resumed by the dispatcher
+ * */
+static int conversations = 0;
+
+static KubixCoro echoConversation(Kubix &bus, int pid, int uid, int rounds)
+{
+    for(int i = 0; i < rounds; i++){
+        KubixView view = co_await bus.receive(pid, uid);
+        CHECK(view.buf != nullptr);
+        if(!view.buf)
+            co_return;
+        CHECK(co_await bus.reply(pid, uid, view.hdr->opt, 0,
+                                 (void*)view.data, view.len) == 0);
+        view.release();
+    }
+    conversations++;
+}
+
+static KubixCoro pingConversation(Kubix &bus, int pid, int uid)
+{
+    char ping[] = "ping";
+    KubixView view = co_await bus.request(pid, uid, ping, sizeof(ping));
+    CHECK(view.buf && strcmp(view.data, "pong") == 0);
+    if(view.buf)
+        view.release();
+    conversations++;
+}
+
+static void run_coro(const KubixConfig &config)
+{
+    const int rounds = 3;
+    LoopbackTransport lt;
+    Kubix bus(&lt, config);
+    Node *node;
+
+    conversations = 0;
+    /* not opened by the kernel: the application reads the channels */
+    for(int uid = 1; uid <= TEST_CHANNELS; uid++){
+        CHECK(bus.createNode(100, uid, node));
+        echoConversation(bus, 100, uid, rounds);
+    }
+    CHECK(bus.createNode(100, 0, node));
+    pingConversation(bus, 100, 0);
+    /* nothing received yet, all of them are parked */
+    CHECK(conversations == 0);
+
+    /* the request went out before it parked */
+    struct kubix_frame frame;
+    CHECK(0 < lt.peerRecv(&frame, 5000));
+    CHECK(frame.kbx_msg.opt == USER_MESSAGE && strcmp(frame.buf, "ping") == 0);
+    CHECK(frame.cn_msg.seq != 0);
+
+    CHECK(bus.runBus() == 0);
+    /* a message of the channel is not the answer */
+    CHECK(lt.peerSend(100, 0, KERNEL_REPORT, 0, 3, "report", 7) == 0);
+    CHECK(lt.peerSend(100, 0, KERNEL_REPLY, 0, 4, "pong", 5,
+                      frame.cn_msg.seq) == 0);
+    for(int i = 0; i < rounds; i++)
+        for(int uid = 1; uid <= TEST_CHANNELS; uid++)
+            exchange(lt, 100, uid, KERNEL_REQUEST, 3 + i, "coro request");
+
+    lt.peerClose();
+    bus.joinBus();
+    CHECK(conversations == TEST_CHANNELS + 1);
+    CHECK(!bus.receive(100, TEST_CHANNELS + 1).attach());
+}
+
+/* ------------------------------------------------------------------------------
+ * erasing a channel ends the waits on it, with no message
+ * */
+static KubixCoro erasedConversation(Kubix &bus, int pid, int uid)
+{
+    KubixView view = co_await bus.receive(pid, uid);
+    CHECK(view.buf == nullptr);
+    conversations++;
+}
+
+struct Waiter{
+    Kubix *bus;
+    int uid;
+    bool got;
+};
+
+static void *waitMessage(void *arg)
+{
+    Waiter *w = (Waiter*)arg;
+    KubixView view;
+    w->got = w->bus->getMessageView(100, w->uid, view);
+    if(w->got)
+        view.release();
+    return NULL;
+}
+
+static void run_erase_waiters(const KubixConfig &config)
+{
+    LoopbackTransport lt;
+    Kubix bus(&lt, config);
+    Node *node;
+
+    conversations = 0;
+    CHECK(bus.createNode(100, 1, node));
+    CHECK(bus.createNode(100, 2, node));
+    erasedConversation(bus, 100, 1);
+    CHECK(conversations == 0);
+    Waiter w = { &bus, 2, true };
+    pthread_t tid;
+    pthread_create(&tid, NULL, waitMessage, &w);
+    usleep(20000);
+
+    CHECK(bus.eraseNode(100, 1, node));
+    node->put();
+    CHECK(conversations == 1);
+    CHECK(bus.eraseNode(100, 2, node));
+    node->put();
+    pthread_join(tid, NULL);
+    CHECK(!w.got);
+}
+
+/* ------------------------------------------------------------------------------
+ * a transport which knows the kernel bus shards overrides the config
+ * */
+class ShardedLoopback : public LoopbackTransport{
+public:
+    int shards() const { return 2; }
+};
+
+static void run_kernel_shards()
+{
+    KubixConfig config;
+    config.dispatchers = 3;
+    ShardedLoopback lt;
+    Kubix bus(&lt, config);
+    CHECK(bus.dispatchers() == 2);
+}
+
+/* ------------------------------------------------------------------------------
+ * channels spread over connector id shards, one dispatcher each; a channel
+ * is served and answered on the socket of its own shard
+ * */
+static void run_shards(KubixConfig config, int shards)
+{
+    const int channels = 4 * TEST_CHANNELS;
+    config.dispatchers = shards;
+    LoopbackTransport lt;
+    Kubix bus(&lt, config);
+    bus._user_app_callback = &userEchoLogic;
+    CHECK(bus.dispatchers() == shards);
+
+    CHECK(bus.runBus() == 0);
+    int used[KBX_MAX_SHARDS] = { 0 };
+    for(int uid = 1; uid <= channels; uid++){
+        int shard = kubix_shard_of(100, uid, shards);
+        LoopbackTransport *peer = (LoopbackTransport*)bus.transport(shard);
+        CHECK(peer->shard() == shard);
+        exchange(*peer, 100, uid, KUBIX_CHANNEL, 1, "open channel");
+        exchange(*peer, 100, uid, KERNEL_REQUEST, 2, "kernel request");
+        used[shard]++;
+    }
+    int busy = 0;
+    for(int i = 0; i < shards; i++)
+        busy += used[i] != 0;
+    CHECK(busy == shards);
+
+    /* the transports stay open, the dispatchers are woken to quit */
+    bus.stopBus();
+    KubixRxStats stats;
+    bus.rxStats(stats);
+    CHECK(stats.messages == 2 * channels);
+    CHECK(shards <= (int)stats.wakeups);
+}
+
+/* ------------------------------------------------------------------------------
+ * frames of another connector id or of an op the bus did not ask for are
+ * dropped by the socket filter, or by the dispatcher with the filter off
+ * */
+static void run_filter(KubixConfig config, int filter)
+{
+    config.socket_filter = filter;
+    config.accept_ops = KBX_KERNEL_OPS & ~KBX_OP_BIT(KERNEL_RELEASE);
+    LoopbackTransport lt;
+    Kubix bus(&lt, config);
+    bus._user_app_callback = &userEchoLogic;
+    CHECK(bus.runBus() == 0);
+
+    /* the unwanted ones go first, the bus answers only the last one */
+    struct kubix_frame frame;
+    int len = kubix_frame_fill(&frame, 100, 1, KUBIX_CHANNEL, 0, 1, "x", 2, 3);
+    CHECK(send(lt.peerFd(), &frame, len, 0) == len);
+    len = kubix_frame_fill(&frame, 100, 1, KUBIX_CHANNEL, 0, 1, "x", 2);
+    frame.cn_msg.id.val = CN_SS_VAL + 1;
+    CHECK(send(lt.peerFd(), &frame, len, 0) == len);
+    CHECK(lt.peerSend(100, 1, KERNEL_RELEASE, 0, 1, "x", 2) == 0);
+    exchange(lt, 100, 1, KUBIX_CHANNEL, 2, "open channel");
+
+    lt.peerClose();
+    bus.joinBus();
+    KubixRxStats stats;
+    bus.rxStats(stats);
+    CHECK(stats.delivered == 1);
+    CHECK(stats.discarded == (filter ? 0 : 3));
+    CHECK(stats.messages == stats.delivered + stats.discarded);
+}
+
+/* ------------------------------------------------------------------------------
+ * a gap in the kernel seqs of a channel: the bus drops what comes after it,
+ * asks for a resend with USER_ACK and takes the resent ones in order
+ * */
+static void run_reliable(const KubixConfig &config)
+{
+    LoopbackTransport lt;
+    Kubix bus(&lt, config);
+    bus._user_app_callback = &userEchoLogic;
+    CHECK(bus.runBus() == 0);
+    struct kubix_frame frame;
+
+    exchange(lt, 100, 1, KUBIX_CHANNEL, 1, "open channel");
+    exchange(lt, 100, 1, KERNEL_REPORT, 2, "report 2");
+    /* 3 is lost on the way */
+    CHECK(lt.peerSend(100, 1, KERNEL_REPORT, 0, 4, "report 4", 9) == 0);
+    CHECK(lt.peerRecv(&frame, 100) == 0);
+    CHECK(lt.peerAcks() == 1 && lt.peerAck() == 2);
+
+    /* the kernel resends everything after the ack, twice here */
+    exchange(lt, 100, 1, KERNEL_REPORT, 3, "report 3");
+    exchange(lt, 100, 1, KERNEL_REPORT, 4, "report 4");
+    CHECK(lt.peerSend(100, 1, KERNEL_REPORT, 0, 4, "report 4", 9) == 0);
+    /* a reply acks what the channel took so far */
+    CHECK(lt.peerSend(100, 1, KERNEL_REQUEST, 0, 5, "request 5", 10) == 0);
+    CHECK(0 < lt.peerRecv(&frame, 5000));
+    CHECK(strcmp(frame.buf, "request 5") == 0 && frame.cn_msg.ack == 5);
+    CHECK(lt.peerAcks() == 1);
+
+    lt.peerClose();
+    bus.joinBus();
+    KubixRxStats stats;
+    bus.rxStats(stats);
+    CHECK(stats.delivered == 7);
+    CHECK(stats.gaps == 1 && stats.duplicates == 1 && stats.acks == 1);
+    CHECK(stats.overflows == 0 && 0 < stats.rcvbuf);
+}
+
+/* ------------------------------------------------------------------------------
+ * a message a full node queue drops is not acked, the kernel resends it
+ * */
+static void run_reliable_overflow(const KubixConfig &config)
+{
+    KubixConfig small = config;
+    small.reliable = 1;
+    small.queue_depth = 2;
+    small.overflow_policy = OVERFLOW_DROP_NEWEST;
+    LoopbackTransport lt;
+    Kubix bus(&lt, small);
+    CHECK(bus.runBus() == 0);
+    struct kubix_frame frame;
+    char msg[PAYLOAD_MAX_SIZE];
+    int op, ret, len;
+
+    /* nobody reads the channel yet: 3 finds the queue full */
+    CHECK(lt.peerSend(100, 2, KUBIX_CHANNEL, 0, 1, "open channel", 13) == 0);
+    CHECK(lt.peerSend(100, 2, KERNEL_REPORT, 0, 2, "report 2", 9) == 0);
+    CHECK(lt.peerSend(100, 2, KERNEL_REPORT, 0, 3, "report 3", 9) == 0);
+    CHECK(lt.peerRecv(&frame, 200) == 0);
+    CHECK(lt.peerAcks() == 1 && lt.peerAck() == 2);
+
+    CHECK(bus.getMessage(100, 2, op, ret, &msg, len) && op == KUBIX_CHANNEL);
+    CHECK(bus.getMessage(100, 2, op, ret, &msg, len) &&
+          strcmp(msg, "report 2") == 0);
+    /* the resend is taken, not a duplicate */
+    CHECK(lt.peerSend(100, 2, KERNEL_REPORT, 0, 3, "report 3", 9) == 0);
+    CHECK(bus.getMessage(100, 2, op, ret, &msg, len) &&
+          strcmp(msg, "report 3") == 0);
+
+    lt.peerClose();
+    bus.joinBus();
+    KubixRxStats stats;
+    bus.rxStats(stats);
+    CHECK(stats.drops == 1 && stats.duplicates == 0 && stats.acks == 1);
+}
+
+/* ------------------------------------------------------------------------------
+ * OVERFLOW_BLOCK parks the dispatcher on a channel nobody reads; erasing
+ * the channel or stopping the bus lets it go
+ * */
+static void run_blocked(KubixConfig config, bool erase)
+{
+    config.queue_depth = 2;
+    config.overflow_policy = OVERFLOW_BLOCK;
+    LoopbackTransport lt;
+    Kubix bus(&lt, config);
+    CHECK(bus.runBus() == 0);
+    char msg[PAYLOAD_MAX_SIZE];
+    int op, ret, len;
+
+    CHECK(lt.peerSend(100, 4, KUBIX_CHANNEL, 0, 1, "open channel", 13) == 0);
+    CHECK(lt.peerSend(100, 4, KERNEL_REPORT, 0, 2, "report 2", 9) == 0);
+    CHECK(lt.peerSend(100, 4, KERNEL_REPORT, 0, 3, "report 3", 9) == 0);
+    usleep(50000);
+    if(!erase){
+        bus.stopBus();
+        return;
+    }
+    Node *node;
+    CHECK(bus.eraseNode(100, 4, node));
+    node->put();
+    /* the shard goes on with the next channel */
+    CHECK(lt.peerSend(100, 5, KUBIX_CHANNEL, 0, 1, "open channel", 13) == 0);
+    bool served = false;
+    for(int i = 0; i < 1000 && !served; i++){
+        /* no node until the dispatcher gets to it */
+        served = bus.getMessage(100, 5, op, ret, &msg, len);
+        if(!served)
+            usleep(1000);
+    }
+    CHECK(served && op == KUBIX_CHANNEL);
+    lt.peerClose();
+    bus.joinBus();
+}
+
+/* ------------------------------------------------------------------------------
+ * without 'reliable' the bus takes a gap but still acks, the kernel window
+ * of the channel must drain; an answer acks what it answers
+ * */
+static void run_unreliable_acks(KubixConfig config)
+{
+    config.reliable = 0;
+    config.queue_depth = 2 * KBX_ACK_EVERY;
+    LoopbackTransport lt;
+    Kubix bus(&lt, config);
+    CHECK(bus.runBus() == 0);
+    struct kubix_frame frame;
+    char msg[PAYLOAD_MAX_SIZE];
+    int op, ret, len;
+
+    CHECK(lt.peerSend(100, 3, KUBIX_CHANNEL, 0, 1, "open channel", 13) == 0);
+    /* 2 is lost on the way */
+    for(int seq = 3; seq <= KBX_ACK_EVERY + 1; seq++)
+        CHECK(lt.peerSend(100, 3, KERNEL_REPORT, 0, seq, "report", 7) == 0);
+    CHECK(lt.peerRecv(&frame, 200) == 0);
+    CHECK(lt.peerAcks() == 1 && lt.peerAck() == KBX_ACK_EVERY);
+    /* an answer acks the message consumed, not the last one routed */
+    CHECK(bus.getMessage(100, 3, op, ret, &msg, len) && op == KUBIX_CHANNEL);
+    CHECK(bus.send2kernel(100, 3, KUBIX_CHANNEL, 0, msg, len) == 0);
+    CHECK(0 < lt.peerRecv(&frame, 5000) && frame.cn_msg.ack == 1);
+    for(int i = 1; i < KBX_ACK_EVERY; i++)
+        CHECK(bus.getMessage(100, 3, op, ret, &msg, len));
+
+    lt.peerClose();
+    bus.joinBus();
+    KubixRxStats stats;
+    bus.rxStats(stats);
+    CHECK(stats.gaps == 0 && stats.acks == 1);
+}
+
+/* ------------------------------------------------------------------------------
+ * pipelined requests on one channel complete by sequence number
+ * */
+static void run_requests(const KubixConfig &config)
+{
+    const int count = 5;
+    LoopbackTransport lt;
+    Kubix bus(&lt, config);
+    CHECK(bus.runBus() == 0);
+    struct kubix_frame frame;
+    KubixFuture futures[count];
+    __u32 seqs[count];
+    KubixView view;
+    char msg[32];
+
+    for(int i = 0; i < count; i++){
+        int len = snprintf(msg, sizeof(msg), "request %d", i) + 1;
+        CHECK(bus.sendRequest(100, 50, msg, len, futures[i]) == 0);
+    }
+    for(int i = 0; i < count; i++){
+        CHECK(0 < lt.peerRecv(&frame, 5000));
+        CHECK(frame.kbx_msg.opt == USER_MESSAGE && frame.cn_msg.seq != 0);
+        snprintf(msg, sizeof(msg), "request %d", i);
+        CHECK(strcmp(frame.buf, msg) == 0);
+        seqs[i] = frame.cn_msg.seq;
+        CHECK(seqs[i] == futures[i].seq());
+    }
+    /* the kernel answers out of order */
+    for(int i = count - 1; 0 <= i; i--){
+        int len = snprintf(msg, sizeof(msg), "reply %d", i) + 1;
+        CHECK(lt.peerSend(100, 50, KERNEL_REPLY, i, 100 + i, msg, len,
+                          seqs[i]) == 0);
+    }
+    for(int i = 0; i < count; i++){
+        CHECK(futures[i].wait(view, 5000) == 0);
+        snprintf(msg, sizeof(msg), "reply %d", i);
+        CHECK(strcmp(view.data, msg) == 0 && view.hdr->ret == i);
+        view.release();
+    }
+    CHECK(futures[0].wait(view) == -EINVAL);
+
+    /* a reply after the timeout is dropped, the future is reusable */
+    KubixFuture late;
+    CHECK(bus.sendRequest(100, 50, msg, 1, late) == 0);
+    CHECK(0 < lt.peerRecv(&frame, 5000));
+    CHECK(late.wait(view, 10) == -ETIMEDOUT);
+    CHECK(lt.peerSend(100, 50, KERNEL_REPLY, 0, 200, "late", 5,
+                      frame.cn_msg.seq) == 0);
+    CHECK(bus.sendRequest(100, 50, msg, 1, late) == 0);
+    CHECK(0 < lt.peerRecv(&frame, 5000));
+    CHECK(lt.peerSend(100, 50, KERNEL_REPLY, 0, 201, "in time", 8,
+                      frame.cn_msg.seq) == 0);
+    CHECK(late.wait(view, 5000) == 0 && strcmp(view.data, "in time") == 0);
+    view.release();
+
+    KubixFuture cancelled;
+    CHECK(bus.sendRequest(100, 50, msg, 1, cancelled) == 0);
+    cancelled.cancel();
+    CHECK(cancelled.wait(view) == -ECANCELED);
+
+    lt.peerClose();
+    bus.joinBus();
+}
+
+/* ------------------------------------------------------------------------------
+ * a stamped kernel message: the answer echoes the trailer with the bus
+ * stamps in order, the histograms count every stage
+ * */
+static void run_timestamps(const KubixConfig &config, bool zero_copy)
+{
+    LoopbackTransport lt;
+    Kubix bus(&lt, config);
+    if(zero_copy)
+        bus._user_view_callback = &userViewEcho;
+    else
+        bus._user_app_callback = &userEchoLogic;
+    CHECK(bus.runBus() == 0);
+
+    struct kubix_frame frame;
+    struct kubix_ts ts;
+    const char msg[] = "stamped request";
+    for(int i = 0; i < 100; i++){
+        int op = i ? KERNEL_REQUEST : KUBIX_CHANNEL;
+        __u64 sent = kbx_now_ns();
+        CHECK(lt.peerSend(300, 1, op, 0, 1 + i, msg, sizeof(msg), 0,
+                          sent) == 0);
+        int len = lt.peerRecv(&frame, 5000);
+        CHECK(frame.kbx_msg.data_len == sizeof(msg) &&
+              strcmp(frame.buf, msg) == 0);
+        CHECK(kubix_frame_get_ts(&frame, len, ts) && ts.sent == sent);
+        CHECK(sent <= ts.received && ts.received <= ts.taken &&
+              ts.taken <= ts.replied && ts.replied <= kbx_now_ns());
+    }
+    /* not stamped, not answered with a trailer */
+    exchange(lt, 300, 1, KERNEL_REQUEST, 101, "plain request");
+
+    KubixLatency lat;
+    for(int stage = 0; stage < KBX_LAT_STAGES; stage++){
+        CHECK(bus.latency(KERNEL_REQUEST, stage, lat) && lat.count == 99);
+        CHECK(lat.p50 <= lat.p99 && lat.p99 <= lat.p999 &&
+              lat.p999 <= lat.max);
+        CHECK(bus.latency(KUBIX_CHANNEL, stage, lat) && lat.count == 1);
+        CHECK(bus.latency(KERNEL_REPORT, stage, lat) && lat.count == 0);
+    }
+    CHECK(!bus.latency(USER_MESSAGE, KBX_LAT_QUEUE, lat));
+    CHECK(!bus.latency(KERNEL_REQUEST, KBX_LAT_STAGES, lat));
+
+    lt.peerClose();
+    bus.joinBus();
+
+    /* a bucket is at most 1/16 wide */
+    KubixHistogram hist;
+    for(__u64 ns = 1; ns <= 1000000; ns++)
+        hist.record(ns);
+    CHECK(hist.count() == 1000000 && hist.max() == 1000000);
+    CHECK(500000 <= hist.percentile(500) && hist.percentile(500) <= 532000);
+    CHECK(990000 <= hist.percentile(990) && hist.percentile(990) <= 1000000);
+    CHECK(hist.percentile(1000) == 1000000);
+}
+
+/* ------------------------------------------------------------------------------
+ * the sampled messages leave a span per stage in the exported trace
+ * */
+static int traced(const std::string &json, int stage)
+{
+    std::string name = std::string("\"name\":\"") +
+                       KubixTrace::stageName(stage) + "\"";
+    int count = 0;
+    for(size_t at = json.find(name); at != std::string::npos;
+        at = json.find(name, at + 1))
+        count++;
+    return count;
+}
+
+static void run_trace(KubixConfig config, int sample)
+{
+    const int messages = 64;
+    {
+        LoopbackTransport lt;
+        Kubix untraced(&lt, config);
+        CHECK(untraced.traceExport("/dev/null") == -1);
+    }
+    config.trace_sample = sample;
+    LoopbackTransport lt;
+    Kubix bus(&lt, config);
+    bus._user_app_callback = &userEchoLogic;
+    CHECK(bus.runBus() == 0);
+
+    struct kubix_frame frame;
+    for(int i = 0; i < messages; i++){
+        int op = i ? KERNEL_REQUEST : KUBIX_CHANNEL;
+        CHECK(lt.peerSend(400, 1, op, 0, 1 + i, "traced", 7, 0,
+                          kbx_now_ns()) == 0);
+        CHECK(0 < lt.peerRecv(&frame, 5000));
+    }
+    lt.peerClose();
+    bus.joinBus();
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/kubix_trace.%d.json", getpid());
+    int spans = bus.traceExport(path);
+    std::string json;
+    if(FILE *in = fopen(path, "r")){
+        char chunk[4096];
+        size_t n;
+        while((n = fread(chunk, 1, sizeof(chunk), in)))
+            json.append(chunk, n);
+        fclose(in);
+    }
+    unlink(path);
+    CHECK(spans == KBX_TRACE_STAGES * messages / sample);
+    for(int stage = 0; stage < KBX_TRACE_STAGES; stage++)
+        CHECK(traced(json, stage) == messages / sample);
+    CHECK(json.find("\"traceEvents\"") != std::string::npos &&
+          json.find("\"channel\":\"400.1\"") != std::string::npos);
+}
+
+int main()
+{
+    overflow(OVERFLOW_DROP_OLDEST, 4, 10);
+    overflow(OVERFLOW_DROP_NEWEST, 4, 10);
+    handoff(10000);
+    flatmap(100000);
+    logger();
+
+    KubixConfig config;
+    config.stats = 1;
+    run_bus(config);
+    config.stats = 0;
+
+    config.tx_batch = 16;
+    config.workers = 4;
+    run_bus(config);
+    run_bus(config, true);
+
+    config.latency_mode = 1;
+    run_bus(config);
+
+    KubixConfig poll_config = config;
+    poll_config.io_uring = 0;
+    run_bus(poll_config);
+    poll_config.latency_mode = 0;
+    run_bus(poll_config, true);
+
+    run_coro(KubixConfig());
+    run_coro(config);
+    run_erase_waiters(KubixConfig());
+    run_erase_waiters(config);
+
+    run_requests(KubixConfig());
+    run_requests(config);
+
+    run_shards(KubixConfig(), 4);
+    run_shards(config, 3);
+    run_kernel_shards();
+
+    run_filter(KubixConfig(), 1);
+    run_filter(KubixConfig(), 0);
+
+    run_reliable(KubixConfig());
+    run_reliable(config);
+    run_reliable_overflow(KubixConfig());
+    run_reliable_overflow(config);
+    run_unreliable_acks(KubixConfig());
+    run_blocked(KubixConfig(), true);
+    run_blocked(KubixConfig(), false);
+    run_blocked(poll_config, true);
+
+    run_timestamps(KubixConfig(), false);
+    run_timestamps(config, true);
+
+    run_trace(KubixConfig(), 1);
+    run_trace(config, 4);
+
+    fprintf(stderr, "%s: %d failure(s)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
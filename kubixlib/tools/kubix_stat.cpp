@@ -0,0 +1,249 @@
+/*
+ *     kubix_stat.cpp
+ *
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* ------------------------------------------------------------------------------
+ * kubix-stat: prints the counters the buses of running processes publish
+ * in /dev/shm, see kbx_stats.h: the ones with KubixConfig::stats set or
+ * started with KUBIX_STATS=1. It maps them read only, the buses go on.
+ *
+ *   kubix-stat                     lists the buses
+ *   kubix-stat [options] bus|pid   the shards and the channels of a bus,
+ *                                  or of every bus of a process
+ *     -i seconds   repeat, with the rates over the interval
+ *     -c count     stop after that many repeats
+ *     -n top       the busiest channels only
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "kbx_stats.h"
+
+#define SHM_DIR		"/dev/shm"
+
+struct Options{
+    int interval;
+    int count;
+    int top;
+};
+
+typedef std::map<std::pair<int, int>, KubixNodeStats> Channels;
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static std::vector<std::string> buses(const char *filter)
+{
+    std::vector<std::string> names;
+    DIR *dir = opendir(SHM_DIR);
+    if(!dir)
+        return names;
+    std::string prefix = filter ? std::string("kubix.") + filter + "." : "kubix.";
+    while(struct dirent *ent = readdir(dir)){
+        if(!strncmp(ent->d_name, prefix.c_str(), prefix.size()))
+            names.push_back(std::string("/") + ent->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void list()
+{
+    std::vector<std::string> names = buses(nullptr);
+    if(names.empty()){
+        printf("no kubix buses in %s\n", SHM_DIR);
+        return;
+    }
+    printf("%-24s %8s %8s %10s %14s %10s\n", "bus", "pid", "up", "channels",
+           "messages", "drops");
+    for(auto &name : names){
+        size_t size;
+        const kubix_stat_hdr *hdr = KubixStats::open(name.c_str(), size);
+        if(!hdr)
+            continue;
+        unsigned long messages = 0;
+        unsigned long drops = 0;
+        for(int i = 0; i < hdr->shards; i++){
+            messages += kbx_stat_shards(hdr)[i].delivered;
+            drops += kbx_stat_shards(hdr)[i].drops;
+        }
+        /* a crashed process leaves its region behind */
+        bool stale = kill(hdr->pid, 0) && errno == ESRCH;
+        printf("%-24s %8d %7lds %10d %14lu %10lu%s\n", name.c_str() + 1,
+               hdr->pid, (long)(time(NULL) - hdr->started),
+               hdr->channels.load(), messages, drops, stale ? "  stale" : "");
+        munmap((void*)hdr, size);
+    }
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static Channels channels(const kubix_stat_hdr *hdr)
+{
+    Channels nodes;
+    const kubix_stat_node *slots = kbx_stat_nodes(hdr);
+    for(int i = 0; i < hdr->nodes; i++){
+        KubixNodeStats stats;
+        /* a slot changing hands is read again */
+        for(int tries = 0; tries < 3; tries++){
+            if(KubixStats::read(&slots[i], stats)){
+                nodes[std::make_pair(stats.pid, stats.uid)] = stats;
+                break;
+            }
+            if(!slots[i].used.load(std::memory_order_relaxed))
+                break;
+        }
+    }
+    return nodes;
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void show(const char *name, const kubix_stat_hdr *hdr,
+                 const Options &opts, Channels &last)
+{
+    Channels nodes = channels(hdr);
+    unsigned long messages = hdr->retired_messages;
+    unsigned long bytes = hdr->retired_bytes;
+    unsigned long drops = hdr->retired_drops;
+    unsigned long served = hdr->retired_served;
+    unsigned long errors = hdr->retired_errors;
+    for(auto &kv : nodes){
+        messages += kv.second.messages;
+        bytes += kv.second.bytes;
+        drops += kv.second.drops;
+        served += kv.second.served;
+        errors += kv.second.errors;
+    }
+
+    printf("%s: pid %d, up %lds, %d channels, %lu without counters\n",
+           name + 1, hdr->pid, (long)(time(NULL) - hdr->started),
+           hdr->channels.load(), hdr->unslotted.load());
+    printf("  channels: messages %lu, bytes %lu, drops %lu, served %lu, "
+           "errors %lu\n", messages, bytes, drops, served, errors);
+    printf("  %5s %10s %10s %10s %10s %12s %8s %8s %8s %9s %8s %9s\n",
+           "shard", "wakeups", "received", "delivered", "discarded", "bytes",
+           "drops", "gaps", "dups", "overflows", "acks", "rcvbuf");
+    for(int i = 0; i < hdr->shards; i++){
+        const kubix_stat_shard *s = &kbx_stat_shards(hdr)[i];
+        if(!s->wakeups && !s->rcvbuf)
+            continue;
+        printf("  %5d %10lu %10lu %10lu %10lu %12lu %8lu %8lu %8lu %9lu %8lu "
+               "%9d%s\n", i, s->wakeups.load(), s->messages.load(),
+               s->delivered.load(), s->discarded.load(), s->bytes.load(),
+               s->drops.load(), s->gaps.load(), s->duplicates.load(),
+               s->overflows.load(), s->acks.load(), s->rcvbuf.load(),
+               s->uring ? " uring" : "");
+    }
+
+    std::vector<const KubixNodeStats*> order;
+    for(auto &kv : nodes)
+        order.push_back(&kv.second);
+    std::sort(order.begin(), order.end(),
+              [](const KubixNodeStats *a, const KubixNodeStats *b){
+                  return a->messages > b->messages; });
+    if(0 < opts.top && opts.top < (int)order.size())
+        order.resize(opts.top);
+
+    printf("  %-22s %5s %10s %12s %8s %10s %8s %6s %6s %10s\n", "channel",
+           "shard", "messages", "bytes", "drops", "served", "errors", "depth",
+           "max", "msg/s");
+    for(const KubixNodeStats *n : order){
+        char rate[16] = "-";
+        auto prev = last.find(std::make_pair(n->pid, n->uid));
+        if(opts.interval && prev != last.end())
+            snprintf(rate, sizeof(rate), "%lu",
+                     (n->messages - prev->second.messages) / opts.interval);
+        char id[32];
+        snprintf(id, sizeof(id), "%d.%d", n->pid, n->uid);
+        printf("  %-22s %5d %10lu %12lu %8lu %10lu %8lu %6d %6d %10s\n", id,
+               n->shard, n->messages, n->bytes, n->drops, n->served,
+               n->errors, n->depth, n->depth_max, rate);
+    }
+    last.swap(nodes);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+static void usage()
+{
+    fprintf(stderr, "usage: kubix-stat [-i seconds] [-c count] [-n top] "
+            "[bus|pid]\n");
+    exit(2);
+}
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  */
+int main(int argc, char *argv[])
+{
+    Options opts = { 0, 0, 0 };
+    int opt;
+
+    while((opt = getopt(argc, argv, "i:c:n:h")) != -1){
+        switch(opt){
+        case 'i': opts.interval = atoi(optarg); break;
+        case 'c': opts.count = atoi(optarg); break;
+        case 'n': opts.top = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if(optind == argc){
+        list();
+        return 0;
+    }
+    if(optind + 1 != argc)
+        usage();
+
+    const char *arg = argv[optind];
+    std::vector<std::string> names;
+    if(strspn(arg, "0123456789") == strlen(arg))
+        names = buses(arg);
+    else
+        names.push_back(arg[0] == '/' ? arg : std::string("/") + arg);
+
+    std::vector<const kubix_stat_hdr*> hdrs;
+    std::vector<size_t> sizes;
+    for(auto &name : names){
+        size_t size;
+        const kubix_stat_hdr *hdr = KubixStats::open(name.c_str(), size);
+        if(!hdr){
+            fprintf(stderr, "%s: no kubix bus\n", name.c_str() + 1);
+            return 1;
+        }
+        hdrs.push_back(hdr);
+        sizes.push_back(size);
+    }
+    if(hdrs.empty()){
+        fprintf(stderr, "%s: no kubix bus\n", arg);
+        return 1;
+    }
+
+    std::vector<Channels> last(hdrs.size());
+    for(int round = 1; ; round++){
+        for(size_t i = 0; i < hdrs.size(); i++)
+            show(names[i].c_str(), hdrs[i], opts, last[i]);
+        if(!opts.interval || round == opts.count)
+            break;
+        sleep(opts.interval);
+        printf("\n");
+    }
+    for(size_t i = 0; i < hdrs.size(); i++)
+        munmap((void*)hdrs[i], sizes[i]);
+    return 0;
+}
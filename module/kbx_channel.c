@@ -29,6 +29,7 @@
 #include <linux/connector.h>
 
 #include "kbx_channel.h"
+#include "kbx_latency.h"
 
 #define KUBIX "channel"
 
@@ -45,7 +46,6 @@ static int cn_cb_equal_001(struct cb_id *i1, struct cb_id *i2)
 static int get_user_message(struct chan_node*, pid_t, s32, void **, int *len);
 /* -----------------------------------------------------------------------------
  * */
-static struct cb_id kubix_id = { CN_SS_IDX, CN_SS_VAL };
 static int kbx_pid =   0;
 static int kbx_uid = -10;
 /* -----------------------------------------------------------------------------
@@ -60,19 +60,162 @@ const char *str_ops_type(int type)
         case USER_RELEASE: return "USER_RELEASE"; break;
         case KERNEL_REPORT: return "KERNEL_REPORT"; break;
         case NO_ACTION:  return "NO_ACTION";  break;
+        case KERNEL_REPLY: return "KERNEL_REPLY"; break;
+        case USER_ACK: return "USER_ACK"; break;
     }
     return "";
 }
 /* -----------------------------------------------------------------------------
+ * one of the connector ids registered by kubix_init
  * */
-void send_message_to_user(struct kubix_hdr *data, u32 seq)
+int kubix_cb_id_valid(struct cb_id *id)
 {
+    return id->val == CN_SS_VAL && CN_SS_IDX <= id->idx &&
+           id->idx < CN_SS_IDX + kubix_shards;
+}
+/* -----------------------------------------------------------------------------
+ * reliable delivery: a message sent to a channel stays in its retransmit
+ * window until the user bus acks its seq, cumulatively in cn_msg.ack of
+ * whatever it sends back; a USER_ACK also asks to resend what follows the
+ * ack. A full window refuses new messages with -ENOBUFS until the user bus
+ * acks: a dropped unacked one could never be resent, and the user bus
+ * would take everything after it as a gap for ever.
+ * */
+enum{
+    TX_SENT,
+    TX_ENOBUFS,
+    TX_ESRCH,
+    TX_RETRANSMITS,
+    TX_REFUSED,
+    TX_TIMEOUTS,
+    TX_COUNTERS
+};
+static atomic_long_t tx_counters[TX_COUNTERS];
+/* -----------------------------------------------------------------------------
+ * */
+static int kbx_main_node(struct chan_node *chan)
+{
+    return chan->pid == kbx_pid && chan->unique_id == kbx_uid;
+}
+/* -----------------------------------------------------------------------------
+ * the message goes to the multicast group of the channel connector id, a
+ * lost one stays in the window; rtx_lock held
+ * */
+static void kbx_netlink_send(struct chan_node *chan, struct cn_msg *m)
+{
+    int err = cn_netlink_send(m, 0, chan->id.idx, GFP_ATOMIC);
+
+    atomic_long_inc(&tx_counters[TX_SENT]);
+    if(err == -ENOBUFS)
+        atomic_long_inc(&tx_counters[TX_ENOBUFS]);
+    else if(err == -ESRCH)
+        atomic_long_inc(&tx_counters[TX_ESRCH]);
+    else if(err)
+        printk(KERN_ERR KUBIX": %d,%s - [%d,%d] seq %u not sent, error %d\n",
+               __LINE__, __func__, chan->pid, chan->unique_id, m->seq, err);
+}
+/* -----------------------------------------------------------------------------
+ * frees the window up to ack
+ * */
+static void kbx_rtx_ack(struct chan_node *chan, u32 ack)
+{
+    struct kbx_rtx_slot *slot;
+    int i;
+
+    spin_lock(&chan->rtx_lock);
+    if((s32)(ack - chan->rtx_acked) > 0){
+        chan->rtx_acked = ack;
+        for(i = 0; i < KBX_RTX_WINDOW; i++){
+            slot = &chan->rtx[i];
+            if(slot->msg && (s32)(slot->seq - ack) <= 0){
+                kfree(slot->msg);
+                slot->msg = NULL;
+            }
+        }
+    }
+    spin_unlock(&chan->rtx_lock);
+}
+/* -----------------------------------------------------------------------------
+ * sends the window after the last ack again, in order: the user bus drops
+ * whatever follows a gap, go back N
+ * */
+static void kbx_rtx_resend(struct chan_node *chan)
+{
+    struct kbx_rtx_slot *slot;
+    u32 seq, end;
+    s32 count;
+
+    spin_lock(&chan->rtx_lock);
+    end = chan->seq;
+    seq = chan->rtx_acked + 1;
+    count = (s32)(end - seq);
+    if(count > KBX_RTX_WINDOW)
+        seq = end - KBX_RTX_WINDOW;
+    for(; 0 < count && seq != end; seq++){
+        slot = &chan->rtx[seq % KBX_RTX_WINDOW];
+        if(!slot->msg || slot->seq != seq)
+            continue;
+        kbx_netlink_send(chan, slot->msg);
+        atomic_long_inc(&tx_counters[TX_RETRANSMITS]);
+    }
+    spin_unlock(&chan->rtx_lock);
+}
+/* -----------------------------------------------------------------------------
+ * the user bus acks in its answer the message it took last: an answer to an
+ * older one is late, its reader gave up
+ * */
+static int kbx_rsp_awaited(struct chan_node *chan, u32 ack)
+{
+    int awaited;
+
+    spin_lock(&chan->rtx_lock);
+    awaited = !chan->rsp_seq || (s32)(ack - chan->rsp_seq) >= 0;
+    if(awaited)
+        chan->rsp_seq = 0;
+    spin_unlock(&chan->rtx_lock);
+    return awaited;
+}
+/* -----------------------------------------------------------------------------
+ * drops an answer nobody took; with gave_up the reader of it is gone, the
+ * answer still to come is late too
+ * */
+static void kbx_rsp_reset(struct chan_node *chan, int gave_up)
+{
+    mutex_lock(&chan->lock);
+    kfree(chan->rspmsg);
+    chan->rspmsg = NULL;
+    chan->rspmsg_len = 0;
+    mutex_unlock(&chan->lock);
+    spin_lock(&chan->rtx_lock);
+    if(gave_up && chan->rsp_seq)
+        chan->rsp_seq++;
+    spin_unlock(&chan->rtx_lock);
+}
+/* -----------------------------------------------------------------------------
+ * for_each_chan_node: resends the channels of a shard whose user socket
+ * overflowed, any of them may have lost messages
+ * */
+static void kbx_rtx_resync(struct chan_node *chan, void *id)
+{
+    if(cn_cb_equal_001(&chan->id, id) && !kbx_main_node(chan))
+        kbx_rtx_resend(chan);
+}
+/* -----------------------------------------------------------------------------
+ * sends a message with the next seq of the channel, taken only if it goes
+ * out; ack is the sequence number of the user message answered, 0 if none;
+ * ext bytes after the payload go too, the timestamp trailer. A reader waits
+ * for the answer of a KUBIX_CHANNEL or KERNEL_REQUEST.
+ *
+ * @return the seq on success, 0 if there was no memory or the window of
+ *         the channel is full of unacked messages
+ * */
+static u32 send_to_user(struct chan_node *chan, struct kubix_hdr *data,
+                        u32 ack, int ext)
+{
+    struct kbx_rtx_slot *slot;
     struct cn_msg *m;
-    int len = sizeof(*data) + data->data_len;
-
-    printk(KERN_DEBUG KUBIX": %d,%s - [%d,%d] seq  %u, type %s, lrngth %d\n",
-            __LINE__, __func__,
-            data->pid, data->uid, seq, str_ops_type(data->opt), len);
+    int len = sizeof(*data) + data->data_len + ext;
+    u32 seq = 0;
 
     m = kzalloc(sizeof(*m) + sizeof(*data) + len + 1, GFP_ATOMIC);
     if(m == NULL){
@@ -81,20 +224,75 @@ void send_message_to_user(struct kubix_hdr *data, u32 seq)
         goto out;
     }
 
-    m->id.idx = CN_SS_IDX;
-    m->id.val = CN_SS_VAL;
+    m->id = chan->id;
 
     m->len = len;
     memcpy(m + 1, data, m->len);
 
-    m->ack =   0;
-    m->seq = seq;
+    m->ack = ack;
 
-    cn_netlink_send(m, 0, CN_SS_IDX, GFP_ATOMIC);
-    kfree(m);
+    spin_lock(&chan->rtx_lock);
+    /* the main node carries the handshake alone, nothing to resend */
+    if(kbx_main_node(chan)){
+        m->seq = seq = chan->seq++;
+        kbx_netlink_send(chan, m);
+        spin_unlock(&chan->rtx_lock);
+        kfree(m);
+        goto out;
+    }
+    slot = &chan->rtx[chan->seq % KBX_RTX_WINDOW];
+    if(slot->msg){
+        printk(KERN_DEBUG KUBIX": %d,%s - [%d,%d] window full, %u unacked\n",
+               __LINE__, __func__, data->pid, data->uid, slot->seq);
+        spin_unlock(&chan->rtx_lock);
+        atomic_long_inc(&tx_counters[TX_REFUSED]);
+        kfree(m);
+        goto out;
+    }
+    m->seq = seq = chan->seq++;
+    if(data->opt == KUBIX_CHANNEL || data->opt == KERNEL_REQUEST)
+        chan->rsp_seq = seq;
+    kbx_netlink_send(chan, m);
+    slot->seq = seq;
+    slot->msg = m;
+    spin_unlock(&chan->rtx_lock);
 
+    printk(KERN_DEBUG KUBIX": %d,%s - [%d,%d] seq  %u, type %s, lrngth %d\n",
+            __LINE__, __func__,
+            data->pid, data->uid, seq, str_ops_type(data->opt), len);
 out:
-    return;
+    return seq;
+}
+/* -----------------------------------------------------------------------------
+ * */
+int send_message_to_user(struct chan_node *chan, struct kubix_hdr *data)
+{
+    return send_to_user(chan, data, 0, 0) ? 0 : -ENOBUFS;
+}
+/* -----------------------------------------------------------------------------
+ * a USER_MESSAGE carrying a sequence number is a request of its own: it is
+ * queued instead of overwriting the single response slot, so a channel can
+ * carry many of them; the reader answers each with KERNEL_REPLY
+ * */
+static void queue_user_request(struct chan_node *chaninfo, struct cn_msg *msg,
+                               struct kubix_hdr *kbx_hdr)
+{
+    struct user_request *req;
+
+    req = kzalloc(sizeof(*req), GFP_KERNEL);
+    if(req)
+        req->data = kmalloc(kbx_hdr->data_len + 1, GFP_KERNEL);
+    if(!req || !req->data){
+        printk(KERN_ERR KUBIX": %d, %s - [%d.%d] request seq %u dropped\n",
+               __LINE__, __func__, kbx_hdr->pid, kbx_hdr->uid, msg->seq);
+        kfree(req);
+        return;
+    }
+    req->seq = msg->seq;
+    req->ret = kbx_hdr->ret;
+    req->len = kbx_hdr->data_len;
+    memcpy(req->data, kbx_hdr->data, req->len);
+    list_add_tail(&req->link, &chaninfo->requests);
 }
 /* -----------------------------------------------------------------------------
  * */
@@ -109,7 +307,7 @@ void send_kubix_handshake(struct chan_node *chaninfo)
     hndshk->opt = KUBIX_CHANNEL;
     memcpy(&hndshk->data, hello, len);
     hndshk->data_len = len;
-    send_message_to_user(hndshk, chaninfo->seq++);
+    send_message_to_user(chaninfo, hndshk);
     return;
 }
 /* -----------------------------------------------------------------------------
@@ -148,10 +346,10 @@ void cn_user_msg_callback(struct cn_msg *msg, struct netlink_skb_parms *nsp)
 
     /* if the message come is unwanted guest
      */
-    if(!cn_cb_equal_001(&msg->id, &kubix_id)){
-        printk(KERN_INFO KUBIX": %d, %s - spurious message %d.%d <> %d.%d\n",
+    if(!kubix_cb_id_valid(&msg->id)){
+        printk(KERN_INFO KUBIX": %d, %s - spurious message %d.%d <> %d.%d+%d\n",
                __LINE__, __func__, msg->id.idx, msg->id.val,
-               kubix_id.idx, kubix_id.val);
+               CN_SS_IDX, CN_SS_VAL, kubix_shards);
         goto out;
     }
 
@@ -167,7 +365,17 @@ void cn_user_msg_callback(struct cn_msg *msg, struct netlink_skb_parms *nsp)
     if(!kbx_hdr){
         printk(KERN_ERR KUBIX": %d, %s -  empty netlink message!\n",
                 __LINE__, __func__);
-        goto wake_up_out;
+        goto out;
+    }
+    /* data_len comes from user space: the payload queue_user_request and
+     * the reply below copy must be in the message
+     */
+    if(len < (int)sizeof(*kbx_hdr) || kbx_hdr->data_len < 0 ||
+       (int)sizeof(*kbx_hdr) + kbx_hdr->data_len > len){
+        printk(KERN_ERR KUBIX": %d, %s - payload length %d in %d bytes\n",
+               __LINE__, __func__,
+               len < (int)sizeof(*kbx_hdr) ? -1 : kbx_hdr->data_len, len);
+        goto out;
     }
 
     /*--------------------------------------------------------------------------
@@ -176,13 +384,30 @@ void cn_user_msg_callback(struct cn_msg *msg, struct netlink_skb_parms *nsp)
     if(find_chan_node(kbx_hdr->pid, kbx_hdr->uid, &chaninfo) < 0){
         printk(KERN_DEBUG KUBIX": %d, %s -  [%d.%d] node does not exists\n",
                 __LINE__, __func__, kbx_hdr->pid, kbx_hdr->uid);
-        goto wake_up_out;
+        goto out;
     }
+    if(!cn_cb_equal_001(&msg->id, &chaninfo->id))
+        printk(KERN_DEBUG KUBIX": %d, %s - [%d.%d] of id %d.%d came on %d.%d\n",
+               __LINE__, __func__, kbx_hdr->pid, kbx_hdr->uid,
+               chaninfo->id.idx, chaninfo->id.val, msg->id.idx, msg->id.val);
     printk(KERN_INFO KUBIX": %d, %s - Operation in user message %s; "
            "Related channel node [%d.%d] in state %s; resulted as %d\n",
            __LINE__, __func__, str_ops_type(kbx_hdr->opt), kbx_hdr->pid,
            kbx_hdr->uid, str_channel_state(chaninfo->state), kbx_hdr->ret);
 
+    /* the user bus has every message up to the ack, whatever it sends;
+     * USER_ACK asks for the rest, on the main node for a whole shard
+     * whose socket overflowed
+     */
+    kbx_rtx_ack(chaninfo, msg->ack);
+    if(kbx_hdr->opt == USER_ACK){
+        if(kbx_main_node(chaninfo))
+            for_each_chan_node(kbx_rtx_resync, &msg->id);
+        else
+            kbx_rtx_resend(chaninfo);
+        goto out;
+    }
+
     /*..........................................................................
      *  now response processing
      */
@@ -221,21 +446,34 @@ void cn_user_msg_callback(struct cn_msg *msg, struct netlink_skb_parms *nsp)
             break;
         case CHAN_NODE_NETLINK: // already opened channel
             switch(kbx_hdr->opt) {
-            case USER_MESSAGE: break;
+            case USER_MESSAGE:
+                if(msg->seq){
+                    queue_user_request(chaninfo, msg, kbx_hdr);
+                    goto unlock_out;
+                }
+                break;
             case USER_RELEASE: chaninfo->state = CHAN_NODE_DESTROY; break;
             case KUBIX_CHANNEL:
             case KERNEL_REQUEST:
             case KERNEL_RELEASE:
             case KERNEL_REPORT:
+            case KERNEL_REPLY:
             case NO_ACTION:
                 kbx_hdr->ret = -(KBX_IMPOSSIBLE_OP);
                 goto unlock_out;
             }
         case CHAN_NODE_DESTROY:
             del_chan_node(kbx_hdr->pid, kbx_hdr->uid, &chaninfo);
-            kfree(chaninfo);
+            free_chan_node(chaninfo);
             goto unlock_out;
     }
+    if(!kbx_rsp_awaited(chaninfo, msg->ack)){
+        printk(KERN_DEBUG KUBIX": %d, %s - [%d.%d] late answer, ack %u\n",
+               __LINE__, __func__, kbx_hdr->pid, kbx_hdr->uid, msg->ack);
+        goto unlock_out;
+    }
+    kbx_ts_reply(chaninfo, kbx_hdr, len);
+    kfree(chaninfo->rspmsg);
     chaninfo->rspmsg = kmalloc(kbx_hdr->data_len, GFP_KERNEL);
     chaninfo->rspmsg_len = kbx_hdr->data_len;
     memcpy(chaninfo->rspmsg, kbx_hdr->data, kbx_hdr->data_len);
@@ -243,7 +481,6 @@ void cn_user_msg_callback(struct cn_msg *msg, struct netlink_skb_parms *nsp)
 
 unlock_out:
     mutex_unlock(&chaninfo->lock);
-wake_up_out:
     wake_up_interruptible(&chaninfo->rspmsg_q);
 out:
     return;
@@ -266,6 +503,8 @@ int get_user_message(struct chan_node *chaninfo, pid_t pid, s32 uid,
                             void **rsp, int *len)
 {
     int ret = -1;
+    int tries;
+    long left;
     *rsp = NULL;
     *len = 0;
 
@@ -276,19 +515,45 @@ int get_user_message(struct chan_node *chaninfo, pid_t pid, s32 uid,
         goto out;
     }
 
-    /* wait until user message come
+    /* wait until user message come, resend what the user bus has not
+     * acked on every timeout: the request or its answer may be lost;
+     * rtx_retries 0 waits for ever
      */
-    if(!chaninfo->rspmsg_len)
-        wait_event_interruptible(chaninfo->rspmsg_q, chaninfo->rspmsg_len > 0);
+    for(tries = 0; !chaninfo->rspmsg_len; tries++){
+        if(kubix_rtx_retries && tries == kubix_rtx_retries){
+            atomic_long_inc(&tx_counters[TX_TIMEOUTS]);
+            printk(KERN_ERR KUBIX": %d, %s - [%d.%d] no user answer in %d ms\n",
+                   __LINE__, __func__, pid, uid,
+                   tries * kubix_rtx_timeout_ms);
+            ret = -ETIMEDOUT;
+            kbx_ts_done(chaninfo, 0);
+            kbx_rsp_reset(chaninfo, 1);
+            goto out;
+        }
+        left = wait_event_interruptible_timeout(chaninfo->rspmsg_q,
+                        chaninfo->rspmsg_len > 0,
+                        msecs_to_jiffies(kubix_rtx_timeout_ms));
+        if(left < 0){
+            ret = -EINTR;
+            kbx_ts_done(chaninfo, 0);
+            kbx_rsp_reset(chaninfo, 1);
+            goto out;
+        }
+        if(!left)
+            kbx_rtx_resend(chaninfo);
+    }
     /* transfer user message to a caller and nulify the channel buffer
      * move buffer, a caller has to free
      */
+    mutex_lock(&chaninfo->lock);
     *len = chaninfo->rspmsg_len;
     *rsp = chaninfo->rspmsg;
     ret  = chaninfo->user_ret;
+    kbx_ts_done(chaninfo, 1);
 
     chaninfo->rspmsg_len = 0;
     chaninfo->rspmsg = NULL;
+    mutex_unlock(&chaninfo->lock);
 
 out:
     return ret;
@@ -310,7 +575,6 @@ out:
 int get_verified_channel(pid_t pid, s32 uid, void *msg, int *length,
                          struct chan_node **chan)
 {
-    u32 seq;
     struct chan_node *chaninfo;
     struct kubix_hdr *req;
     int len = *length;
@@ -360,24 +624,31 @@ int get_verified_channel(pid_t pid, s32 uid, void *msg, int *length,
         printk(KERN_INFO KUBIX": %d, %s - pre-existed node schedule for remove\n",
                 __LINE__, __func__);
         del_chan_node(pid, uid, &chaninfo);
-        kfree(chaninfo);
+        free_chan_node(chaninfo);
         goto unlock_out;
     }
 
     printk(KERN_INFO KUBIX": %d, %s - bus node was created for [%d.%d] channel\n",
             __LINE__, __func__, pid, uid);
     /* transfer request to user space */
-    req = kzalloc(sizeof(*req) + len, GFP_ATOMIC);
+    req = kzalloc(sizeof(*req) + len + sizeof(struct kubix_ts), GFP_ATOMIC);
     req->pid = pid;
     req->uid = uid;
     req->opt = KUBIX_CHANNEL;
     req->data_len = len;
     memcpy(req->data, msg, len);
-    seq = chaninfo->seq++;
 
     printk(KERN_INFO KUBIX": %d, %s - sending message %p to [%d.%d] channel\n",
             __LINE__, __func__, msg, pid, uid);
-    send_message_to_user(req, seq);
+    /* a new node, its window is empty */
+    if(!send_to_user(chaninfo, req, 0, kbx_ts_stamp(chaninfo, req))){
+        kfree(req);
+        del_chan_node(pid, uid, &chaninfo);
+        free_chan_node(chaninfo);
+        *chan = NULL;
+        ret = -ENOMEM;
+        goto out;
+    }
 
     chaninfo->state = CHAN_NODE_HANDSHAKE;
 
@@ -425,7 +696,6 @@ EXPORT_SYMBOL(get_message_from_userspace);
 int send_message_to_userspace(pid_t pid, s32 uid, void *msg, int len, int op)
 {
     int ret = -1;
-    u32 seq;
     struct chan_node *chaninfo;
     struct kubix_hdr *req = NULL;
 
@@ -447,7 +717,7 @@ int send_message_to_userspace(pid_t pid, s32 uid, void *msg, int len, int op)
                 "NL connector is not ready or closed");
         goto out;
     }
-    req = kzalloc(sizeof(*req) + len + 1, GFP_KERNEL);
+    req = kzalloc(sizeof(*req) + len + sizeof(struct kubix_ts), GFP_KERNEL);
     req->pid = pid;
     req->uid = uid;
     req->opt = op; /* KERNEL_REQUEST || KERNEL_RELEASE || KERNEL_REPORT */
@@ -455,8 +725,16 @@ int send_message_to_userspace(pid_t pid, s32 uid, void *msg, int len, int op)
     memcpy(req->data, msg, len);
     req->data_len = len;
 
-    seq = chaninfo->seq++;
-    send_message_to_user(req, seq);
+    /* a late answer to a reader which gave up is not this one's */
+    if(op == KERNEL_REQUEST)
+        kbx_rsp_reset(chaninfo, 0);
+    /* a full window pushes back on the caller, the user bus is behind */
+    if(!send_to_user(chaninfo, req, 0, kbx_ts_stamp(chaninfo, req))){
+        kbx_ts_done(chaninfo, 0);
+        ret = -ENOBUFS;
+        goto out;
+    }
+    ret = 0;
     /* request - response logic */
     if(op == KERNEL_REQUEST)
         ret = get_user_message(chaninfo, pid, uid, &msg, &len);
@@ -469,5 +747,115 @@ out:
     return ret;
 }
 EXPORT_SYMBOL(send_message_to_userspace);
+/* -----------------------------------------------------------------------------
+ * @brief - block and wait for the oldest sequenced USER_MESSAGE of a channel
+ *
+ * @parm1 - pid  - caller process/thread ID
+ * @parm2 - uid  - unique value for the caller
+ * @parm3 - seq  - the request sequence number to pass to the reply
+ * @parm4 - msg  - the request payload, a caller has to free
+ * @parm5 - len  - the payload length
+ *
+ * @return the user return code of the request or -(n) error code
+ * */
+int get_request_from_userspace(pid_t pid, s32 uid, u32 *seq,
+                               void **msg, int *len)
+{
+    int ret = -1;
+    struct chan_node *chaninfo;
+    struct user_request *req = NULL;
+    *msg = NULL;
+    *len = 0;
+
+    if(find_chan_node(pid, uid, &chaninfo) < 0){
+        printk(KERN_DEBUG KUBIX": %d, %s - node %d.%d is not found\n",
+                __LINE__, __func__, pid, uid);
+        goto out;
+    }
+    if(wait_event_interruptible(chaninfo->rspmsg_q,
+                                !list_empty(&chaninfo->requests) ||
+                                chaninfo->state != CHAN_NODE_NETLINK)){
+        ret = -EINTR;
+        goto out;
+    }
+    mutex_lock(&chaninfo->lock);
+    if(!list_empty(&chaninfo->requests)){
+        req = list_first_entry(&chaninfo->requests, struct user_request, link);
+        list_del(&req->link);
+    }
+    mutex_unlock(&chaninfo->lock);
+    if(!req)
+        goto out;   /* the channel is closing */
+
+    *seq = req->seq;
+    *msg = req->data;
+    *len = req->len;
+    ret  = req->ret;
+    kfree(req);
+
+out:
+    return ret;
+}
+EXPORT_SYMBOL(get_request_from_userspace);
+/* -----------------------------------------------------------------------------
+ * @brief - answers a request of get_request_from_userspace, the user bus
+ *          completes the request future whose sequence number is acked
+ *
+ * @return 0 on success or -(n) error code
+ * */
+int reply_message_to_userspace(pid_t pid, s32 uid, u32 seq,
+                               void *msg, int len, int ret)
+{
+    struct chan_node *chaninfo;
+    struct kubix_hdr *rsp;
+    u32 sent;
+
+    if(find_chan_node(pid, uid, &chaninfo) < 0){
+        printk(KERN_DEBUG KUBIX": %d, %s - node %d.%d is not found\n",
+                __LINE__, __func__, pid, uid);
+        return -1;
+    }
+    if(chaninfo->state != CHAN_NODE_NETLINK)
+        return -1;
+
+    rsp = kzalloc(sizeof(*rsp) + len + 1, GFP_KERNEL);
+    if(!rsp)
+        return -ENOMEM;
+    rsp->pid = pid;
+    rsp->uid = uid;
+    rsp->opt = KERNEL_REPLY;
+    rsp->ret = ret;
+    rsp->data_len = len;
+    memcpy(rsp->data, msg, len);
+
+    sent = send_to_user(chaninfo, rsp, seq, 0);
+    kfree(rsp);
+    return sent ? 0 : -ENOBUFS;
+}
+EXPORT_SYMBOL(reply_message_to_userspace);
+/* -----------------------------------------------------------------------------
+ * */
+void kubix_get_tx_stats(struct kubix_tx_stats *stats)
+{
+    stats->sent        = atomic_long_read(&tx_counters[TX_SENT]);
+    stats->enobufs     = atomic_long_read(&tx_counters[TX_ENOBUFS]);
+    stats->esrch       = atomic_long_read(&tx_counters[TX_ESRCH]);
+    stats->retransmits = atomic_long_read(&tx_counters[TX_RETRANSMITS]);
+    stats->refused     = atomic_long_read(&tx_counters[TX_REFUSED]);
+    stats->timeouts    = atomic_long_read(&tx_counters[TX_TIMEOUTS]);
+}
+EXPORT_SYMBOL(kubix_get_tx_stats);
+/* -----------------------------------------------------------------------------
+ * */
+void kubix_show_tx_stats(void)
+{
+    struct kubix_tx_stats stats;
+
+    kubix_get_tx_stats(&stats);
+    printk(KERN_INFO KUBIX": %d, %s - sent %lu, enobufs %lu, esrch %lu, "
+           "retransmits %lu, refused %lu, timeouts %lu\n",
+           __LINE__, __func__, stats.sent, stats.enobufs, stats.esrch,
+           stats.retransmits, stats.refused, stats.timeouts);
+}
 /* -----------------------------------------------------------------------------
  * */
@@ -33,6 +33,8 @@ enum OPERATION_TYPES{
     USER_RELEASE,       /*     notify kernel on user close       */
     KERNEL_REPORT,      /*     report to kubix user side         */
     NO_ACTION,          /*     remove this from code             */
+    KERNEL_REPLY,       /*     answer a sequenced USER_MESSAGE   */
+    USER_ACK,           /*     ack up to cn_msg.ack, resend rest */
 };
 /* --------------------------------------------------------------------------------
  * */
@@ -53,6 +55,21 @@ struct kubix_hdr{
                              * kubix is agnostic to payload content
                              */
 };
+/* --------------------------------------------------------------------------------
+ * timestamp trailer: with the 'timestamps' parameter on, a message the kernel
+ * sends follows its payload with it, cn_msg.len covers it. The user bus
+ * stamps it on the way and echoes it after the payload of its answer. Times
+ * are ktime_get_ns(), CLOCK_MONOTONIC in user space; unaligned, memcpy it.
+ * */
+#define KBX_TS_MAGIC        0x5354424b      /* "KBTS" */
+struct kubix_ts{
+    u32 magic;
+    u32 reserved;
+    u64 sent;               /* kernel: the message is sent */
+    u64 received;           /* user: the dispatcher routed it */
+    u64 taken;              /* user: the consumer took it off the queue */
+    u64 replied;            /* user: the answer is sent */
+};
 /* --------------------------------------------------------------------------------
  * */
 struct cm_handshake_result{
@@ -60,9 +77,23 @@ struct cm_handshake_result{
     s32 len;
     u8  data[0];
 };
+/* --------------------------------------------------------------------------------
+ * reliable delivery counters since the module load
+ * */
+struct kubix_tx_stats{
+    unsigned long sent;         /* messages multicast to the user bus */
+    unsigned long enobufs;      /* a user socket buffer was full */
+    unsigned long esrch;        /* no user bus listened on the group */
+    unsigned long retransmits;  /* unacked messages sent again */
+    unsigned long refused;      /* sends a window full of unacked ones refused */
+    unsigned long timeouts;     /* readers which gave up on the user bus */
+};
+extern int kubix_rtx_timeout_ms;  /* kubix_main.c: module parameters */
+extern int kubix_rtx_retries;
 /* --------------------------------------------------------------------------------
  * */
-void send_message_to_user(struct kubix_hdr *, u32 seq);
+int  send_message_to_user(struct chan_node *chan, struct kubix_hdr *);
+int  kubix_cb_id_valid(struct cb_id *id);
 void send_kubix_handshake(struct chan_node *chaninfo);
 void cn_user_msg_callback(struct cn_msg *msg, struct netlink_skb_parms *nsp);
 /* --------------------------------------------------------------------------------
@@ -70,6 +101,12 @@ void cn_user_msg_callback(struct cn_msg *msg, struct netlink_skb_parms *nsp);
 int  get_verified_channel(pid_t, s32, void*, int*, struct chan_node **c);
 int  get_message_from_userspace(pid_t pid, s32 uid, void **msg, int *len);
 int  send_message_to_userspace(pid_t pid, s32 uid, void*, int len, int op);
+int  get_request_from_userspace(pid_t pid, s32 uid, u32 *seq,
+                                void **msg, int *len);
+int  reply_message_to_userspace(pid_t pid, s32 uid, u32 seq,
+                                void *msg, int len, int ret);
+void kubix_get_tx_stats(struct kubix_tx_stats *stats);
+void kubix_show_tx_stats(void);
 /* --------------------------------------------------------------------------------
  * */
 #endif
@@ -0,0 +1,253 @@
+/*
+ *     kbx_latency.c
+ * 
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+
+#include "kbx_channel.h"
+#include "kbx_latency.h"
+
+#define KUBIX "latency"
+
+/* -----------------------------------------------------------------------------
+ * */
+static struct kbx_hist lat_hist[KBX_LAT_OPS][KBX_LAT_STAGES];
+static const char *lat_ops[KBX_LAT_OPS] = {
+    "KUBIX_CHANNEL", "KERNEL_REQUEST",
+};
+static const char *lat_stages[KBX_LAT_STAGES] = {
+    "rtt", "to_user", "in_user", "to_kernel", "wakeup",
+};
+/* -----------------------------------------------------------------------------
+ * */
+static int kbx_hist_index(u64 ns)
+{
+    int msb, shift;
+
+    if(ns < KBX_HIST_SUB)
+        return ns;
+    msb = fls64(ns) - 1;
+    if(msb >= KBX_HIST_MAX_BITS)
+        return KBX_HIST_BUCKETS - 1;
+    shift = msb - KBX_HIST_SUB_BITS;
+    return (shift + 1) * KBX_HIST_SUB + ((ns >> shift) & (KBX_HIST_SUB - 1));
+}
+/* -----------------------------------------------------------------------------
+ * the largest value of a bucket
+ * */
+static u64 kbx_hist_upper(int idx)
+{
+    int shift;
+
+    if(idx < KBX_HIST_SUB)
+        return idx;
+    shift = idx / KBX_HIST_SUB - 1;
+    return ((u64)(KBX_HIST_SUB + idx % KBX_HIST_SUB + 1) << shift) - 1;
+}
+/* -----------------------------------------------------------------------------
+ * */
+void kbx_hist_record(struct kbx_hist *hist, u64 ns)
+{
+    s64 max = atomic64_read(&hist->max);
+    s64 prev;
+
+    atomic_long_inc(&hist->bucket[kbx_hist_index(ns)]);
+    atomic64_inc(&hist->count);
+    while(max < (s64)ns){
+        prev = atomic64_cmpxchg(&hist->max, max, ns);
+        if(prev == max)
+            break;
+        max = prev;
+    }
+}
+/* -----------------------------------------------------------------------------
+ * the upper bound of the bucket holding the value at 'permille' of the
+ * recorded ones, the max if that is lower; 0 if there is none yet
+ * */
+u64 kbx_hist_percentile(struct kbx_hist *hist, int permille)
+{
+    u64 count = atomic64_read(&hist->count);
+    u64 max = atomic64_read(&hist->max);
+    u64 rank, seen = 0;
+    int i;
+
+    if(!count)
+        return 0;
+    rank = div_u64(count * permille + 999, 1000);
+    for(i = 0; i < KBX_HIST_BUCKETS; i++){
+        seen += atomic_long_read(&hist->bucket[i]);
+        if(seen >= rank)
+            return min(kbx_hist_upper(i), max);
+    }
+    return max;
+}
+/* -----------------------------------------------------------------------------
+ * the timestamp trailer of a message about to be sent, the buffer has room
+ * for it after the payload; a KUBIX_CHANNEL or KERNEL_REQUEST starts the
+ * round trip of the channel reader
+ *
+ * @return the trailer length, 0 if 'timestamps' is off
+ * */
+int kbx_ts_stamp(struct chan_node *chan, struct kubix_hdr *req)
+{
+    struct kubix_ts ts = { .magic = KBX_TS_MAGIC };
+
+    if(!kubix_timestamps)
+        return 0;
+    ts.sent = ktime_get_ns();
+    memcpy(req->data + req->data_len, &ts, sizeof(ts));
+    if(req->opt == KUBIX_CHANNEL || req->opt == KERNEL_REQUEST){
+        chan->ts_op = req->opt == KUBIX_CHANNEL ? KBX_LAT_CHANNEL
+                                                : KBX_LAT_REQUEST;
+        chan->ts_received = 0;
+        chan->ts_replied = 0;
+        chan->ts_arrived = 0;
+        chan->ts_sent = ts.sent;
+    }
+    return sizeof(ts);
+}
+/* -----------------------------------------------------------------------------
+ * connector callback: the answer the reader waits for came, with the user
+ * stamps if the user bus echoed the trailer of the message; chan->lock held
+ * */
+void kbx_ts_reply(struct chan_node *chan, struct kubix_hdr *rsp, int len)
+{
+    struct kubix_ts ts;
+
+    if(!chan->ts_sent)
+        return;
+    chan->ts_arrived = ktime_get_ns();
+    if(len < (int)(sizeof(*rsp) + rsp->data_len + sizeof(ts)))
+        return;
+    memcpy(&ts, rsp->data + rsp->data_len, sizeof(ts));
+    if(ts.magic != KBX_TS_MAGIC || ts.sent != chan->ts_sent)
+        return;     /* the answer to another message */
+    chan->ts_received = ts.received;
+    chan->ts_replied = ts.replied;
+}
+/* -----------------------------------------------------------------------------
+ * */
+static u64 kbx_ts_delta(u64 from, u64 to)
+{
+    return from < to ? to - from : 0;
+}
+/* -----------------------------------------------------------------------------
+ * the reader is done waiting; a round trip which got its answer goes to the
+ * histograms of its op
+ * */
+void kbx_ts_done(struct chan_node *chan, int answered)
+{
+    struct kbx_hist *hist = lat_hist[chan->ts_op];
+    u64 now;
+
+    if(!chan->ts_sent)
+        return;
+    if(answered){
+        now = ktime_get_ns();
+        kbx_hist_record(&hist[KBX_LAT_RTT], kbx_ts_delta(chan->ts_sent, now));
+        if(chan->ts_arrived)
+            kbx_hist_record(&hist[KBX_LAT_WAKEUP],
+                            kbx_ts_delta(chan->ts_arrived, now));
+        if(chan->ts_arrived && chan->ts_replied){
+            kbx_hist_record(&hist[KBX_LAT_TO_USER],
+                            kbx_ts_delta(chan->ts_sent, chan->ts_received));
+            kbx_hist_record(&hist[KBX_LAT_IN_USER],
+                            kbx_ts_delta(chan->ts_received, chan->ts_replied));
+            kbx_hist_record(&hist[KBX_LAT_TO_KERNEL],
+                            kbx_ts_delta(chan->ts_replied, chan->ts_arrived));
+        }
+    }
+    chan->ts_sent = 0;
+}
+/* -----------------------------------------------------------------------------
+ * @brief - the latency of a round trip stage since the module load
+ *
+ * @parm1 - op    - KBX_LAT_OPS
+ * @parm2 - stage - KBX_LAT_STAGES
+ * @parm3 - lat   - the percentiles in nanoseconds
+ *
+ * @return 0 on success or -EINVAL
+ * */
+int kubix_get_latency(int op, int stage, struct kubix_latency *lat)
+{
+    struct kbx_hist *hist;
+
+    if(op < 0 || KBX_LAT_OPS <= op || stage < 0 || KBX_LAT_STAGES <= stage)
+        return -EINVAL;
+    hist = &lat_hist[op][stage];
+    lat->count = atomic64_read(&hist->count);
+    lat->p50   = kbx_hist_percentile(hist, 500);
+    lat->p99   = kbx_hist_percentile(hist, 990);
+    lat->p999  = kbx_hist_percentile(hist, 999);
+    lat->max   = atomic64_read(&hist->max);
+    return 0;
+}
+EXPORT_SYMBOL(kubix_get_latency);
+/* -----------------------------------------------------------------------------
+ * */
+void kubix_show_latency(void)
+{
+    struct kubix_latency lat;
+    int op, stage;
+
+    for(op = 0; op < KBX_LAT_OPS; op++)
+        for(stage = 0; stage < KBX_LAT_STAGES; stage++){
+            if(kubix_get_latency(op, stage, &lat) || !lat.count)
+                continue;
+            printk(KERN_INFO KUBIX": %d, %s - %s %s: count %lu, p50 %llu, "
+                   "p99 %llu, p99.9 %llu, max %llu ns\n",
+                   __LINE__, __func__, lat_ops[op], lat_stages[stage],
+                   lat.count, lat.p50, lat.p99, lat.p999, lat.max);
+        }
+}
+/* -----------------------------------------------------------------------------
+ * /sys/module/kubix/parameters/latency: the histograms at runtime, a line
+ * per stage which has seen a round trip
+ * */
+static int kubix_latency_get(char *buffer, const struct kernel_param *kp)
+{
+    struct kubix_latency lat;
+    int op, stage, n = 0;
+
+    for(op = 0; op < KBX_LAT_OPS; op++)
+        for(stage = 0; stage < KBX_LAT_STAGES; stage++){
+            if(kubix_get_latency(op, stage, &lat) || !lat.count)
+                continue;
+            n += scnprintf(buffer + n, PAGE_SIZE - n,
+                           "%s %s count %lu p50 %llu p99 %llu p99.9 %llu "
+                           "max %llu\n", lat_ops[op], lat_stages[stage],
+                           lat.count, lat.p50, lat.p99, lat.p999, lat.max);
+        }
+    return n;
+}
+static int kubix_latency_set(const char *val, const struct kernel_param *kp)
+{
+    return -EPERM;
+}
+const struct kernel_param_ops kubix_latency_ops = {
+    .set = kubix_latency_set,
+    .get = kubix_latency_get,
+};
+/* -----------------------------------------------------------------------------
+ * */
@@ -0,0 +1,84 @@
+/*
+ *     kbx_latency.h
+ * 
+ * 2020+ Copyright (c) Oleg Bushmanov <olegbush55@hotmai.com>
+ * All rights reserved.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/moduleparam.h>
+
+#ifndef _KBX_LATENCY__H_
+#define _KBX_LATENCY__H_
+/* --------------------------------------------------------------------------------
+ * HDR style histogram of nanoseconds: values under KBX_HIST_SUB count one
+ * by one, each power of two over it splits in KBX_HIST_SUB buckets, so a
+ * bucket is at most 1/16 wide; the last one takes everything past 2^36 ns.
+ * Writers only add, readers walk the buckets without a lock.
+ * */
+#define KBX_HIST_SUB_BITS   4
+#define KBX_HIST_SUB        (1 << KBX_HIST_SUB_BITS)
+#define KBX_HIST_MAX_BITS   36
+#define KBX_HIST_BUCKETS    ((KBX_HIST_MAX_BITS - KBX_HIST_SUB_BITS + 1) * \
+                             KBX_HIST_SUB)
+struct kbx_hist{
+    atomic64_t    count;
+    atomic64_t    max;
+    atomic_long_t bucket[KBX_HIST_BUCKETS];
+};
+/* --------------------------------------------------------------------------------
+ * the round trips a kernel thread waits on, by the op which started it
+ * */
+enum KBX_LAT_OPS{
+    KBX_LAT_CHANNEL,        /* KUBIX_CHANNEL of get_verified_channel */
+    KBX_LAT_REQUEST,        /* KERNEL_REQUEST of send_message_to_userspace */
+    KBX_LAT_OPS
+};
+enum KBX_LAT_STAGES{
+    KBX_LAT_RTT,            /* sent to the reader woken with the answer */
+    KBX_LAT_TO_USER,        /* sent to routed by the user dispatcher */
+    KBX_LAT_IN_USER,        /* routed to answered by the user bus */
+    KBX_LAT_TO_KERNEL,      /* answered to taken by the connector callback */
+    KBX_LAT_WAKEUP,         /* taken to the reader running */
+    KBX_LAT_STAGES
+};
+struct kubix_latency{       /* nanoseconds */
+    unsigned long count;
+    u64 p50;
+    u64 p99;
+    u64 p999;
+    u64 max;
+};
+extern int kubix_timestamps;  /* kubix_main.c: 'timestamps' module parameter */
+/* --------------------------------------------------------------------------------
+ * */
+void kbx_hist_record(struct kbx_hist *hist, u64 ns);
+u64  kbx_hist_percentile(struct kbx_hist *hist, int permille);
+struct chan_node;
+struct kubix_hdr;
+int  kbx_ts_stamp(struct chan_node *chan, struct kubix_hdr *req);
+void kbx_ts_reply(struct chan_node *chan, struct kubix_hdr *rsp, int len);
+void kbx_ts_done(struct chan_node *chan, int answered);
+/* --------------------------------------------------------------------------------
+ * exported */
+int  kubix_get_latency(int op, int stage, struct kubix_latency *lat);
+void kubix_show_latency(void);
+extern const struct kernel_param_ops kubix_latency_ops;
+/* --------------------------------------------------------------------------------
+ * */
+#endif
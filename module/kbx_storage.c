@@ -42,6 +42,20 @@ static struct kubix_channels *channels = NULL; /* Channel storage for sessions *
 #define get_composite_key(v1, v2) (s64)((((u64)v2) << 32) | (u64)v1)
 #define hash_key_fmt "hash_min(pid=%d, uid=%d)=>bucket[%d]"
 #define hash_key_val(p, u, k) p, u, hash_min(k, CHAN_HT_WIDTH)
+/* --------------------------------------------------------------------------------
+ * the connector id of a channel: channels are spread over kubix_shards ids,
+ * each multicast to a group of its own and read by its own user dispatcher;
+ * the user bus computes the same shard in kubix_shard_of(), keep them equal
+ * */
+void kubix_shard_id(pid_t pid, s32 uid, struct cb_id *id)
+{
+    u64 key = ((u64)(u32)uid << 32) | (u32)pid;
+
+    id->idx = CN_SS_IDX + (u32)((key * 0x9E3779B97F4A7C15ULL) >> 32) %
+                          (u32)kubix_shards;
+    id->val = CN_SS_VAL;
+}
+EXPORT_SYMBOL(kubix_shard_id);
 /* --------------------------------------------------------------------------------
  * */
 const char *str_channel_state(int state)
@@ -121,7 +135,9 @@ int add_chan_node(pid_t pid, s32 uid, struct cb_id *id_ptr,
     chaninfo->unique_id = uid;
     chaninfo->rspmsg = NULL;
     chaninfo->rspmsg_len = 0;
+    INIT_LIST_HEAD(&chaninfo->requests);
     mutex_init(&chaninfo->lock);
+    spin_lock_init(&chaninfo->rtx_lock);
     init_waitqueue_head(&chaninfo->rspmsg_q);
 
     spin_lock(&kubix_ht_lock);
@@ -129,8 +145,7 @@ int add_chan_node(pid_t pid, s32 uid, struct cb_id *id_ptr,
         memcpy(&chaninfo->id, id_ptr, sizeof(struct cb_id));
     }
     else{
-        chaninfo->id.idx = CN_SS_IDX;
-        chaninfo->id.val = CN_SS_VAL;
+        kubix_shard_id(pid, uid, &chaninfo->id);
     }
 
     hash_add(channels->chan_hash, &chaninfo->node, key);
@@ -201,6 +216,27 @@ int del_chan_node(pid_t pid, s32 uid, struct chan_node **chaninfo_o)
 }
 EXPORT_SYMBOL(del_chan_node);
 
+/* --------------------------------------------------------------------------------
+ * frees an unlinked node with the user messages nobody has read and the
+ * kernel messages nobody has acked
+ * */
+void free_chan_node(struct chan_node *chaninfo)
+{
+    struct user_request *req, *tmp;
+    int i;
+
+    list_for_each_entry_safe(req, tmp, &chaninfo->requests, link){
+        list_del(&req->link);
+        kfree(req->data);
+        kfree(req);
+    }
+    for(i = 0; i < KBX_RTX_WINDOW; i++)
+        kfree(chaninfo->rtx[i].msg);
+    kfree(chaninfo->rspmsg);
+    kfree(chaninfo);
+}
+EXPORT_SYMBOL(free_chan_node);
+
 /* --------------------------------------------------------------------------------
  * */
 void show_chan_buckets(void)
@@ -257,7 +293,7 @@ void purify_chan_buckets(void)
                        "cbid[%d,0x%u]",
                         i, obj->pid, obj->unique_id, obj->id.idx, obj->id.val);
                 hash_del(&obj->node);
-                kfree(obj);
+                free_chan_node(obj);
             }
         }
     }
@@ -265,6 +301,20 @@ void purify_chan_buckets(void)
 }
 EXPORT_SYMBOL(purify_chan_buckets);
 
+/* --------------------------------------------------------------------------------
+ * calls fn on every node under the table lock, fn must not sleep
+ * */
+void for_each_chan_node(void (*fn)(struct chan_node *, void *), void *arg)
+{
+    struct chan_node *obj;
+    int i;
+    spin_lock(&kubix_ht_lock);
+    hash_for_each(channels->chan_hash, i, obj, node)
+        fn(obj, arg);
+    spin_unlock(&kubix_ht_lock);
+}
+EXPORT_SYMBOL(for_each_chan_node);
+
 /* --------------------------------------------------------------------------------
  * */
 #if 0
@@ -31,6 +31,8 @@
  * --------------------------------------------------------------------------------
  * */
 #define CHAN_HT_WIDTH        8
+#define KBX_MAX_SHARDS       8    /* connector ids CN_SS_IDX + [0, shards) */
+extern int kubix_shards;          /* kubix_main.c: 'shards' module parameter */
 struct kubix_channels{
     DECLARE_HASHTABLE(chan_hash, CHAN_HT_WIDTH);
     int idx_val;                  /* struct cb_id .val running */
@@ -41,6 +43,18 @@ enum CHAN_NODE_STATE{             /* netlink connector states */
     CHAN_NODE_NETLINK,            /* Controller: handshake responsed */
     CHAN_NODE_DESTROY,            /* Socket closed: KCM can reset the context */
 };
+struct user_request{              /* USER_MESSAGE with a sequence number */
+    struct list_head  link;       /* chan_node requests, FIFO */
+    u32               seq;        /* user side sequence, acked by the reply */
+    int               ret;
+    int               len;
+    u8               *data;       /* moved to the reader, it has to free */
+};
+#define KBX_RTX_WINDOW       32   /* unacked messages kept per channel */
+struct kbx_rtx_slot{              /* a message sent, not acked by the user */
+    u32               seq;
+    struct cn_msg    *msg;        /* NULL: the slot is free */
+};
 struct chan_node{
     int               state;      /* Chan Node state */
         /* channel identity */
@@ -53,6 +67,19 @@ struct chan_node{
     int               rspmsg_len; /* its length */
     u8               *rspmsg;     /* message to the userspace */
     int               user_ret;   /* save user return in void call */
+    u32               rsp_seq;    /* the message a reader waits the answer
+                                   * of, rtx_lock; 0: takes any */
+    struct list_head  requests;   /* pipelined user_request list */
+        /* reliable delivery, see kbx_channel.c */
+    spinlock_t        rtx_lock;   /* protects the retransmit window */
+    u32               rtx_acked;  /* the user has every seq up to this */
+    struct kbx_rtx_slot rtx[KBX_RTX_WINDOW]; /* by seq % KBX_RTX_WINDOW */
+        /* round trip timestamps, see kbx_latency.c */
+    u64               ts_sent;    /* the awaited message went out, 0: none */
+    int               ts_op;      /* KBX_LAT_OPS of it */
+    u64               ts_received;/* echoed by the user bus, 0 if not */
+    u64               ts_replied;
+    u64               ts_arrived; /* the answer reached the callback */
         /* Hashtable variables */
     wait_queue_head_t rspmsg_q;   /* poll/read wait queue */
     struct mutex      lock;       /* protects struct members */
@@ -62,14 +89,17 @@ struct chan_node{
 /* ss_storage.c: functions prototypes*/
 int  kubix_store_init(void);
 void kubix_store_destroy(void);
+void kubix_shard_id(pid_t pid, s32 uid, struct cb_id *id);
 #define create_chan_node(x, y, o) add_chan_node(x,  y, 0, o)
-int  add_chan_node(pid_t pid, s32 uid, struct cb_id*, /* cb_id for reserved only */
+int  add_chan_node(pid_t pid, s32 uid, struct cb_id*, /* NULL: by kubix_shard_id */
         struct chan_node **chan_node);
 int  find_chan_node(pid_t pid, s32 uid, struct chan_node**);
 int  del_chan_node(pid_t pid, s32 uid, struct chan_node**);
+void free_chan_node(struct chan_node *);
 void show_chan_buckets(void);
 void show_chan_bucket(int bkt);
 void purify_chan_buckets(void);
+void for_each_chan_node(void (*fn)(struct chan_node *, void *), void *arg);
 
 const char *str_channel_state(int state);
 
@@ -32,6 +32,7 @@
 #include "kubix_main.h"
 #include "kbx_storage.h"
 #include "kbx_channel.h"
+#include "kbx_latency.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Oleg Bushmanov");
@@ -39,12 +40,69 @@ MODULE_DESCRIPTION("Kernel to User Bus for Interprocess Transmissions");
 MODULE_VERSION("1.0");
 #define KUBIX "kubix.module: "
 
-static struct cb_id kubix_id = { CN_SS_IDX, CN_SS_VAL };
-static char kubix_name[] = "kubix";
+int kubix_shards = 1;
+module_param_named(shards, kubix_shards, int, 0444);
+MODULE_PARM_DESC(shards, "connector ids the channels are spread over, "
+		 "one user dispatcher each; 1.."__stringify(KBX_MAX_SHARDS));
+
+int kubix_rtx_timeout_ms = 200;
+module_param_named(rtx_timeout_ms, kubix_rtx_timeout_ms, int, 0644);
+MODULE_PARM_DESC(rtx_timeout_ms, "a waiting reader resends the unacked "
+		 "messages of its channel after that long");
+int kubix_rtx_retries = 10;
+module_param_named(rtx_retries, kubix_rtx_retries, int, 0644);
+MODULE_PARM_DESC(rtx_retries, "resends before a reader gives up with "
+		 "-ETIMEDOUT, 0 waits for ever");
+
+int kubix_timestamps = 0;
+module_param_named(timestamps, kubix_timestamps, int, 0644);
+MODULE_PARM_DESC(timestamps, "stamp the messages sent to the user bus and "
+		 "keep round trip latency histograms, see 'latency'");
+module_param_cb(latency, &kubix_latency_ops, NULL, 0444);
+MODULE_PARM_DESC(latency, "round trip percentiles in ns per op and stage");
+
+static struct cb_id kubix_ids[KBX_MAX_SHARDS];
+static char kubix_names[KBX_MAX_SHARDS][16];
+static int kubix_registered = 0;
 static pid_t kubix_pid =   0;
 static s32 kubix_uid   = -10;
 static struct sock *nls;
 
+/* ------------------------------------------------------------------------------
+ * one connector callback per shard id, all of them run cn_user_msg_callback
+ */
+static void kubix_del_callbacks(void)
+{
+	while(kubix_registered)
+		cn_del_callback(&kubix_ids[--kubix_registered]);
+}
+static int kubix_add_callbacks(void)
+{
+	int i, err;
+
+	if(kubix_shards < 1 || KBX_MAX_SHARDS < kubix_shards){
+		printk(KERN_ERR KUBIX" shards=%d is out of 1..%d.\n",
+			kubix_shards, KBX_MAX_SHARDS);
+		return -EINVAL;
+	}
+	for(i = 0; i < kubix_shards; i++){
+		kubix_ids[i].idx = CN_SS_IDX + i;
+		kubix_ids[i].val = CN_SS_VAL;
+		if(i)
+			snprintf(kubix_names[i], sizeof(kubix_names[i]), "kubix%d", i);
+		else
+			strscpy(kubix_names[i], "kubix", sizeof(kubix_names[i]));
+		err = cn_add_callback(&kubix_ids[i], kubix_names[i],
+				      cn_user_msg_callback);
+		if(err){
+			kubix_del_callbacks();
+			return err;
+		}
+		kubix_registered++;
+	}
+	return 0;
+}
+
 /* ------------------------------------------------------------------------------
  */
 static int kubix_init(void)
@@ -54,7 +112,7 @@ static int kubix_init(void)
 
 	printk(KERN_INFO KUBIX"... init started \n");
 
-	err = cn_add_callback(&kubix_id, kubix_name, cn_user_msg_callback);
+	err = kubix_add_callbacks();
 	if(err){
 		printk(KERN_ERR KUBIX" faield to register CN callback.\n");
 		goto err_out;
@@ -70,14 +128,15 @@ static int kubix_init(void)
     if(err < 0)
 		return err;
 
-	printk(KERN_INFO KUBIX"initialized kubix_channels with id={%u.%u}\n",
-		kubix_id.idx, kubix_id.val);
+	printk(KERN_INFO KUBIX"initialized kubix_channels with id={%u.%u}+%d\n",
+		CN_SS_IDX, CN_SS_VAL, kubix_shards);
 
 	send_kubix_handshake(kubix_node);
 
 	return 0;
 
 err_out:
+	kubix_del_callbacks();
 	if (nls && nls->sk_socket)
 		sock_release(nls->sk_socket);
 
@@ -88,11 +147,13 @@ err_out:
  */
 static void kubix_fini(void)
 {
-	cn_del_callback(&kubix_id);
+	kubix_del_callbacks();
 	if (nls && nls->sk_socket)
 		sock_release(nls->sk_socket);
 
 	kubix_store_destroy();
+	kubix_show_tx_stats();
+	kubix_show_latency();
 
 	printk(KERN_INFO KUBIX"fini stopped ... \n");
 }